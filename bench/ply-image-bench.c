@@ -0,0 +1,676 @@
+/* ply-image-bench.c - image decoding and pixel buffer benchmarks
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "ply-command-parser.h"
+#include "ply-event-loop.h"
+#include "ply-image.h"
+#include "ply-list.h"
+#include "ply-logger.h"
+#include "ply-pixel-buffer.h"
+#include "ply-utils.h"
+
+#define DEFAULT_MIN_TIME 0.25
+#define MIN_ITERATIONS 3
+#define MAX_ITERATIONS 100000
+
+typedef struct
+{
+        const char *name;
+        long        width;
+        long        height;
+} resolution_t;
+
+static const resolution_t resolutions[] =
+{
+        { "1080p", 1920, 1080 },
+        { "1440p", 2560, 1440 },
+        { "4k",    3840, 2160 },
+};
+
+static const int scales[] = { 1, 2 };
+
+static const ply_pixel_buffer_rotation_t rotations[] =
+{
+        PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,
+        PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE,
+        PLY_PIXEL_BUFFER_ROTATE_UPSIDE_DOWN,
+        PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE,
+};
+
+typedef struct
+{
+        double      min_time;
+        bool        json;
+        char       *only;
+
+        ply_list_t *assets;
+        char       *largest_asset;
+        char       *generated_bmp;
+} state_t;
+
+/* Runs one iteration of a benchmark and returns how long the part being
+ * measured took, in seconds
+ */
+typedef double (*benchmark_iteration_t) (void *data);
+
+typedef struct
+{
+        const char         *filename;
+} load_data_t;
+
+typedef struct
+{
+        ply_pixel_buffer_t *source;
+        long                width;
+        long                height;
+        double              angle;
+} transform_data_t;
+
+typedef enum
+{
+        FILL_WITH_HEX_COLOR,
+        FILL_WITH_HEX_COLOR_AT_OPACITY,
+        FILL_WITH_GRADIENT,
+        FILL_WITH_BUFFER,
+        FILL_WITH_OPAQUE_BUFFER,
+} fill_operation_t;
+
+static const char *fill_operation_names[] =
+{
+        "fill_with_hex_color",
+        "fill_with_hex_color_at_opacity",
+        "fill_with_gradient",
+        "fill_with_buffer",
+        "fill_with_opaque_buffer",
+};
+
+typedef struct
+{
+        fill_operation_t    operation;
+        ply_pixel_buffer_t *canvas;
+        ply_pixel_buffer_t *source;
+} fill_data_t;
+
+static bool
+should_run (state_t    *state,
+            const char *benchmark)
+{
+        return state->only == NULL || strcmp (state->only, benchmark) == 0;
+}
+
+static long
+run_benchmark (state_t              *state,
+               benchmark_iteration_t iteration,
+               void                 *data,
+               double               *seconds)
+{
+        long iterations;
+
+        *seconds = 0.0;
+        for (iterations = 0; iterations < MAX_ITERATIONS; iterations++) {
+                if (iterations >= MIN_ITERATIONS && *seconds >= state->min_time)
+                        break;
+
+                *seconds += iteration (data);
+        }
+
+        return iterations;
+}
+
+static void
+print_json_string (const char *string)
+{
+        const char *p;
+
+        putchar ('"');
+        for (p = string; *p != '\0'; p++) {
+                if (*p == '"' || *p == '\\')
+                        putchar ('\\');
+                putchar (*p);
+        }
+        putchar ('"');
+}
+
+static void
+report (state_t    *state,
+        const char *benchmark,
+        const char *subject,
+        long        width,
+        long        height,
+        int         scale,
+        int         rotation,
+        long        iterations,
+        double      seconds)
+{
+        double pixels, ns_per_pixel, mb_per_s;
+
+        pixels = (double) width * height * iterations;
+        ns_per_pixel = seconds * 1000000000.0 / pixels;
+        mb_per_s = pixels * sizeof(uint32_t) / seconds / 1000000.0;
+
+        if (!state->json) {
+                printf ("%-31s %-40s %5ldx%-5ld x%d %3d°  %9.3f ns/pixel %9.1f MB/s  (%ld iterations)\n",
+                        benchmark, subject, width, height, scale, rotation * 90,
+                        ns_per_pixel, mb_per_s, iterations);
+                return;
+        }
+
+        printf ("{\"benchmark\":");
+        print_json_string (benchmark);
+        printf (",\"subject\":");
+        print_json_string (subject);
+        printf (",\"width\":%ld,\"height\":%ld,\"scale\":%d,\"rotation\":%d,"
+                "\"iterations\":%ld,\"seconds\":%.6f,"
+                "\"ns_per_pixel\":%.4f,\"mb_per_s\":%.2f}\n",
+                width, height, scale, rotation * 90,
+                iterations, seconds, ns_per_pixel, mb_per_s);
+}
+
+static bool
+has_suffix (const char *string,
+            const char *suffix)
+{
+        size_t length, suffix_length;
+
+        length = strlen (string);
+        suffix_length = strlen (suffix);
+
+        return length >= suffix_length &&
+               strcasecmp (string + length - suffix_length, suffix) == 0;
+}
+
+static void
+find_assets (state_t    *state,
+             const char *directory)
+{
+        struct dirent **entries;
+        int number_of_entries, i;
+
+        number_of_entries = scandir (directory, &entries, NULL, alphasort);
+
+        if (number_of_entries < 0)
+                return;
+
+        for (i = 0; i < number_of_entries; i++) {
+                char *path;
+
+                path = NULL;
+                asprintf (&path, "%s/%s", directory, entries[i]->d_name);
+
+                if (entries[i]->d_name[0] != '.' && ply_directory_exists (path)) {
+                        find_assets (state, path);
+                        free (path);
+                } else if (has_suffix (entries[i]->d_name, ".png") ||
+                           has_suffix (entries[i]->d_name, ".bmp")) {
+                        ply_list_append_data (state->assets, path);
+                } else {
+                        free (path);
+                }
+
+                free (entries[i]);
+        }
+        free (entries);
+}
+
+static bool
+find_largest_asset (state_t *state)
+{
+        ply_list_node_t *node;
+        long largest_size;
+
+        largest_size = 0;
+        node = ply_list_get_first_node (state->assets);
+        while (node != NULL) {
+                char *filename = ply_list_node_get_data (node);
+                ply_image_t *image;
+
+                image = ply_image_new (filename);
+                if (ply_image_load (image) &&
+                    ply_image_get_width (image) * ply_image_get_height (image) > largest_size) {
+                        largest_size = ply_image_get_width (image) * ply_image_get_height (image);
+                        state->largest_asset = filename;
+                }
+                ply_image_free (image);
+
+                node = ply_list_get_next_node (state->assets, node);
+        }
+
+        ply_image_cache_flush ();
+
+        return state->largest_asset != NULL;
+}
+
+static void
+write_le (FILE    *fp,
+          uint32_t value,
+          int      bytes)
+{
+        int i;
+
+        for (i = 0; i < bytes; i++) {
+                fputc (value & 0xff, fp);
+                value >>= 8;
+        }
+}
+
+/* None of the themes ship a BMP, so convert the largest asset to a
+ * 24bpp BMP like the ones firmware provides through BGRT
+ */
+static bool
+generate_bmp (state_t *state)
+{
+        ply_image_t *image;
+        char *filename;
+        uint32_t *bytes;
+        long width, height, x, y;
+        unsigned long pitch;
+        FILE *fp;
+        int fd;
+
+        image = ply_image_new (state->largest_asset);
+        if (!ply_image_load (image)) {
+                ply_image_free (image);
+                return false;
+        }
+
+        filename = strdup ("/tmp/ply-image-bench-XXXXXX");
+        fd = mkstemp (filename);
+        if (fd < 0) {
+                free (filename);
+                ply_image_free (image);
+                return false;
+        }
+        fp = fdopen (fd, "w");
+
+        width = ply_image_get_width (image);
+        height = ply_image_get_height (image);
+        bytes = ply_pixel_buffer_get_argb32_data (ply_image_get_buffer (image));
+        pitch = (3 * width + 3) & ~3;
+
+        fputs ("BM", fp);
+        write_le (fp, 14 + 40 + pitch * height, 4);
+        write_le (fp, 0, 4);
+        write_le (fp, 14 + 40, 4);
+
+        write_le (fp, 40, 4);
+        write_le (fp, width, 4);
+        write_le (fp, height, 4);
+        write_le (fp, 1, 2);
+        write_le (fp, 24, 2);
+        write_le (fp, 0, 4);
+        write_le (fp, pitch * height, 4);
+        write_le (fp, 2835, 4);
+        write_le (fp, 2835, 4);
+        write_le (fp, 0, 4);
+        write_le (fp, 0, 4);
+
+        for (y = height - 1; y >= 0; y--) {
+                for (x = 0; x < width; x++) {
+                        write_le (fp, bytes[y * width + x], 3);
+                }
+                for (x = 3 * width; x < (long) pitch; x++) {
+                        fputc (0, fp);
+                }
+        }
+
+        fclose (fp);
+        ply_image_free (image);
+        ply_image_cache_flush ();
+
+        state->generated_bmp = filename;
+        return true;
+}
+
+static double
+load_iteration (load_data_t *data)
+{
+        ply_image_t *image;
+        double start_time, elapsed_time;
+
+        ply_image_cache_flush ();
+        image = ply_image_new (data->filename);
+
+        start_time = ply_get_timestamp ();
+        ply_image_load (image);
+        elapsed_time = ply_get_timestamp () - start_time;
+
+        ply_image_free (image);
+
+        return elapsed_time;
+}
+
+static void
+benchmark_load (state_t    *state,
+                const char *filename,
+                const char *subject)
+{
+        load_data_t data = { filename };
+        ply_image_t *image;
+        long iterations;
+        double seconds;
+
+        image = ply_image_new (filename);
+        if (!ply_image_load (image)) {
+                ply_image_free (image);
+                return;
+        }
+
+        iterations = run_benchmark (state, (benchmark_iteration_t) load_iteration, &data, &seconds);
+        report (state, has_suffix (subject, ".png") ? "load_png" : "load_bmp", subject,
+                ply_image_get_width (image), ply_image_get_height (image), 1, 0,
+                iterations, seconds);
+
+        ply_image_free (image);
+        ply_image_cache_flush ();
+}
+
+static double
+resize_iteration (transform_data_t *data)
+{
+        ply_pixel_buffer_t *buffer;
+        double start_time, elapsed_time;
+
+        start_time = ply_get_timestamp ();
+        buffer = ply_pixel_buffer_resize (data->source, data->width, data->height);
+        elapsed_time = ply_get_timestamp () - start_time;
+
+        ply_pixel_buffer_free (buffer);
+
+        return elapsed_time;
+}
+
+static double
+rotate_iteration (transform_data_t *data)
+{
+        ply_pixel_buffer_t *buffer;
+        double start_time, elapsed_time;
+
+        start_time = ply_get_timestamp ();
+        buffer = ply_pixel_buffer_rotate (data->source, data->width / 2, data->height / 2, data->angle);
+        elapsed_time = ply_get_timestamp () - start_time;
+
+        ply_pixel_buffer_free (buffer);
+
+        return elapsed_time;
+}
+
+static double
+tile_iteration (transform_data_t *data)
+{
+        ply_pixel_buffer_t *buffer;
+        double start_time, elapsed_time;
+
+        start_time = ply_get_timestamp ();
+        buffer = ply_pixel_buffer_tile (data->source, data->width, data->height);
+        elapsed_time = ply_get_timestamp () - start_time;
+
+        ply_pixel_buffer_free (buffer);
+
+        return elapsed_time;
+}
+
+static double
+fill_iteration (fill_data_t *data)
+{
+        double start_time;
+
+        start_time = ply_get_timestamp ();
+
+        switch (data->operation) {
+        case FILL_WITH_HEX_COLOR:
+                ply_pixel_buffer_fill_with_hex_color (data->canvas, NULL, 0x5d5950);
+                break;
+        case FILL_WITH_HEX_COLOR_AT_OPACITY:
+                ply_pixel_buffer_fill_with_hex_color_at_opacity (data->canvas, NULL, 0x5d5950, 0.5);
+                break;
+        case FILL_WITH_GRADIENT:
+                ply_pixel_buffer_fill_with_gradient (data->canvas, NULL, 0x807c71, 0x3a362f);
+                break;
+        case FILL_WITH_BUFFER:
+        case FILL_WITH_OPAQUE_BUFFER:
+                ply_pixel_buffer_fill_with_buffer (data->canvas, data->source, 0, 0);
+                break;
+        }
+
+        return ply_get_timestamp () - start_time;
+}
+
+static void
+benchmark_transforms (state_t            *state,
+                      ply_pixel_buffer_t *source)
+{
+        const char *subject;
+        size_t r, s, t;
+
+        subject = state->largest_asset;
+
+        for (r = 0; r < PLY_NUMBER_OF_ELEMENTS (resolutions); r++) {
+                for (s = 0; s < PLY_NUMBER_OF_ELEMENTS (scales); s++) {
+                        transform_data_t data;
+                        long iterations;
+                        double seconds;
+
+                        data.source = source;
+                        data.width = resolutions[r].width / scales[s];
+                        data.height = resolutions[r].height / scales[s];
+                        data.angle = 0.0;
+
+                        if (should_run (state, "resize")) {
+                                iterations = run_benchmark (state, (benchmark_iteration_t) resize_iteration, &data, &seconds);
+                                report (state, "resize", subject, data.width, data.height, scales[s], 0, iterations, seconds);
+                        }
+
+                        if (should_run (state, "tile")) {
+                                iterations = run_benchmark (state, (benchmark_iteration_t) tile_iteration, &data, &seconds);
+                                report (state, "tile", subject, data.width, data.height, scales[s], 0, iterations, seconds);
+                        }
+
+                        if (!should_run (state, "rotate"))
+                                continue;
+
+                        data.source = ply_pixel_buffer_resize (source, data.width, data.height);
+                        for (t = 0; t < PLY_NUMBER_OF_ELEMENTS (rotations); t++) {
+                                data.angle = t * M_PI / 2;
+                                iterations = run_benchmark (state, (benchmark_iteration_t) rotate_iteration, &data, &seconds);
+                                report (state, "rotate", subject, data.width, data.height, scales[s], t, iterations, seconds);
+                        }
+                        ply_pixel_buffer_free (data.source);
+                }
+        }
+}
+
+static void
+benchmark_fills (state_t            *state,
+                 ply_pixel_buffer_t *source)
+{
+        size_t r, s, t, o;
+
+        for (r = 0; r < PLY_NUMBER_OF_ELEMENTS (resolutions); r++) {
+                for (s = 0; s < PLY_NUMBER_OF_ELEMENTS (scales); s++) {
+                        ply_pixel_buffer_t *screen_source, *opaque_source;
+                        long width, height;
+
+                        width = resolutions[r].width / scales[s];
+                        height = resolutions[r].height / scales[s];
+
+                        screen_source = ply_pixel_buffer_resize (source, width, height);
+                        opaque_source = ply_pixel_buffer_copy (screen_source);
+                        ply_pixel_buffer_fill_with_hex_color (opaque_source, NULL, 0x000000);
+                        ply_pixel_buffer_fill_with_buffer (opaque_source, screen_source, 0, 0);
+                        ply_pixel_buffer_set_opaque (opaque_source, true);
+
+                        for (t = 0; t < PLY_NUMBER_OF_ELEMENTS (rotations); t++) {
+                                fill_data_t data;
+
+                                data.canvas = ply_pixel_buffer_new_with_device_rotation (resolutions[r].width,
+                                                                                         resolutions[r].height,
+                                                                                         rotations[t]);
+                                ply_pixel_buffer_set_device_scale (data.canvas, scales[s]);
+
+                                for (o = 0; o < PLY_NUMBER_OF_ELEMENTS (fill_operation_names); o++) {
+                                        long iterations;
+                                        double seconds;
+
+                                        if (!should_run (state, fill_operation_names[o]))
+                                                continue;
+
+                                        data.operation = o;
+                                        data.source = o == FILL_WITH_OPAQUE_BUFFER ? opaque_source : screen_source;
+
+                                        iterations = run_benchmark (state, (benchmark_iteration_t) fill_iteration, &data, &seconds);
+                                        report (state, fill_operation_names[o], resolutions[r].name,
+                                                resolutions[r].width, resolutions[r].height,
+                                                scales[s], t, iterations, seconds);
+                                }
+
+                                ply_pixel_buffer_free (data.canvas);
+                        }
+
+                        ply_pixel_buffer_free (opaque_source);
+                        ply_pixel_buffer_free (screen_source);
+                }
+        }
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        state_t state = { 0 };
+        ply_command_parser_t *command_parser;
+        ply_list_node_t *node;
+        ply_image_t *source_image;
+        char *min_time = NULL;
+        char *assets_directory = NULL;
+        bool should_help = false;
+
+        command_parser = ply_command_parser_new ("ply-image-bench", "Image decoding and pixel buffer benchmarks");
+
+        ply_command_parser_add_options (command_parser,
+                                        "help", "This help message", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "assets", "Directory to search for PNG and BMP assets (default: themes)", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        "json", "Write one JSON object per measurement", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "min-time", "Minimum number of seconds to spend on each measurement", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        "only", "Only run the named benchmark", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        NULL);
+
+        if (!ply_command_parser_parse_arguments (command_parser, ply_event_loop_get_default (), argv, argc)) {
+                char *help_string;
+
+                help_string = ply_command_parser_get_help_string (command_parser);
+                ply_error_without_new_line ("%s", help_string);
+                free (help_string);
+                return EX_USAGE;
+        }
+
+        ply_command_parser_get_options (command_parser,
+                                        "help", &should_help,
+                                        "assets", &assets_directory,
+                                        "json", &state.json,
+                                        "min-time", &min_time,
+                                        "only", &state.only,
+                                        NULL);
+
+        if (should_help) {
+                char *help_string;
+
+                help_string = ply_command_parser_get_help_string (command_parser);
+                printf ("%s", help_string);
+                free (help_string);
+                return 0;
+        }
+
+        state.min_time = DEFAULT_MIN_TIME;
+        if (min_time != NULL)
+                state.min_time = atof (min_time);
+
+        state.assets = ply_list_new ();
+        find_assets (&state, assets_directory != NULL ? assets_directory : "themes");
+
+        if (!find_largest_asset (&state)) {
+                ply_error ("ply-image-bench: no loadable PNG or BMP assets found");
+                return EX_NOINPUT;
+        }
+
+        if (state.json) {
+                printf ("{\"benchmark\":\"meta\",\"version\":");
+                print_json_string (PACKAGE_VERSION);
+                printf (",\"largest_asset\":");
+                print_json_string (state.largest_asset);
+                printf (",\"min_time\":%.3f}\n", state.min_time);
+        }
+
+        if (should_run (&state, "load_png") || should_run (&state, "load_bmp")) {
+                node = ply_list_get_first_node (state.assets);
+                while (node != NULL) {
+                        char *filename = ply_list_node_get_data (node);
+
+                        if (should_run (&state, has_suffix (filename, ".png") ? "load_png" : "load_bmp"))
+                                benchmark_load (&state, filename, filename);
+
+                        node = ply_list_get_next_node (state.assets, node);
+                }
+        }
+
+        if (should_run (&state, "load_bmp") && generate_bmp (&state)) {
+                char *subject = NULL;
+
+                asprintf (&subject, "%s.bmp", state.largest_asset);
+                benchmark_load (&state, state.generated_bmp, subject);
+                free (subject);
+
+                unlink (state.generated_bmp);
+                free (state.generated_bmp);
+        }
+
+        source_image = ply_image_new (state.largest_asset);
+        ply_image_load (source_image);
+
+        benchmark_transforms (&state, ply_image_get_buffer (source_image));
+        benchmark_fills (&state, ply_image_get_buffer (source_image));
+
+        ply_image_free (source_image);
+
+        node = ply_list_get_first_node (state.assets);
+        while (node != NULL) {
+                free (ply_list_node_get_data (node));
+                node = ply_list_get_next_node (state.assets, node);
+        }
+        ply_list_free (state.assets);
+        ply_command_parser_free (command_parser);
+        free (assets_directory);
+        free (min_time);
+        free (state.only);
+
+        return 0;
+}
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -685,10 +685,10 @@ static void
 on_idle (ply_boot_splash_t *splash)
 {
         ply_trace ("splash now idle");
-        ply_event_loop_watch_for_timeout (splash->loop, 0.01,
-                                          (ply_event_loop_timeout_handler_t)
-                                          splash->idle_handler,
-                                          splash->idle_handler_user_data);
+        ply_event_loop_watch_for_idle (splash->loop,
+                                       (ply_event_loop_idle_handler_t)
+                                       splash->idle_handler,
+                                       splash->idle_handler_user_data);
         splash->idle_handler = NULL;
         splash->idle_handler_user_data = NULL;
 }
@@ -710,10 +710,10 @@ ply_boot_splash_become_idle (ply_boot_splash_t                *splash,
 
         ply_trace ("telling splash to become idle");
         if (splash->plugin_interface->become_idle == NULL) {
-                ply_event_loop_watch_for_timeout (splash->loop, 0.01,
-                                                  (ply_event_loop_timeout_handler_t)
-                                                  idle_handler,
-                                                  user_data);
+                ply_event_loop_watch_for_idle (splash->loop,
+                                               (ply_event_loop_idle_handler_t)
+                                               idle_handler,
+                                               user_data);
 
                 return;
         }
@@ -50,6 +50,7 @@ struct _ply_pixel_buffer
         ply_region_t   *updated_areas; /* in device pixels */
         uint32_t        is_opaque : 1;
         int             device_scale;
+        int             reference_count;
 
         ply_pixel_buffer_rotation_t device_rotation;
 };
@@ -386,6 +387,7 @@ ply_pixel_buffer_new_with_device_rotation (unsigned long               width,
         buffer->logical_area = buffer->area;
         buffer->device_scale = 1;
         buffer->device_rotation = device_rotation;
+        buffer->reference_count = 1;
 
         buffer->clip_areas = ply_list_new ();
         ply_pixel_buffer_push_clip_area (buffer, &buffer->area);
@@ -411,12 +413,55 @@ ply_pixel_buffer_free (ply_pixel_buffer_t *buffer)
         if (buffer == NULL)
                 return;
 
+        buffer->reference_count--;
+        assert (buffer->reference_count >= 0);
+
+        if (buffer->reference_count > 0)
+                return;
+
         free_clip_areas (buffer);
         free (buffer->bytes);
         ply_region_free (buffer->updated_areas);
         free (buffer);
 }
 
+void
+ply_pixel_buffer_take_reference (ply_pixel_buffer_t *buffer)
+{
+        assert (buffer != NULL);
+
+        buffer->reference_count++;
+}
+
+bool
+ply_pixel_buffer_is_shared (ply_pixel_buffer_t *buffer)
+{
+        assert (buffer != NULL);
+
+        return buffer->reference_count > 1;
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_copy (ply_pixel_buffer_t *old_buffer)
+{
+        ply_pixel_buffer_t *buffer;
+
+        assert (old_buffer != NULL);
+
+        buffer = ply_pixel_buffer_new (old_buffer->area.width, old_buffer->area.height);
+        memcpy (buffer->bytes, old_buffer->bytes,
+                old_buffer->area.width * old_buffer->area.height * sizeof(uint32_t));
+
+        /* area is already in the old buffer's device orientation, so copy
+         * the rotation over as is rather than through set_device_rotation
+         */
+        buffer->device_rotation = old_buffer->device_rotation;
+        ply_pixel_buffer_set_device_scale (buffer, old_buffer->device_scale);
+        buffer->is_opaque = old_buffer->is_opaque;
+
+        return buffer;
+}
+
 void
 ply_pixel_buffer_get_size (ply_pixel_buffer_t *buffer,
                            ply_rectangle_t    *size)
@@ -895,6 +940,122 @@ ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (ply_pixel_buffer_t *canv
         }
 }
 
+/* Draws the source with an affine transform, sampling it directly rather
+ * than going through a transformed copy.  The transform maps source pixels
+ * to logical canvas pixels: x' = xx * x + xy * y + x0 and
+ * y' = yx * x + yy * y + y0, given as { xx, xy, yx, yy, x0, y0 }.
+ */
+void
+ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip_and_transform (ply_pixel_buffer_t *canvas,
+                                                                      ply_pixel_buffer_t *source,
+                                                                      const double        transform[6],
+                                                                      ply_rectangle_t    *clip_area,
+                                                                      float               opacity)
+{
+        ply_rectangle_t fill_area;
+        ply_rectangle_t cropped_area;
+        double min_x, min_y, max_x, max_y;
+        double inverse[4];
+        double determinant, scale;
+        double source_x, source_y;
+        unsigned long row, column;
+        uint8_t opacity_as_byte;
+        uint32_t *bytes;
+        int width, height;
+        int i;
+
+        assert (canvas != NULL);
+        assert (source != NULL);
+
+        determinant = transform[0] * transform[3] - transform[1] * transform[2];
+        if (fabs (determinant) < 1e-9)
+                return;
+
+        width = source->area.width;
+        height = source->area.height;
+        bytes = ply_pixel_buffer_get_argb32_data (source);
+
+        /* The bounding box of the transformed source, in logical pixels */
+        min_x = max_x = transform[4];
+        min_y = max_y = transform[5];
+        for (i = 1; i < 4; i++) {
+                double corner_x = (i & 1) ? source->logical_area.width : 0;
+                double corner_y = (i & 2) ? source->logical_area.height : 0;
+                double x = transform[0] * corner_x + transform[1] * corner_y + transform[4];
+                double y = transform[2] * corner_x + transform[3] * corner_y + transform[5];
+
+                min_x = MIN (min_x, x);
+                min_y = MIN (min_y, y);
+                max_x = MAX (max_x, x);
+                max_y = MAX (max_y, y);
+        }
+
+        fill_area.x = floor (min_x);
+        fill_area.y = floor (min_y);
+        fill_area.width = ceil (max_x) - fill_area.x;
+        fill_area.height = ceil (max_y) - fill_area.y;
+
+        ply_pixel_buffer_crop_area_to_clip_area (canvas, &fill_area, &cropped_area);
+
+        if (clip_area) {
+                ply_rectangle_t device_clip_area;
+
+                device_clip_area = *clip_area;
+                ply_pixel_buffer_adjust_area_for_device_scale (canvas, &device_clip_area);
+                ply_rectangle_intersect (&cropped_area, &device_clip_area, &cropped_area);
+        }
+
+        if (cropped_area.width == 0 || cropped_area.height == 0)
+                return;
+
+        /* Maps the centres of canvas device pixels back to source pixels */
+        scale = (double) source->device_scale / canvas->device_scale;
+        inverse[0] = transform[3] / determinant * scale;
+        inverse[1] = -transform[1] / determinant * scale;
+        inverse[2] = -transform[2] / determinant * scale;
+        inverse[3] = transform[0] / determinant * scale;
+
+        opacity_as_byte = (uint8_t) (opacity * 255.0);
+
+        /* Each pixel is sampled from scratch, rather than stepped to, so it
+         * comes out the same however the area is split up between draws.
+         */
+        for (row = cropped_area.y; row < cropped_area.y + cropped_area.height; row++) {
+                double y = row + 0.5 - transform[5] * canvas->device_scale;
+
+                for (column = cropped_area.x; column < cropped_area.x + cropped_area.width; column++) {
+                        double x = column + 0.5 - transform[4] * canvas->device_scale;
+                        uint32_t pixel_value;
+
+                        source_x = inverse[0] * x + inverse[1] * y - 0.5;
+                        source_y = inverse[2] * x + inverse[3] * y - 0.5;
+
+                        if (source_x >= -0.5 && source_x < width - 0.5 &&
+                            source_y >= -0.5 && source_y < height - 0.5) {
+                                /* Rounding errors would otherwise blend in a
+                                 * sliver of the neighbouring pixels */
+                                if (fabs (source_x - rint (source_x)) < 1e-6)
+                                        source_x = rint (source_x);
+                                if (fabs (source_y - rint (source_y)) < 1e-6)
+                                        source_y = rint (source_y);
+
+                                pixel_value = ply_pixels_interpolate (bytes, width, height,
+                                                                      MAX (source_x, 0),
+                                                                      MAX (source_y, 0));
+                                if ((pixel_value >> 24) != 0x00) {
+                                        pixel_value = make_pixel_value_translucent (pixel_value,
+                                                                                    opacity_as_byte);
+                                        ply_pixel_buffer_blend_value_at_pixel (canvas,
+                                                                               column, row,
+                                                                               pixel_value);
+                                }
+                        }
+                }
+        }
+
+        ply_pixel_buffer_add_updated_area (canvas, &cropped_area);
+}
+
 void
 ply_pixel_buffer_fill_with_buffer_at_opacity (ply_pixel_buffer_t *canvas,
                                               ply_pixel_buffer_t *source,
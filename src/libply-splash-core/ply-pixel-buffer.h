@@ -52,7 +52,13 @@ ply_pixel_buffer_t *
 ply_pixel_buffer_new_with_device_rotation (unsigned long width,
                                            unsigned long height,
                                            ply_pixel_buffer_rotation_t device_rotation);
+/* Buffers are reference counted, ply_pixel_buffer_free drops a reference.
+ * A buffer that is shared must be treated as read-only.
+ */
 void ply_pixel_buffer_free (ply_pixel_buffer_t *buffer);
+void ply_pixel_buffer_take_reference (ply_pixel_buffer_t *buffer);
+bool ply_pixel_buffer_is_shared (ply_pixel_buffer_t *buffer);
+ply_pixel_buffer_t *ply_pixel_buffer_copy (ply_pixel_buffer_t *old_buffer);
 void ply_pixel_buffer_get_size (ply_pixel_buffer_t *buffer,
                                 ply_rectangle_t    *size);
 int  ply_pixel_buffer_get_device_scale (ply_pixel_buffer_t *buffer);
@@ -124,6 +130,11 @@ void ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (ply_pixel_buffer_t
                                                              int                 y_offset,
                                                              ply_rectangle_t    *clip_area,
                                                              float               opacity);
+void ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip_and_transform (ply_pixel_buffer_t *canvas,
+                                                                           ply_pixel_buffer_t *source,
+                                                                           const double        transform[6],
+                                                                           ply_rectangle_t    *clip_area,
+                                                                           float               opacity);
 void ply_pixel_buffer_fill_with_buffer_at_opacity (ply_pixel_buffer_t *canvas,
                                                    ply_pixel_buffer_t *source,
                                                    int                 x_offset,
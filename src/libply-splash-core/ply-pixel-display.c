@@ -57,8 +57,12 @@ struct _ply_pixel_display
         void                            *draw_handler_user_data;
 
         int                              pause_count;
+
+        uint32_t                         flush_is_queued : 1;
 };
 
+static void on_flush_idle (ply_pixel_display_t *display);
+
 ply_pixel_display_t *
 ply_pixel_display_new (ply_renderer_t      *renderer,
                        ply_renderer_head_t *head)
@@ -119,9 +123,38 @@ ply_pixel_display_flush (ply_pixel_display_t *display)
         if (display->pause_count > 0)
                 return;
 
+        if (display->flush_is_queued) {
+                ply_event_loop_stop_watching_for_idle (display->loop,
+                                                       (ply_event_loop_idle_handler_t)
+                                                       on_flush_idle,
+                                                       display);
+                display->flush_is_queued = false;
+        }
+
         ply_renderer_flush_head (display->renderer, display->head);
 }
 
+static void
+on_flush_idle (ply_pixel_display_t *display)
+{
+        display->flush_is_queued = false;
+        ply_pixel_display_flush (display);
+}
+
+/* Areas drawn while handling one batch of events go out in a single flush */
+static void
+ply_pixel_display_queue_flush (ply_pixel_display_t *display)
+{
+        if (display->pause_count > 0 || display->flush_is_queued)
+                return;
+
+        display->flush_is_queued = true;
+        ply_event_loop_watch_for_idle (display->loop,
+                                       (ply_event_loop_idle_handler_t)
+                                       on_flush_idle,
+                                       display);
+}
+
 void
 ply_pixel_display_pause_updates (ply_pixel_display_t *display)
 {
@@ -166,7 +199,7 @@ ply_pixel_display_draw_area (ply_pixel_display_t *display,
                 ply_pixel_buffer_pop_clip_area (pixel_buffer);
         }
 
-        ply_pixel_display_flush (display);
+        ply_pixel_display_queue_flush (display);
 }
 
 void
@@ -175,6 +208,12 @@ ply_pixel_display_free (ply_pixel_display_t *display)
         if (display == NULL)
                 return;
 
+        if (display->flush_is_queued)
+                ply_event_loop_stop_watching_for_idle (display->loop,
+                                                       (ply_event_loop_idle_handler_t)
+                                                       on_flush_idle,
+                                                       display);
+
         free (display);
 }
 
@@ -67,7 +67,7 @@ struct _ply_animation
         int                  frame_number;
         long                 x, y;
         long                 width, height;
-        double               start_time, previous_time, now;
+        uint64_t             start_time, previous_time, now;
         uint32_t             is_stopped : 1;
         uint32_t             stop_requested : 1;
 };
@@ -170,18 +170,21 @@ animate_at_time (ply_animation_t *animation,
 static void
 on_timeout (ply_animation_t *animation)
 {
-        double sleep_time;
+        uint64_t next_frame_time, earliest_time;
         bool should_continue;
 
         animation->previous_time = animation->now;
-        animation->now = ply_get_timestamp ();
+        animation->now = ply_get_monotonic_time ();
 
         should_continue = animate_at_time (animation,
-                                           animation->now - animation->start_time);
+                                           (double) (animation->now - animation->start_time) / PLY_NANOSECONDS_PER_SECOND);
 
-        sleep_time = 1.0 / FRAMES_PER_SECOND;
-        sleep_time = MAX (sleep_time - (ply_get_timestamp () - animation->now),
-                          0.005);
+        /* Frames are due a frame apart, unless drawing ran so late that
+         * the loop would get no chance to do anything else.
+         */
+        next_frame_time = animation->now + PLY_NANOSECONDS_PER_SECOND / FRAMES_PER_SECOND;
+        earliest_time = ply_get_monotonic_time () + PLY_NANOSECONDS_PER_SECOND / 200;
+        next_frame_time = MAX (next_frame_time, earliest_time);
 
         if (!should_continue) {
                 if (animation->stop_trigger != NULL) {
@@ -190,10 +193,10 @@ on_timeout (ply_animation_t *animation)
                         animation->stop_trigger = NULL;
                 }
         } else {
-                ply_event_loop_watch_for_timeout (animation->loop,
-                                                  sleep_time,
-                                                  (ply_event_loop_timeout_handler_t)
-                                                  on_timeout, animation);
+                ply_event_loop_watch_for_deadline (animation->loop,
+                                                   next_frame_time,
+                                                   (ply_event_loop_timeout_handler_t)
+                                                   on_timeout, animation);
         }
 }
 
@@ -323,7 +326,7 @@ ply_animation_start (ply_animation_t     *animation,
         animation->x = x;
         animation->y = y;
 
-        animation->start_time = ply_get_timestamp ();
+        animation->start_time = ply_get_monotonic_time ();
 
         ply_event_loop_watch_for_timeout (animation->loop,
                                           1.0 / FRAMES_PER_SECOND,
@@ -30,11 +30,14 @@
 #include "ply-pixel-buffer.h"
 
 #include <assert.h>
+#include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -47,12 +50,37 @@
 
 #include <linux/fb.h>
 
+#include "ply-event-loop.h"
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include "ply-logger.h"
 #include "ply-utils.h"
 
+/* How much of the image to decode per event loop iteration when
+ * loading progressively
+ */
+#define PLY_IMAGE_PIXELS_PER_BAND (256 * 1024)
+
+/* How much memory the image cache may hold on to for buffers that no
+ * image is using anymore
+ */
+#define PLY_IMAGE_CACHE_MAX_UNUSED_BYTES (16 * 1024 * 1024)
+
 struct _ply_image
 {
-        char               *filename;
-        ply_pixel_buffer_t *buffer;
+        char                    *filename;
+        ply_pixel_buffer_t      *buffer;
+        char                    *cache_key;
+
+        FILE                    *fp;
+        png_struct              *png;
+        png_info                *png_info;
+        png_uint_32              next_row;
+        png_uint_32              rows_left;
+
+        ply_event_loop_t        *loop;
+        ply_image_load_handler_t load_handler;
+        void                    *load_handler_user_data;
 };
 
 struct bmp_file_header {
@@ -76,8 +104,202 @@ struct bmp_dib_header {
         uint32_t colors_important;
 } __attribute__((__packed__));
 
+#define BMP_COMPRESSION_RGB            0
+#define BMP_COMPRESSION_BITFIELDS      3
+#define BMP_COMPRESSION_ALPHABITFIELDS 6
+
+typedef struct
+{
+        char               *key;
+        ply_pixel_buffer_t *buffer;
+        ply_list_node_t    *node;
+} ply_image_cache_entry_t;
+
 const uint8_t png_header[8] = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
 
+/* Decoded and transformed images, shared by every image in the process.
+ * Entries are keyed by the identity of the file they were loaded from plus
+ * the chain of transformations applied to it, and hold a reference on the
+ * buffer.  The list is kept in least recently used order.
+ */
+static ply_hashtable_t *image_cache;
+static ply_list_t *image_cache_entries;
+
+static size_t
+get_buffer_size_in_bytes (ply_pixel_buffer_t *buffer)
+{
+        int scale;
+
+        scale = ply_pixel_buffer_get_device_scale (buffer);
+
+        return ply_pixel_buffer_get_width (buffer) * scale *
+               ply_pixel_buffer_get_height (buffer) * scale *
+               sizeof(uint32_t);
+}
+
+static char *
+get_file_cache_key (const char *filename)
+{
+        struct stat file_info;
+        char *key;
+
+        if (stat (filename, &file_info) < 0)
+                return NULL;
+
+        key = NULL;
+        asprintf (&key, "%s@%llx:%llx:%lld.%09ld:%lld",
+                  filename,
+                  (unsigned long long) file_info.st_dev,
+                  (unsigned long long) file_info.st_ino,
+                  (long long) file_info.st_mtim.tv_sec,
+                  (long) file_info.st_mtim.tv_nsec,
+                  (long long) file_info.st_size);
+
+        return key;
+}
+
+static void
+image_cache_remove_entry (ply_image_cache_entry_t *entry)
+{
+        ply_hashtable_remove (image_cache, entry->key);
+        ply_list_remove_node (image_cache_entries, entry->node);
+        ply_pixel_buffer_free (entry->buffer);
+        free (entry->key);
+        free (entry);
+}
+
+static void
+image_cache_trim (void)
+{
+        ply_list_node_t *node;
+        size_t unused_bytes;
+
+        if (image_cache_entries == NULL)
+                return;
+
+        unused_bytes = 0;
+        node = ply_list_get_first_node (image_cache_entries);
+        while (node != NULL) {
+                ply_image_cache_entry_t *entry = ply_list_node_get_data (node);
+
+                if (!ply_pixel_buffer_is_shared (entry->buffer))
+                        unused_bytes += get_buffer_size_in_bytes (entry->buffer);
+
+                node = ply_list_get_next_node (image_cache_entries, node);
+        }
+
+        node = ply_list_get_first_node (image_cache_entries);
+        while (node != NULL && unused_bytes > PLY_IMAGE_CACHE_MAX_UNUSED_BYTES) {
+                ply_image_cache_entry_t *entry = ply_list_node_get_data (node);
+
+                node = ply_list_get_next_node (image_cache_entries, node);
+
+                if (ply_pixel_buffer_is_shared (entry->buffer))
+                        continue;
+
+                unused_bytes -= get_buffer_size_in_bytes (entry->buffer);
+                image_cache_remove_entry (entry);
+        }
+}
+
+static ply_pixel_buffer_t *
+image_cache_lookup (const char *key)
+{
+        ply_image_cache_entry_t *entry;
+
+        if (image_cache == NULL || key == NULL)
+                return NULL;
+
+        entry = ply_hashtable_lookup (image_cache, (void *) key);
+
+        if (entry == NULL)
+                return NULL;
+
+        ply_list_remove_node (image_cache_entries, entry->node);
+        entry->node = ply_list_append_data (image_cache_entries, entry);
+
+        ply_pixel_buffer_take_reference (entry->buffer);
+        return entry->buffer;
+}
+
+static void
+image_cache_insert (const char         *key,
+                    ply_pixel_buffer_t *buffer)
+{
+        ply_image_cache_entry_t *entry;
+
+        if (key == NULL)
+                return;
+
+        if (image_cache == NULL) {
+                image_cache = ply_hashtable_new (ply_hashtable_string_hash,
+                                                 ply_hashtable_string_compare);
+                image_cache_entries = ply_list_new ();
+        }
+
+        if (ply_hashtable_lookup (image_cache, (void *) key) != NULL)
+                return;
+
+        entry = calloc (1, sizeof(ply_image_cache_entry_t));
+        entry->key = strdup (key);
+        entry->buffer = buffer;
+        ply_pixel_buffer_take_reference (buffer);
+        entry->node = ply_list_append_data (image_cache_entries, entry);
+        ply_hashtable_insert (image_cache, entry->key, entry);
+
+        image_cache_trim ();
+}
+
+/* Drops the cache's references on every buffer it holds.  Images that are
+ * still alive keep their buffers.
+ */
+void
+ply_image_cache_flush (void)
+{
+        ply_list_node_t *node;
+
+        if (image_cache_entries == NULL)
+                return;
+
+        node = ply_list_get_first_node (image_cache_entries);
+        while (node != NULL) {
+                ply_image_cache_entry_t *entry = ply_list_node_get_data (node);
+
+                node = ply_list_get_next_node (image_cache_entries, node);
+                image_cache_remove_entry (entry);
+        }
+}
+
+/* Called before handing out writable pixel data, since the image's buffer
+ * may be shared with other images through the cache
+ */
+static void
+ply_image_make_buffer_private (ply_image_t *image)
+{
+        ply_pixel_buffer_t *buffer;
+
+        if (image->cache_key != NULL) {
+                ply_image_cache_entry_t *entry;
+
+                entry = NULL;
+                if (image_cache != NULL)
+                        entry = ply_hashtable_lookup (image_cache, image->cache_key);
+
+                if (entry != NULL && entry->buffer == image->buffer)
+                        image_cache_remove_entry (entry);
+
+                free (image->cache_key);
+                image->cache_key = NULL;
+        }
+
+        if (image->buffer == NULL || !ply_pixel_buffer_is_shared (image->buffer))
+                return;
+
+        buffer = ply_pixel_buffer_copy (image->buffer);
+        ply_pixel_buffer_free (image->buffer);
+        image->buffer = buffer;
+}
+
 ply_image_t *
 ply_image_new (const char *filename)
 {
@@ -93,6 +315,10 @@ ply_image_new (const char *filename)
         return image;
 }
 
+static void ply_image_stop_loading (ply_image_t *image);
+static void on_load_idle (ply_image_t *image);
+static void on_load_loop_exit (ply_image_t *image);
+
 void
 ply_image_free (ply_image_t *image)
 {
@@ -101,9 +327,13 @@ ply_image_free (ply_image_t *image)
 
         assert (image->filename != NULL);
 
+        ply_image_stop_loading (image);
         ply_pixel_buffer_free (image->buffer);
+        free (image->cache_key);
         free (image->filename);
         free (image);
+
+        image_cache_trim ();
 }
 
 static void
@@ -135,141 +365,490 @@ transform_to_argb32 (png_struct   *png,
         }
 }
 
+static void
+ply_image_end_png (ply_image_t *image)
+{
+        if (image->png == NULL)
+                return;
+
+        png_destroy_read_struct (&image->png, &image->png_info, NULL);
+        image->png = NULL;
+        image->png_info = NULL;
+        image->rows_left = 0;
+}
+
 static bool
-ply_image_load_png (ply_image_t *image, FILE *fp)
+ply_image_begin_png (ply_image_t *image, FILE *fp)
 {
-        png_struct *png;
-        png_info *info;
-        png_uint_32 width, height, row;
-        int bits_per_pixel, color_type, interlace_method;
-        png_byte **rows;
-        uint32_t *bytes;
+        png_uint_32 width, height;
+        int bits_per_pixel, color_type, interlace_method, number_of_passes;
 
         assert (image != NULL);
         assert (fp != NULL);
 
-        png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-        assert (png != NULL);
+        image->png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        assert (image->png != NULL);
 
-        info = png_create_info_struct (png);
-        assert (info != NULL);
+        image->png_info = png_create_info_struct (image->png);
+        assert (image->png_info != NULL);
 
-        png_init_io (png, fp);
+        png_init_io (image->png, fp);
 
-        if (setjmp (png_jmpbuf (png)) != 0)
+        if (setjmp (png_jmpbuf (image->png)) != 0) {
+                ply_image_end_png (image);
                 return false;
+        }
 
-        png_read_info (png, info);
-        png_get_IHDR (png, info,
+        png_read_info (image->png, image->png_info);
+        png_get_IHDR (image->png, image->png_info,
                       &width, &height, &bits_per_pixel,
                       &color_type, &interlace_method, NULL, NULL);
 
         if (color_type == PNG_COLOR_TYPE_PALETTE)
-                png_set_palette_to_rgb (png);
+                png_set_palette_to_rgb (image->png);
 
         if ((color_type == PNG_COLOR_TYPE_GRAY) && (bits_per_pixel < 8))
-                png_set_expand_gray_1_2_4_to_8 (png);
+                png_set_expand_gray_1_2_4_to_8 (image->png);
 
-        if (png_get_valid (png, info, PNG_INFO_tRNS))
-                png_set_tRNS_to_alpha (png);
+        if (png_get_valid (image->png, image->png_info, PNG_INFO_tRNS))
+                png_set_tRNS_to_alpha (image->png);
 
         if (bits_per_pixel == 16)
-                png_set_strip_16 (png);
+                png_set_strip_16 (image->png);
 
         if (bits_per_pixel < 8)
-                png_set_packing (png);
+                png_set_packing (image->png);
 
         if ((color_type == PNG_COLOR_TYPE_GRAY)
             || (color_type == PNG_COLOR_TYPE_GRAY_ALPHA))
-                png_set_gray_to_rgb (png);
+                png_set_gray_to_rgb (image->png);
 
+        number_of_passes = 1;
         if (interlace_method != PNG_INTERLACE_NONE)
-                png_set_interlace_handling (png);
+                number_of_passes = png_set_interlace_handling (image->png);
 
-        png_set_filler (png, 0xff, PNG_FILLER_AFTER);
+        png_set_filler (image->png, 0xff, PNG_FILLER_AFTER);
 
-        png_set_read_user_transform_fn (png, transform_to_argb32);
+        png_set_read_user_transform_fn (image->png, transform_to_argb32);
 
-        png_read_update_info (png, info);
+        png_read_update_info (image->png, image->png_info);
 
-        rows = malloc (height * sizeof(png_byte *));
         image->buffer = ply_pixel_buffer_new (width, height);
+        image->next_row = 0;
+        image->rows_left = number_of_passes * height;
+
+        return true;
+}
+
+/* Marking fully decoded images without transparency as opaque lets them be
+ * copied rather than blended, and spares drawing whatever they cover.
+ */
+static bool
+ply_image_png_is_opaque (ply_image_t *image)
+{
+        unsigned long i, size;
+        uint32_t *bytes;
+
+        if (!(png_get_color_type (image->png, image->png_info) & PNG_COLOR_MASK_ALPHA))
+                return true;
 
+        size = ply_pixel_buffer_get_width (image->buffer) * ply_pixel_buffer_get_height (image->buffer);
         bytes = ply_pixel_buffer_get_argb32_data (image->buffer);
 
-        for (row = 0; row < height; row++) {
-                rows[row] = (png_byte *) &bytes[row * width];
+        for (i = 0; i < size; i++) {
+                if ((bytes[i] >> 24) != 0xff)
+                        return false;
         }
 
-        png_read_image (png, rows);
+        return true;
+}
+
+/* Decodes at most max_rows rows into the image's buffer, and reports
+ * which rows changed in decoded_area.  The decoded rows are always
+ * contiguous, so a band stops early at the end of an interlace pass.
+ */
+static bool
+ply_image_read_png_rows (ply_image_t     *image,
+                         png_uint_32      max_rows,
+                         ply_rectangle_t *decoded_area)
+{
+        unsigned long width, height;
+        uint32_t *bytes;
+
+        assert (image != NULL);
+        assert (image->png != NULL);
+
+        width = ply_pixel_buffer_get_width (image->buffer);
+        height = ply_pixel_buffer_get_height (image->buffer);
+        bytes = ply_pixel_buffer_get_argb32_data (image->buffer);
+
+        decoded_area->x = 0;
+        decoded_area->y = image->next_row;
+        decoded_area->width = width;
+        decoded_area->height = 0;
+
+        if (setjmp (png_jmpbuf (image->png)) != 0)
+                return false;
+
+        while (decoded_area->height < max_rows && image->rows_left > 0) {
+                png_read_row (image->png, (png_byte *) &bytes[image->next_row * width], NULL);
 
-        free (rows);
-        png_read_end (png, info);
-        png_destroy_read_struct (&png, &info, NULL);
+                image->next_row = (image->next_row + 1) % height;
+                image->rows_left--;
+                decoded_area->height++;
+
+                if (image->next_row == 0)
+                        break;
+        }
+
+        if (image->rows_left == 0) {
+                png_read_end (image->png, image->png_info);
+                ply_pixel_buffer_set_opaque (image->buffer, ply_image_png_is_opaque (image));
+        }
 
         return true;
 }
 
+static bool
+ply_image_load_png (ply_image_t *image, FILE *fp)
+{
+        ply_rectangle_t decoded_area;
+        bool ret;
+
+        if (!ply_image_begin_png (image, fp))
+                return false;
+
+        ret = true;
+        while (ret && image->rows_left > 0) {
+                ret = ply_image_read_png_rows (image, image->rows_left, &decoded_area);
+        }
+
+        ply_image_end_png (image);
+
+        if (!ret) {
+                ply_pixel_buffer_free (image->buffer);
+                image->buffer = NULL;
+        }
+
+        return ret;
+}
+
+typedef struct
+{
+        uint32_t mask;
+        int      shift;
+        int      bits;
+} bmp_channel_t;
+
+static bool
+bmp_channel_init (bmp_channel_t *channel,
+                  uint32_t       mask)
+{
+        channel->mask = mask;
+        channel->shift = 0;
+        channel->bits = 0;
+
+        if (mask == 0)
+                return true;
+
+        while ((mask & 1) == 0) {
+                mask >>= 1;
+                channel->shift++;
+        }
+
+        while ((mask & 1) != 0) {
+                mask >>= 1;
+                channel->bits++;
+        }
+
+        /* Only contiguous masks make sense */
+        return mask == 0;
+}
+
+static inline uint32_t
+bmp_channel_get_value (const bmp_channel_t *channel,
+                       uint32_t             pixel)
+{
+        uint32_t value;
+
+        if (channel->bits == 0)
+                return 0;
+
+        value = (pixel & channel->mask) >> channel->shift;
+
+        if (channel->bits >= 8)
+                return value >> (channel->bits - 8);
+
+        return value * 255 / ((1u << channel->bits) - 1);
+}
+
+static inline uint32_t
+read_le32 (const uint8_t *data)
+{
+        uint32_t value;
+
+        memcpy (&value, data, sizeof(uint32_t));
+        return le32toh (value);
+}
+
+/* Converts a row of packed 24-bit BGR pixels to opaque XRGB.  Four pixels
+ * are handled per iteration from three little-endian words, so the loop
+ * body is plain shifts and masks the compiler can vectorize.
+ */
+static void
+convert_bgr24_row (uint32_t      *dst,
+                   const uint8_t *src,
+                   uint32_t       width)
+{
+        uint32_t x;
+
+        for (x = 0; x + 4 <= width; x += 4) {
+                uint32_t w0, w1, w2;
+
+                w0 = read_le32 (src + 0);
+                w1 = read_le32 (src + 4);
+                w2 = read_le32 (src + 8);
+
+                dst[x + 0] = 0xff000000 | (w0 & 0xffffff);
+                dst[x + 1] = 0xff000000 | (w0 >> 24) | ((w1 & 0xffff) << 8);
+                dst[x + 2] = 0xff000000 | (w1 >> 16) | ((w2 & 0xff) << 16);
+                dst[x + 3] = 0xff000000 | (w2 >> 8);
+
+                src += 12;
+        }
+
+        for (; x < width; x++) {
+                dst[x] = 0xff000000 | (src[2] << 16) | (src[1] << 8) | src[0];
+                src += 3;
+        }
+}
+
+/* Converts a row of 32-bit BGRX pixels to opaque XRGB */
+static void
+convert_bgrx32_row (uint32_t      *dst,
+                    const uint8_t *src,
+                    uint32_t       width)
+{
+        uint32_t x;
+
+        for (x = 0; x < width; x++)
+                dst[x] = 0xff000000 | read_le32 (src + x * 4);
+}
+
+static void
+convert_indexed8_row (uint32_t       *dst,
+                      const uint8_t  *src,
+                      uint32_t        width,
+                      const uint32_t *palette)
+{
+        uint32_t x;
+
+        for (x = 0; x < width; x++)
+                dst[x] = palette[src[x]];
+}
+
+/* Converts a row of 32-bit pixels with arbitrary channel masks to
+ * premultiplied ARGB
+ */
+static void
+convert_bitfields32_row (uint32_t            *dst,
+                         const uint8_t       *src,
+                         uint32_t             width,
+                         const bmp_channel_t *channels)
+{
+        uint32_t x;
+
+        for (x = 0; x < width; x++) {
+                uint32_t pixel, red, green, blue, alpha;
+
+                pixel = read_le32 (src + x * 4);
+
+                red = bmp_channel_get_value (&channels[0], pixel);
+                green = bmp_channel_get_value (&channels[1], pixel);
+                blue = bmp_channel_get_value (&channels[2], pixel);
+
+                if (channels[3].bits > 0) {
+                        alpha = bmp_channel_get_value (&channels[3], pixel);
+
+                        if (alpha != 0xff) {
+                                red = (red * alpha + 127) / 255;
+                                green = (green * alpha + 127) / 255;
+                                blue = (blue * alpha + 127) / 255;
+                        }
+                } else {
+                        alpha = 0xff;
+                }
+
+                dst[x] = (alpha << 24) | (red << 16) | (green << 8) | blue;
+        }
+}
+
 static bool
 ply_image_load_bmp (ply_image_t *image, FILE *fp)
 {
-        uint32_t x, y, src_y, width, height, bmp_pitch, *dst;
+        uint32_t y, src_y, width, height, bmp_pitch, *dst;
         struct bmp_file_header file_header;
         struct bmp_dib_header dib_header;
-        uint8_t r, g, b, *buf, *src;
+        bmp_channel_t channels[4];
+        uint32_t palette[256];
+        const uint8_t *pixels;
+        uint8_t *map;
+        uint64_t bitmap_end;
+        struct stat file_info;
+        bool use_bitfields = false;
         bool ret = false;
 
         assert (image != NULL);
         assert (fp != NULL);
 
-        if (fread (&file_header, 1, sizeof(struct bmp_file_header), fp) != sizeof(struct bmp_file_header))
+        if (fstat (fileno (fp), &file_info) < 0)
                 return false;
 
-        if (fread (&dib_header, 1, sizeof(struct bmp_dib_header), fp) != sizeof(struct bmp_dib_header))
+        if ((size_t) file_info.st_size < sizeof(struct bmp_file_header) + sizeof(struct bmp_dib_header))
                 return false;
 
-        if (dib_header.dib_header_size != 40 || dib_header.width < 0 ||
-            dib_header.planes != 1 || dib_header.bpp != 24 ||
-            dib_header.compression != 0)
+        map = mmap (NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fileno (fp), 0);
+        if (map == MAP_FAILED)
                 return false;
 
+        memcpy (&file_header, map, sizeof(struct bmp_file_header));
+        memcpy (&dib_header, map + sizeof(struct bmp_file_header), sizeof(struct bmp_dib_header));
+
+        /* BITMAPINFOHEADER or one of its V4/V5 extensions */
+        if (dib_header.dib_header_size < 40 || dib_header.width <= 0 ||
+            dib_header.height == 0 || dib_header.height == INT32_MIN ||
+            dib_header.planes != 1)
+                goto out;
+
         width = dib_header.width;
         height = abs (dib_header.height);
-        bmp_pitch = (3 * width + 3) & ~3;
-
-        buf = malloc (bmp_pitch * height);
-        assert (buf);
 
-        if (fseek (fp, file_header.bitmap_offset, SEEK_SET) != 0)
+        switch (dib_header.bpp) {
+        case 8:
+                if (dib_header.compression != BMP_COMPRESSION_RGB)
+                        goto out;
+                break;
+        case 24:
+                if (dib_header.compression != BMP_COMPRESSION_RGB)
+                        goto out;
+                break;
+        case 32:
+                if (dib_header.compression == BMP_COMPRESSION_BITFIELDS ||
+                    dib_header.compression == BMP_COMPRESSION_ALPHABITFIELDS)
+                        use_bitfields = true;
+                else if (dib_header.compression != BMP_COMPRESSION_RGB)
+                        goto out;
+                break;
+        default:
                 goto out;
-        
-        if (fread (buf, 1, bmp_pitch * height, fp) != bmp_pitch * height)
+        }
+
+        bmp_pitch = ((dib_header.bpp * (uint64_t) width + 31) / 32) * 4;
+        bitmap_end = file_header.bitmap_offset + (uint64_t) bmp_pitch * height;
+
+        if (bitmap_end > (uint64_t) file_info.st_size)
                 goto out;
 
+        pixels = map + file_header.bitmap_offset;
+
+        if (use_bitfields) {
+                const uint8_t *masks = map + sizeof(struct bmp_file_header) + 40;
+                bool has_alpha_mask;
+
+                /* The masks live at the end of the V2/V3 header fields, or
+                 * right after a plain BITMAPINFOHEADER, which is the same place
+                 */
+                has_alpha_mask = dib_header.dib_header_size >= 56 ||
+                                 dib_header.compression == BMP_COMPRESSION_ALPHABITFIELDS;
+
+                if (masks + (has_alpha_mask ? 16 : 12) > map + file_info.st_size)
+                        goto out;
+
+                if (!bmp_channel_init (&channels[0], read_le32 (masks + 0)) ||
+                    !bmp_channel_init (&channels[1], read_le32 (masks + 4)) ||
+                    !bmp_channel_init (&channels[2], read_le32 (masks + 8)) ||
+                    !bmp_channel_init (&channels[3], has_alpha_mask ? read_le32 (masks + 12) : 0))
+                        goto out;
+
+                /* Lots of writers fill in an alpha mask and then leave the
+                 * alpha channel zeroed, meaning the image is really opaque
+                 */
+                if (channels[3].bits > 0) {
+                        bool alpha_is_used = false;
+
+                        for (y = 0; y < height && !alpha_is_used; y++) {
+                                uint32_t x;
+
+                                for (x = 0; x < width; x++) {
+                                        if ((read_le32 (pixels + y * bmp_pitch + x * 4) & channels[3].mask) != 0) {
+                                                alpha_is_used = true;
+                                                break;
+                                        }
+                                }
+                        }
+
+                        if (!alpha_is_used)
+                                bmp_channel_init (&channels[3], 0);
+                }
+
+                /* The common layout doesn't need per channel work */
+                if (channels[0].mask == 0xff0000 && channels[1].mask == 0xff00 &&
+                    channels[2].mask == 0xff && channels[3].bits == 0)
+                        use_bitfields = false;
+        } else if (dib_header.bpp == 8) {
+                uint64_t palette_offset;
+                const uint8_t *entries;
+                uint32_t number_of_entries, i;
+
+                number_of_entries = dib_header.colors_used;
+                if (number_of_entries == 0 || number_of_entries > 256)
+                        number_of_entries = 256;
+
+                palette_offset = sizeof(struct bmp_file_header) + (uint64_t) dib_header.dib_header_size;
+                if (palette_offset + number_of_entries * 4 > (uint64_t) file_info.st_size)
+                        goto out;
+
+                entries = map + palette_offset;
+
+                /* Out of range indices show up as black */
+                for (i = 0; i < 256; i++) {
+                        if (i < number_of_entries)
+                                palette[i] = 0xff000000 | (read_le32 (entries + i * 4) & 0xffffff);
+                        else
+                                palette[i] = 0xff000000;
+                }
+        }
+
         image->buffer = ply_pixel_buffer_new (width, height);
         dst = ply_pixel_buffer_get_argb32_data (image->buffer);
 
         for (y = 0; y < height; y++) {
+                const uint8_t *src;
+
                 /* Positive header height means upside down row order */
                 if (dib_header.height > 0)
                         src_y = (height - 1) - y;
                 else
                         src_y = y;
 
-                src = buf + src_y * bmp_pitch;
+                src = pixels + (size_t) src_y * bmp_pitch;
 
-                for (x = 0; x < width; x++) {
-                        b = *src++;
-                        g = *src++;
-                        r = *src++;
-                        *dst++ = (0xff << 24) | (r << 16) | (g << 8) | (b << 0);
-                }
+                if (use_bitfields)
+                        convert_bitfields32_row (dst, src, width, channels);
+                else if (dib_header.bpp == 32)
+                        convert_bgrx32_row (dst, src, width);
+                else if (dib_header.bpp == 24)
+                        convert_bgr24_row (dst, src, width);
+                else
+                        convert_indexed8_row (dst, src, width, palette);
+
+                dst += width;
         }
 
-        ply_pixel_buffer_set_opaque (image->buffer, true);
+        ply_pixel_buffer_set_opaque (image->buffer, !use_bitfields || channels[3].bits == 0);
         ret = true;
 out:
-        free (buf);
+        munmap (map, file_info.st_size);
         return ret;
 }
 
@@ -282,6 +861,15 @@ ply_image_load (ply_image_t *image)
 
         assert (image != NULL);
 
+        free (image->cache_key);
+        image->cache_key = get_file_cache_key (image->filename);
+
+        ply_pixel_buffer_free (image->buffer);
+        image->buffer = image_cache_lookup (image->cache_key);
+
+        if (image->buffer != NULL)
+                return true;
+
         fp = fopen (image->filename, "re");
         if (fp == NULL)
                 return false;
@@ -300,16 +888,154 @@ ply_image_load (ply_image_t *image)
                  ((struct bmp_file_header *)header)->reserved == 0)
                 ret = ply_image_load_bmp (image, fp);
 
+        if (ret)
+                image_cache_insert (image->cache_key, image->buffer);
 out:
         fclose (fp);
         return ret;
 }
 
+static void
+ply_image_stop_loading (ply_image_t *image)
+{
+        if (image->fp == NULL)
+                return;
+
+        if (image->loop != NULL) {
+                ply_event_loop_stop_watching_for_idle (image->loop,
+                                                       (ply_event_loop_idle_handler_t)
+                                                       on_load_idle, image);
+                ply_event_loop_stop_watching_for_exit (image->loop,
+                                                       (ply_event_loop_exit_handler_t)
+                                                       on_load_loop_exit, image);
+                image->loop = NULL;
+        }
+
+        ply_image_end_png (image);
+        fclose (image->fp);
+        image->fp = NULL;
+        image->load_handler = NULL;
+        image->load_handler_user_data = NULL;
+}
+
+static void
+on_load_loop_exit (ply_image_t *image)
+{
+        ply_image_stop_loading (image);
+}
+
+static void
+on_load_idle (ply_image_t *image)
+{
+        ply_image_load_handler_t load_handler;
+        void *user_data;
+        ply_rectangle_t decoded_area;
+        png_uint_32 rows_per_band;
+
+        load_handler = image->load_handler;
+        user_data = image->load_handler_user_data;
+
+        rows_per_band = MAX (PLY_IMAGE_PIXELS_PER_BAND / ply_image_get_width (image), 1);
+
+        if (!ply_image_read_png_rows (image, rows_per_band, &decoded_area)) {
+                ply_trace ("could not decode rest of image %s", image->filename);
+                ply_image_stop_loading (image);
+
+                /* Don't let transformations of the partial image get cached */
+                free (image->cache_key);
+                image->cache_key = NULL;
+        } else if (image->rows_left == 0) {
+                ply_image_stop_loading (image);
+                image_cache_insert (image->cache_key, image->buffer);
+        } else {
+                ply_event_loop_watch_for_idle (image->loop,
+                                               (ply_event_loop_idle_handler_t)
+                                               on_load_idle, image);
+        }
+
+        if (load_handler != NULL && decoded_area.height > 0)
+                load_handler (user_data, image, &decoded_area);
+}
+
+/* Like ply_image_load, but for PNG files only the header is read up front.
+ * The pixel data is then decoded a band of rows at a time from the event
+ * loop, and load_handler is called with the area of each decoded band.
+ * Until loading finishes, the undecoded part of the image is fully
+ * transparent.  Other formats are loaded synchronously and load_handler
+ * is never called for them.
+ */
+bool
+ply_image_load_progressively (ply_image_t             *image,
+                              ply_event_loop_t        *loop,
+                              ply_image_load_handler_t load_handler,
+                              void                    *user_data)
+{
+        uint8_t header[sizeof(png_header)];
+        FILE *fp;
+
+        assert (image != NULL);
+        assert (loop != NULL);
+        assert (image->fp == NULL);
+
+        free (image->cache_key);
+        image->cache_key = get_file_cache_key (image->filename);
+
+        ply_pixel_buffer_free (image->buffer);
+        image->buffer = image_cache_lookup (image->cache_key);
+
+        if (image->buffer != NULL)
+                return true;
+
+        fp = fopen (image->filename, "re");
+        if (fp == NULL)
+                return false;
+
+        if (fread (header, 1, sizeof(header), fp) != sizeof(header) ||
+            memcmp (header, png_header, sizeof(png_header)) != 0 ||
+            fseek (fp, 0, SEEK_SET) != 0) {
+                fclose (fp);
+                return ply_image_load (image);
+        }
+
+        if (!ply_image_begin_png (image, fp)) {
+                fclose (fp);
+                return false;
+        }
+
+        image->fp = fp;
+        image->loop = loop;
+        image->load_handler = load_handler;
+        image->load_handler_user_data = user_data;
+
+        ply_event_loop_watch_for_exit (loop,
+                                       (ply_event_loop_exit_handler_t)
+                                       on_load_loop_exit, image);
+        /* One band per loop iteration, so pending fds are serviced in between */
+        ply_event_loop_watch_for_idle (loop,
+                                       (ply_event_loop_idle_handler_t)
+                                       on_load_idle, image);
+
+        return true;
+}
+
+bool
+ply_image_is_loading (ply_image_t *image)
+{
+        assert (image != NULL);
+
+        return image->fp != NULL;
+}
+
+/* Returns pixel data the caller may modify, so if the image's buffer is
+ * shared through the image cache this makes a private copy of it first.
+ */
 uint32_t *
 ply_image_get_data (ply_image_t *image)
 {
         assert (image != NULL);
 
+        ply_image_make_buffer_private (image);
+
         return ply_pixel_buffer_get_argb32_data (image->buffer);
 }
 
@@ -335,6 +1061,42 @@ ply_image_get_height (ply_image_t *image)
         return size.height;
 }
 
+static char *
+get_transformed_cache_key (ply_image_t *image,
+                           const char  *format,
+                           ...)
+{
+        char *transform, *key;
+        va_list args;
+
+        if (image->cache_key == NULL || ply_image_is_loading (image))
+                return NULL;
+
+        transform = NULL;
+        va_start (args, format);
+        vasprintf (&transform, format, args);
+        va_end (args);
+
+        key = NULL;
+        asprintf (&key, "%s|%s", image->cache_key, transform);
+        free (transform);
+
+        return key;
+}
+
+static ply_image_t *
+ply_image_new_from_cache (ply_image_t *image,
+                          char        *cache_key)
+{
+        ply_image_t *new_image;
+
+        new_image = ply_image_new (image->filename);
+        new_image->cache_key = cache_key;
+        new_image->buffer = image_cache_lookup (cache_key);
+
+        return new_image;
+}
+
 ply_image_t *
 ply_image_resize (ply_image_t *image,
                   long         width,
@@ -342,11 +1104,18 @@ ply_image_resize (ply_image_t *image,
 {
         ply_image_t *new_image;
 
-        new_image = ply_image_new (image->filename);
+        new_image = ply_image_new_from_cache (image,
+                                              get_transformed_cache_key (image,
+                                                                         "resize %ldx%ld",
+                                                                         width, height));
+        if (new_image->buffer != NULL)
+                return new_image;
 
         new_image->buffer = ply_pixel_buffer_resize (image->buffer,
                                                      width,
                                                      height);
+        image_cache_insert (new_image->cache_key, new_image->buffer);
+
         return new_image;
 }
 
@@ -358,12 +1127,20 @@ ply_image_rotate (ply_image_t *image,
 {
         ply_image_t *new_image;
 
-        new_image = ply_image_new (image->filename);
+        new_image = ply_image_new_from_cache (image,
+                                              get_transformed_cache_key (image,
+                                                                         "rotate %ld,%ld,%a",
+                                                                         center_x, center_y,
+                                                                         theta_offset));
+        if (new_image->buffer != NULL)
+                return new_image;
 
         new_image->buffer = ply_pixel_buffer_rotate (image->buffer,
                                                      center_x,
                                                      center_y,
                                                      theta_offset);
+        image_cache_insert (new_image->cache_key, new_image->buffer);
+
         return new_image;
 }
 
@@ -374,14 +1151,24 @@ ply_image_tile (ply_image_t *image,
 {
         ply_image_t *new_image;
 
-        new_image = ply_image_new (image->filename);
+        new_image = ply_image_new_from_cache (image,
+                                              get_transformed_cache_key (image,
+                                                                         "tile %ldx%ld",
+                                                                         width, height));
+        if (new_image->buffer != NULL)
+                return new_image;
 
         new_image->buffer = ply_pixel_buffer_tile (image->buffer,
                                                    width,
                                                    height);
+        image_cache_insert (new_image->cache_key, new_image->buffer);
+
         return new_image;
 }
 
+/* The returned buffer may be shared with other images loaded from the same
+ * file, so it must not be modified.  Use ply_image_get_data for that.
+ */
 ply_pixel_buffer_t *
 ply_image_get_buffer (ply_image_t *image)
 {
@@ -390,6 +1177,9 @@ ply_image_get_buffer (ply_image_t *image)
         return image->buffer;
 }
 
+/* Like ply_image_get_buffer, the returned buffer may be shared and must
+ * not be modified.  The caller owns a reference on it.
+ */
 ply_pixel_buffer_t *
 ply_image_convert_to_pixel_buffer (ply_image_t *image)
 {
@@ -22,6 +22,7 @@
 #ifndef PLY_IMAGE_H
 #define PLY_IMAGE_H
 
+#include "ply-event-loop.h"
 #include "ply-pixel-buffer.h"
 
 #include <stdbool.h>
@@ -30,10 +31,19 @@
 
 typedef struct _ply_image ply_image_t;
 
+typedef void (*ply_image_load_handler_t) (void            *user_data,
+                                          ply_image_t     *image,
+                                          ply_rectangle_t *decoded_area);
+
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_image_t *ply_image_new (const char *filename);
 void ply_image_free (ply_image_t *image);
 bool ply_image_load (ply_image_t *image);
+bool ply_image_load_progressively (ply_image_t             *image,
+                                   ply_event_loop_t        *loop,
+                                   ply_image_load_handler_t load_handler,
+                                   void                    *user_data);
+bool ply_image_is_loading (ply_image_t *image);
 uint32_t *ply_image_get_data (ply_image_t *image);
 long ply_image_get_width (ply_image_t *image);
 long ply_image_get_height (ply_image_t *image);
@@ -50,6 +60,8 @@ ply_image_t *ply_image_tile (ply_image_t *image,
 ply_pixel_buffer_t *ply_image_get_buffer (ply_image_t *image);
 ply_pixel_buffer_t *ply_image_convert_to_pixel_buffer (ply_image_t *image);
 
+void ply_image_cache_flush (void);
+
 #endif
 
 #endif /* PLY_IMAGE_H */
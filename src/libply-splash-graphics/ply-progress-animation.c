@@ -65,7 +65,7 @@ struct _ply_progress_animation
         double                              fraction_done;
         int                                 previous_frame_number;
 
-        double                              transition_start_time;
+        uint64_t                            transition_start_time;
 
         ply_pixel_buffer_t                 *last_rendered_frame;
 
@@ -222,7 +222,7 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
             progress_animation->transition != PLY_PROGRESS_ANIMATION_TRANSITION_NONE &&
             progress_animation->transition_duration > 0.0) {
                 progress_animation->is_transitioning = true;
-                progress_animation->transition_start_time = ply_get_timestamp ();
+                progress_animation->transition_start_time = ply_get_monotonic_time ();
         }
 
         frames = (ply_image_t *const *) ply_array_get_pointer_elements (progress_animation->frames);
@@ -232,14 +232,15 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
         current_frame_buffer = ply_image_get_buffer (frames[frame_number]);
 
         if (progress_animation->is_transitioning) {
-                double now;
+                uint64_t now;
                 double fade_percentage;
                 double fade_out_opacity;
                 int width, height;
                 uint32_t *faded_data;
-                now = ply_get_timestamp ();
+                now = ply_get_monotonic_time ();
 
-                fade_percentage = (now - progress_animation->transition_start_time) / progress_animation->transition_duration;
+                fade_percentage = (double) (now - progress_animation->transition_start_time) / PLY_NANOSECONDS_PER_SECOND /
+                                  progress_animation->transition_duration;
 
                 if (fade_percentage >= 1.0)
                         progress_animation->is_transitioning = false;
@@ -72,7 +72,7 @@ struct _ply_throbber
 
         long                 x, y;
         long                 width, height;
-        double               start_time, now;
+        uint64_t             start_time, now;
 
         int                  frame_number;
         uint32_t             is_stopped : 1;
@@ -182,17 +182,17 @@ animate_at_time (ply_throbber_t *throbber,
 static void
 on_timeout (ply_throbber_t *throbber)
 {
-        double sleep_time;
+        uint64_t next_frame_time, earliest_time;
         bool should_continue;
 
-        throbber->now = ply_get_timestamp ();
+        throbber->now = ply_get_monotonic_time ();
 
         should_continue = animate_at_time (throbber,
-                                           throbber->now - throbber->start_time);
+                                           (double) (throbber->now - throbber->start_time) / PLY_NANOSECONDS_PER_SECOND);
 
-        sleep_time = 1.0 / FRAMES_PER_SECOND;
-        sleep_time = MAX (sleep_time - (ply_get_timestamp () - throbber->now),
-                          0.005);
+        next_frame_time = throbber->now + PLY_NANOSECONDS_PER_SECOND / FRAMES_PER_SECOND;
+        earliest_time = ply_get_monotonic_time () + PLY_NANOSECONDS_PER_SECOND / 200;
+        next_frame_time = MAX (next_frame_time, earliest_time);
 
         if (!should_continue) {
                 throbber->is_stopped = true;
@@ -201,10 +201,10 @@ on_timeout (ply_throbber_t *throbber)
                         throbber->stop_trigger = NULL;
                 }
         } else {
-                ply_event_loop_watch_for_timeout (throbber->loop,
-                                                  sleep_time,
-                                                  (ply_event_loop_timeout_handler_t)
-                                                  on_timeout, throbber);
+                ply_event_loop_watch_for_deadline (throbber->loop,
+                                                   next_frame_time,
+                                                   (ply_event_loop_timeout_handler_t)
+                                                   on_timeout, throbber);
         }
 }
 
@@ -313,7 +313,7 @@ ply_throbber_start (ply_throbber_t      *throbber,
         throbber->x = x;
         throbber->y = y;
 
-        throbber->start_time = ply_get_timestamp ();
+        throbber->start_time = ply_get_monotonic_time ();
 
         ply_event_loop_watch_for_timeout (throbber->loop,
                                           1.0 / FRAMES_PER_SECOND,
@@ -864,7 +864,7 @@ ply_command_parser_read_command (ply_command_parser_t *parser)
 }
 
 static void
-on_command_dispatch_timeout (ply_command_parser_t *parser)
+on_command_dispatch_idle (ply_command_parser_t *parser)
 {
         ply_command_t *command;
         ply_list_node_t *node;
@@ -881,10 +881,10 @@ on_command_dispatch_timeout (ply_command_parser_t *parser)
 
         assert (command != NULL);
 
-        ply_event_loop_watch_for_timeout (parser->loop, 0.01,
-                                          (ply_event_loop_timeout_handler_t)
-                                          on_command_dispatch_timeout,
-                                          parser);
+        ply_event_loop_watch_for_idle (parser->loop,
+                                       (ply_event_loop_idle_handler_t)
+                                       on_command_dispatch_idle,
+                                       parser);
 
         if (command->handler != NULL)
                 command->handler (command->handler_data, command->name);
@@ -898,10 +898,11 @@ ply_command_parser_queue_command_dispatch (ply_command_parser_t *parser)
         if (parser->dispatch_is_queued)
                 return;
 
-        ply_event_loop_watch_for_timeout (parser->loop, 0.01,
-                                          (ply_event_loop_timeout_handler_t)
-                                          on_command_dispatch_timeout,
-                                          parser);
+        parser->dispatch_is_queued = true;
+        ply_event_loop_watch_for_idle (parser->loop,
+                                       (ply_event_loop_idle_handler_t)
+                                       on_command_dispatch_idle,
+                                       parser);
 }
 
 bool
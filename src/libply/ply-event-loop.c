@@ -25,6 +25,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -34,9 +35,12 @@
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/signalfd.h>
 #include <sys/termios.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
+#include "ply-hashtable.h"
 #include "ply-logger.h"
 #include "ply-list.h"
 #include "ply-utils.h"
@@ -46,15 +50,16 @@
 #endif
 
 #ifndef PLY_EVENT_LOOP_NO_TIMED_WAKEUP
-#define PLY_EVENT_LOOP_NO_TIMED_WAKEUP 0.0
+#define PLY_EVENT_LOOP_NO_TIMED_WAKEUP 0
 #endif
 
 typedef struct
 {
-        int         fd;
-        ply_list_t *destinations;
-        ply_list_t *fd_watches;
-        uint32_t    is_getting_polled : 1;
+        int              fd;
+        ply_list_t      *destinations;
+        ply_list_t      *fd_watches;
+        ply_list_node_t *node;          /* in the loop's sources */
+        uint32_t         is_getting_polled : 1;
         uint32_t    is_disconnected : 1;
         int         reference_count;
 } ply_event_source_t;
@@ -62,6 +67,7 @@ typedef struct
 typedef struct
 {
         ply_event_source_t        *source;
+        ply_list_node_t           *node;      /* in the source's destinations */
 
         ply_event_loop_fd_status_t status;
         ply_event_handler_t        status_met_handler;
@@ -72,6 +78,7 @@ typedef struct
 struct _ply_fd_watch
 {
         ply_event_destination_t *destination;
+        ply_list_node_t         *node;        /* in the source's fd watches */
 };
 
 typedef struct
@@ -79,16 +86,16 @@ typedef struct
         int                 signal_number;
         ply_event_handler_t handler;
         void               *user_data;
-
-        sighandler_t        old_posix_signal_handler;
 } ply_signal_source_t;
 
-static int ply_signal_dispatcher_sender_fd = -1,
-           ply_signal_dispatcher_receiver_fd = -1;
-
+/* Watched signals are blocked and read from a signalfd instead of being
+ * delivered to a handler.
+ */
 typedef struct
 {
-        ply_list_t *sources;
+        int         fd;
+        sigset_t    mask;
+        ply_list_t *sources[NSIG];      /* by signal number, created when needed */
 } ply_signal_dispatcher_t;
 
 typedef struct
@@ -99,20 +106,48 @@ typedef struct
 
 typedef struct
 {
-        double                           timeout;
+        ply_event_loop_idle_handler_t handler;
+        void                         *user_data;
+} ply_event_loop_idle_closure_t;
+
+typedef struct _ply_event_loop_timeout_watch ply_event_loop_timeout_watch_t;
+
+struct _ply_event_loop_timeout_watch
+{
+        uint64_t                         timeout;
+        unsigned long                    serial;       /* breaks ties in the order they were added */
         ply_event_loop_timeout_handler_t handler;
         void                            *user_data;
-} ply_event_loop_timeout_watch_t;
+        int                              heap_index;
+        ply_event_loop_timeout_watch_t  *next_watch;   /* with the same user data */
+};
 
 struct _ply_event_loop
 {
         int                      epoll_fd;
         int                      exit_code;
-        double                   wakeup_time;
+        int                      timer_fd;
+        uint64_t                 wakeup_time;          /* what the timer is set to */
 
         ply_list_t              *sources;
+        ply_event_source_t     **sources_by_fd;
+        int                      sources_by_fd_size;
         ply_list_t              *exit_closures;
-        ply_list_t              *timeout_watches;
+
+        /* Idle closures run once the ready fds of an iteration are handled.
+         * The ones queued while they run wait for the next iteration.
+         */
+        ply_list_t              *idle_closures;
+        ply_list_t              *running_idle_closures;
+
+        /* Timeouts are kept in a binary min-heap ordered by when they are
+         * due, and filed by user data so they can be found for removal.
+         */
+        ply_event_loop_timeout_watch_t **timeout_heap;
+        int                      timeout_count;
+        int                      timeout_heap_size;
+        unsigned long            timeout_serial;
+        ply_hashtable_t         *timeout_watches;
 
         ply_signal_dispatcher_t *signal_dispatcher;
 
@@ -122,13 +157,8 @@ struct _ply_event_loop
 
 static void ply_event_loop_remove_source (ply_event_loop_t   *loop,
                                           ply_event_source_t *source);
-static ply_list_node_t *ply_event_loop_find_source_node (ply_event_loop_t *loop,
-                                                         int               fd);
-
-static ply_list_node_t *
-ply_signal_dispatcher_find_source_node (ply_signal_dispatcher_t *dispatcher,
-                                        int                      signal_number);
-
+static void ply_event_loop_on_timer (ply_event_loop_t *loop,
+                                     int               fd);
 
 static ply_signal_source_t *
 ply_signal_source_new (int                 signal_number,
@@ -141,7 +171,6 @@ ply_signal_source_new (int                 signal_number,
         source->signal_number = signal_number;
         source->handler = signal_handler;
         source->user_data = user_data;
-        source->old_posix_signal_handler = NULL;
 
         return source;
 }
@@ -159,94 +188,123 @@ static ply_signal_dispatcher_t *
 ply_signal_dispatcher_new (void)
 {
         ply_signal_dispatcher_t *dispatcher;
+        sigset_t mask;
+        int fd;
 
-        if (!ply_open_unidirectional_pipe (&ply_signal_dispatcher_sender_fd,
-                                           &ply_signal_dispatcher_receiver_fd))
+        sigemptyset (&mask);
+        fd = signalfd (-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (fd < 0)
                 return NULL;
 
         dispatcher = calloc (1, sizeof(ply_signal_dispatcher_t));
-
-        dispatcher->sources = ply_list_new ();
+        dispatcher->fd = fd;
+        dispatcher->mask = mask;
 
         return dispatcher;
 }
 
+/* Stops blocking the signals, so they go back to their usual handlers */
+static void
+ply_signal_dispatcher_release_signals (ply_signal_dispatcher_t *dispatcher)
+{
+        sigprocmask (SIG_UNBLOCK, &dispatcher->mask, NULL);
+        sigemptyset (&dispatcher->mask);
+}
+
 static void
 ply_signal_dispatcher_free (ply_signal_dispatcher_t *dispatcher)
 {
         ply_list_node_t *node;
+        int signal_number;
 
         if (dispatcher == NULL)
                 return;
 
-        close (ply_signal_dispatcher_receiver_fd);
-        ply_signal_dispatcher_receiver_fd = -1;
-        close (ply_signal_dispatcher_sender_fd);
-        ply_signal_dispatcher_sender_fd = -1;
+        ply_signal_dispatcher_release_signals (dispatcher);
+        close (dispatcher->fd);
 
-        node = ply_list_get_first_node (dispatcher->sources);
-        while (node != NULL) {
-                ply_list_node_t *next_node;
-                ply_signal_source_t *source;
+        for (signal_number = 0; signal_number < NSIG; signal_number++) {
+                ply_list_t *sources = dispatcher->sources[signal_number];
 
-                source = (ply_signal_source_t *) ply_list_node_get_data (node);
+                if (sources == NULL)
+                        continue;
 
-                next_node = ply_list_get_next_node (dispatcher->sources, node);
+                node = ply_list_get_first_node (sources);
+                while (node != NULL) {
+                        ply_list_node_t *next_node;
+                        ply_signal_source_t *source;
 
-                ply_signal_source_free (source);
+                        source = (ply_signal_source_t *) ply_list_node_get_data (node);
 
-                node = next_node;
-        }
+                        next_node = ply_list_get_next_node (sources, node);
 
-        ply_list_free (dispatcher->sources);
+                        ply_signal_source_free (source);
+
+                        node = next_node;
+                }
+
+                ply_list_free (sources);
+        }
 
         free (dispatcher);
 }
 
 static void
-ply_signal_dispatcher_posix_signal_handler (int signal_number)
+ply_signal_dispatcher_dispatch_signal_number (ply_signal_dispatcher_t *dispatcher,
+                                              int                      signal_number)
 {
-        if (ply_signal_dispatcher_sender_fd < 0)
+        ply_list_t *sources;
+        ply_list_node_t *node;
+
+        if (signal_number <= 0 || signal_number >= NSIG)
                 return;
 
-        ply_write (ply_signal_dispatcher_sender_fd, &signal_number,
-                   sizeof(signal_number));
-}
+        sources = dispatcher->sources[signal_number];
+        if (sources == NULL)
+                return;
 
-static int
-ply_signal_dispatcher_get_next_signal_from_pipe (ply_signal_dispatcher_t *dispatcher)
-{
-        int signal_number;
+        node = ply_list_get_first_node (sources);
+        while (node != NULL) {
+                ply_signal_source_t *source;
+
+                source = (ply_signal_source_t *) ply_list_node_get_data (node);
 
-        if (!ply_read (ply_signal_dispatcher_receiver_fd, &signal_number,
-                       sizeof(signal_number)))
-                signal_number = 0;
+                if (source->handler != NULL)
+                        source->handler (source->user_data, signal_number);
 
-        return signal_number;
+                node = ply_list_get_next_node (sources, node);
+        }
 }
 
 static void
 ply_signal_dispatcher_dispatch_signal (ply_signal_dispatcher_t *dispatcher,
                                        int                      fd)
 {
-        ply_list_node_t *node;
-        int signal_number;
+        struct signalfd_siginfo signal_infos[16];
+        ssize_t bytes_read;
+        size_t i;
 
-        assert (fd == ply_signal_dispatcher_receiver_fd);
+        assert (fd == dispatcher->fd);
 
-        signal_number = ply_signal_dispatcher_get_next_signal_from_pipe (dispatcher);
+        /* Signals that arrived together, like at shutdown, are read in one go */
+        while (true) {
+                bytes_read = read (fd, signal_infos, sizeof(signal_infos));
 
-        node = ply_list_get_first_node (dispatcher->sources);
-        while (node != NULL) {
-                ply_signal_source_t *source;
-
-                source = (ply_signal_source_t *) ply_list_node_get_data (node);
+                if (bytes_read < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno != EAGAIN)
+                                ply_trace ("could not read signals: %m");
+                        break;
+                }
 
-                if (source->signal_number == signal_number)
-                        if (source->handler != NULL)
-                                source->handler (source->user_data, signal_number);
+                for (i = 0; i < bytes_read / sizeof(struct signalfd_siginfo); i++) {
+                        ply_signal_dispatcher_dispatch_signal_number (dispatcher,
+                                                                      signal_infos[i].ssi_signo);
+                }
 
-                node = ply_list_get_next_node (dispatcher->sources, node);
+                if (bytes_read < (ssize_t) sizeof(signal_infos))
+                        break;
         }
 }
 
@@ -254,20 +312,7 @@ static void
 ply_signal_dispatcher_reset_signal_sources (ply_signal_dispatcher_t *dispatcher,
                                             int                      fd)
 {
-        ply_list_node_t *node;
-
-        node = ply_list_get_first_node (dispatcher->sources);
-        while (node != NULL) {
-                ply_signal_source_t *handler;
-
-                handler = (ply_signal_source_t *) ply_list_node_get_data (node);
-
-                signal (handler->signal_number,
-                        handler->old_posix_signal_handler != NULL ?
-                        handler->old_posix_signal_handler : SIG_DFL);
-
-                node = ply_list_get_next_node (dispatcher->sources, node);
-        }
+        ply_signal_dispatcher_release_signals (dispatcher);
 }
 
 static ply_event_destination_t *
@@ -428,13 +473,14 @@ ply_event_loop_add_destination_for_source (ply_event_loop_t        *loop,
         destination_node = ply_list_append_data (source->destinations, destination);
         assert (destination_node != NULL);
         assert (destination->source == source);
+        destination->node = destination_node;
 
         ply_event_loop_update_source_event_mask (loop, source);
 
         watch = ply_fd_watch_new (destination);
 
         ply_event_source_take_reference (source);
-        ply_list_append_data (source->fd_watches, watch);
+        watch->node = ply_list_append_data (source->fd_watches, watch);
 
         return watch;
 }
@@ -470,9 +516,9 @@ ply_event_loop_remove_destination_by_fd_watch (ply_event_loop_t *loop,
         source = destination->source;
         assert (source != NULL);
 
-        ply_list_remove_data (source->destinations, destination);
+        ply_list_remove_node (source->destinations, destination->node);
+        destination->node = NULL;
         ply_event_source_drop_reference (source);
-        assert (ply_list_find_node (source->destinations, destination) == NULL);
         ply_event_loop_update_source_event_mask (loop, source);
 }
 
@@ -484,6 +530,7 @@ ply_event_loop_new (void)
         loop = calloc (1, sizeof(ply_event_loop_t));
 
         loop->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+        loop->timer_fd = -1;
         loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
 
         assert (loop->epoll_fd >= 0);
@@ -494,7 +541,9 @@ ply_event_loop_new (void)
 
         loop->sources = ply_list_new ();
         loop->exit_closures = ply_list_new ();
-        loop->timeout_watches = ply_list_new ();
+        loop->idle_closures = ply_list_new ();
+        loop->timeout_watches = ply_hashtable_new (ply_hashtable_direct_hash,
+                                                   ply_hashtable_direct_compare);
 
         loop->signal_dispatcher = ply_signal_dispatcher_new ();
 
@@ -504,7 +553,7 @@ ply_event_loop_new (void)
         }
 
         ply_event_loop_watch_fd (loop,
-                                 ply_signal_dispatcher_receiver_fd,
+                                 loop->signal_dispatcher->fd,
                                  PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
                                  (ply_event_handler_t)
                                  ply_signal_dispatcher_dispatch_signal,
@@ -512,6 +561,19 @@ ply_event_loop_new (void)
                                  ply_signal_dispatcher_reset_signal_sources,
                                  loop->signal_dispatcher);
 
+        /* Without a timer fd, epoll_wait is given the time left instead */
+        loop->timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (loop->timer_fd >= 0)
+                ply_event_loop_watch_fd (loop,
+                                         loop->timer_fd,
+                                         PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                         (ply_event_handler_t)
+                                         ply_event_loop_on_timer,
+                                         NULL,
+                                         loop);
+        else
+                ply_trace ("could not create timer fd: %m");
+
         return loop;
 }
 
@@ -566,6 +628,23 @@ ply_event_loop_run_exit_closures (ply_event_loop_t *loop)
         }
 }
 
+static void
+ply_event_loop_free_idle_closures (ply_event_loop_t *loop)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (loop->idle_closures);
+        while (node != NULL) {
+                ply_list_node_t *next_node;
+
+                next_node = ply_list_get_next_node (loop->idle_closures, node);
+                free (ply_list_node_get_data (node));
+                ply_list_remove_node (loop->idle_closures, node);
+
+                node = next_node;
+        }
+}
+
 void
 ply_event_loop_free (ply_event_loop_t *loop)
 {
@@ -576,33 +655,28 @@ ply_event_loop_free (ply_event_loop_t *loop)
 
         ply_signal_dispatcher_free (loop->signal_dispatcher);
         ply_event_loop_free_exit_closures (loop);
+        ply_event_loop_free_idle_closures (loop);
+        ply_list_free (loop->idle_closures);
 
         ply_list_free (loop->sources);
-        ply_list_free (loop->timeout_watches);
+        free (loop->sources_by_fd);
+        ply_hashtable_free (loop->timeout_watches);
+        free (loop->timeout_heap);
 
+        if (loop->timer_fd >= 0)
+                close (loop->timer_fd);
         close (loop->epoll_fd);
         free (loop);
 }
 
-static ply_list_node_t *
-ply_event_loop_find_source_node (ply_event_loop_t *loop,
-                                 int               fd)
+static ply_event_source_t *
+ply_event_loop_lookup_source (ply_event_loop_t *loop,
+                              int               fd)
 {
-        ply_list_node_t *node;
-
-        node = ply_list_get_first_node (loop->sources);
-        while (node != NULL) {
-                ply_event_source_t *source;
-
-                source = (ply_event_source_t *) ply_list_node_get_data (node);
-
-                if (source->fd == fd)
-                        break;
-
-                node = ply_list_get_next_node (loop->sources, node);
-        }
+        if (fd >= loop->sources_by_fd_size)
+                return NULL;
 
-        return node;
+        return loop->sources_by_fd[fd];
 }
 
 static void
@@ -612,7 +686,7 @@ ply_event_loop_add_source (ply_event_loop_t   *loop,
         struct epoll_event event = { 0 };
         int status;
 
-        assert (ply_event_loop_find_source_node (loop, source->fd) == NULL);
+        assert (ply_event_loop_lookup_source (loop, source->fd) == NULL);
         assert (source->is_getting_polled == false);
 
         event.events = EPOLLERR | EPOLLHUP;
@@ -624,7 +698,18 @@ ply_event_loop_add_source (ply_event_loop_t   *loop,
         source->is_getting_polled = true;
 
         ply_event_source_take_reference (source);
-        ply_list_append_data (loop->sources, source);
+        source->node = ply_list_append_data (loop->sources, source);
+
+        if (source->fd >= loop->sources_by_fd_size) {
+                int old_size = loop->sources_by_fd_size;
+
+                loop->sources_by_fd_size = MAX (source->fd + 1, 2 * old_size);
+                loop->sources_by_fd = realloc (loop->sources_by_fd,
+                                               loop->sources_by_fd_size * sizeof(ply_event_source_t *));
+                memset (loop->sources_by_fd + old_size, 0,
+                        (loop->sources_by_fd_size - old_size) * sizeof(ply_event_source_t *));
+        }
+        loop->sources_by_fd[source->fd] = source;
 }
 
 static void
@@ -651,7 +736,11 @@ ply_event_loop_remove_source_node (ply_event_loop_t *loop,
                 source->is_getting_polled = false;
         }
 
+        if (loop->sources_by_fd[source->fd] == source)
+                loop->sources_by_fd[source->fd] = NULL;
+
         ply_list_remove_node (loop->sources, source_node);
+        source->node = NULL;
         ply_event_source_drop_reference (source);
 }
 
@@ -659,15 +748,10 @@ static void
 ply_event_loop_remove_source (ply_event_loop_t   *loop,
                               ply_event_source_t *source)
 {
-        ply_list_node_t *source_node;
-
         assert (ply_list_get_length (source->destinations) == 0);
+        assert (source->node != NULL);
 
-        source_node = ply_list_find_node (loop->sources, source);
-
-        assert (source_node != NULL);
-
-        ply_event_loop_remove_source_node (loop, source_node);
+        ply_event_loop_remove_source_node (loop, source->node);
 }
 
 static void
@@ -698,20 +782,15 @@ static ply_event_source_t *
 ply_event_loop_get_source_from_fd (ply_event_loop_t *loop,
                                    int               fd)
 {
-        ply_list_node_t *source_node;
         ply_event_source_t *source;
 
-        source_node = ply_event_loop_find_source_node (loop, fd);
+        source = ply_event_loop_lookup_source (loop, fd);
 
-        if (source_node == NULL) {
+        if (source == NULL) {
                 source = ply_event_source_new (fd);
                 ply_event_loop_add_source (loop, source);
-
-                source_node = ply_list_get_last_node (loop->sources);
-                assert (source_node != NULL);
         }
 
-        source = (ply_event_source_t *) ply_list_node_get_data (source_node);
         assert (source->fd == fd);
 
         return source;
@@ -773,7 +852,7 @@ ply_event_loop_stop_watching_fd (ply_event_loop_t *loop,
          */
         if (source->is_disconnected) {
                 ply_trace ("source for fd %d is already disconnected", source->fd);
-                ply_list_remove_data (source->fd_watches, watch);
+                ply_list_remove_node (source->fd_watches, watch->node);
                 ply_event_source_drop_reference (source);
                 ply_fd_watch_free (watch);
                 return;
@@ -782,7 +861,7 @@ ply_event_loop_stop_watching_fd (ply_event_loop_t *loop,
         ply_trace ("removing destination for fd %d", source->fd);
         ply_event_loop_remove_destination_by_fd_watch (loop, watch);
 
-        ply_list_remove_data (source->fd_watches, watch);
+        ply_list_remove_node (source->fd_watches, watch->node);
         ply_event_source_drop_reference (source);
         ply_fd_watch_free (watch);
         ply_event_destination_free (destination);
@@ -793,74 +872,70 @@ ply_event_loop_stop_watching_fd (ply_event_loop_t *loop,
         }
 }
 
-static ply_list_node_t *
-ply_signal_dispatcher_find_source_node (ply_signal_dispatcher_t *dispatcher,
-                                        int                      signal_number)
-{
-        ply_list_node_t *node;
-
-        node = ply_list_get_first_node (dispatcher->sources);
-        while (node != NULL) {
-                ply_signal_source_t *handler;
-
-                handler = (ply_signal_source_t *) ply_list_node_get_data (node);
-
-                assert (handler != NULL);
-
-                if (handler->signal_number == signal_number)
-                        break;
-
-                node = ply_list_get_next_node (dispatcher->sources, node);
-        }
-
-        return node;
-}
-
 void
 ply_event_loop_watch_signal (ply_event_loop_t   *loop,
                              int                 signal_number,
                              ply_event_handler_t signal_handler,
                              void               *user_data)
 {
+        ply_signal_dispatcher_t *dispatcher = loop->signal_dispatcher;
         ply_signal_source_t *source;
 
+        assert (signal_number > 0 && signal_number < NSIG);
+
         source = ply_signal_source_new (signal_number,
                                         signal_handler,
                                         user_data);
 
-        source->old_posix_signal_handler =
-                signal (signal_number, ply_signal_dispatcher_posix_signal_handler);
-        ply_list_append_data (loop->signal_dispatcher->sources, source);
-}
+        if (dispatcher->sources[signal_number] == NULL)
+                dispatcher->sources[signal_number] = ply_list_new ();
+        ply_list_append_data (dispatcher->sources[signal_number], source);
 
-static void
-ply_signal_dispatcher_remove_source_node (ply_signal_dispatcher_t *dispatcher,
-                                          ply_list_node_t         *node)
-{
-        ply_signal_source_t *source;
-
-        source = (ply_signal_source_t *) ply_list_node_get_data (node);
+        if (!sigismember (&dispatcher->mask, signal_number)) {
+                sigset_t mask;
 
-        signal (source->signal_number,
-                source->old_posix_signal_handler != NULL ?
-                source->old_posix_signal_handler : SIG_DFL);
+                sigemptyset (&mask);
+                sigaddset (&mask, signal_number);
+                sigprocmask (SIG_BLOCK, &mask, NULL);
 
-        ply_list_remove_node (dispatcher->sources, node);
+                sigaddset (&dispatcher->mask, signal_number);
+                if (signalfd (dispatcher->fd, &dispatcher->mask, 0) < 0)
+                        ply_trace ("could not watch for signal %d: %m", signal_number);
+        }
 }
 
 void
 ply_event_loop_stop_watching_signal (ply_event_loop_t *loop,
                                      int               signal_number)
 {
+        ply_signal_dispatcher_t *dispatcher = loop->signal_dispatcher;
+        ply_signal_source_t *source;
         ply_list_node_t *node;
+        sigset_t mask;
 
-        node = ply_signal_dispatcher_find_source_node (loop->signal_dispatcher,
-                                                       signal_number);
+        if (signal_number <= 0 || signal_number >= NSIG ||
+            dispatcher->sources[signal_number] == NULL)
+                return;
 
+        node = ply_list_get_first_node (dispatcher->sources[signal_number]);
         if (node == NULL)
                 return;
 
-        ply_signal_dispatcher_remove_source_node (loop->signal_dispatcher, node);
+        source = (ply_signal_source_t *) ply_list_node_get_data (node);
+        ply_list_remove_node (dispatcher->sources[signal_number], node);
+        ply_signal_source_free (source);
+
+        if (ply_list_get_length (dispatcher->sources[signal_number]) > 0 ||
+            !sigismember (&dispatcher->mask, signal_number))
+                return;
+
+        sigdelset (&dispatcher->mask, signal_number);
+        if (signalfd (dispatcher->fd, &dispatcher->mask, 0) < 0)
+                ply_trace ("could not stop watching for signal %d: %m", signal_number);
+
+        sigemptyset (&mask);
+        sigaddset (&mask, signal_number);
+        sigprocmask (SIG_UNBLOCK, &mask, NULL);
 }
 
 void
@@ -905,29 +980,306 @@ ply_event_loop_stop_watching_for_exit (ply_event_loop_t             *loop,
         }
 }
 
+static ply_list_node_t *
+ply_event_loop_find_idle_closure (ply_list_t                   *closures,
+                                  ply_event_loop_idle_handler_t idle_handler,
+                                  void                         *user_data)
+{
+        ply_list_node_t *node;
+
+        if (closures == NULL)
+                return NULL;
+
+        node = ply_list_get_first_node (closures);
+        while (node != NULL) {
+                ply_event_loop_idle_closure_t *closure;
+
+                closure = (ply_event_loop_idle_closure_t *) ply_list_node_get_data (node);
+
+                if (closure->handler == idle_handler &&
+                    closure->user_data == user_data)
+                        return node;
+
+                node = ply_list_get_next_node (closures, node);
+        }
+
+        return NULL;
+}
+
+void
+ply_event_loop_watch_for_idle (ply_event_loop_t             *loop,
+                               ply_event_loop_idle_handler_t idle_handler,
+                               void                         *user_data)
+{
+        ply_event_loop_idle_closure_t *closure;
+
+        assert (loop != NULL);
+        assert (idle_handler != NULL);
+
+        /* Queueing the same closure again before it runs is a no-op */
+        if (ply_event_loop_find_idle_closure (loop->idle_closures,
+                                              idle_handler,
+                                              user_data) != NULL)
+                return;
+
+        closure = calloc (1, sizeof(ply_event_loop_idle_closure_t));
+        closure->handler = idle_handler;
+        closure->user_data = user_data;
+
+        ply_list_append_data (loop->idle_closures, closure);
+}
+
+void
+ply_event_loop_stop_watching_for_idle (ply_event_loop_t             *loop,
+                                       ply_event_loop_idle_handler_t idle_handler,
+                                       void                         *user_data)
+{
+        ply_list_t *lists[] = { loop->idle_closures, loop->running_idle_closures };
+        size_t i;
+
+        for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+                ply_list_node_t *node;
+
+                node = ply_event_loop_find_idle_closure (lists[i],
+                                                         idle_handler,
+                                                         user_data);
+                if (node == NULL)
+                        continue;
+
+                free (ply_list_node_get_data (node));
+                ply_list_remove_node (lists[i], node);
+        }
+}
+
+static void
+ply_event_loop_handle_idle_closures (ply_event_loop_t *loop)
+{
+        ply_list_node_t *node;
+
+        if (ply_list_get_length (loop->idle_closures) == 0)
+                return;
+
+        loop->running_idle_closures = loop->idle_closures;
+        loop->idle_closures = ply_list_new ();
+
+        /* Taken off one at a time, since a handler may stop watching for
+         * the ones after it
+         */
+        while ((node = ply_list_get_first_node (loop->running_idle_closures)) != NULL) {
+                ply_event_loop_idle_closure_t *closure;
+
+                closure = (ply_event_loop_idle_closure_t *) ply_list_node_get_data (node);
+                ply_list_remove_node (loop->running_idle_closures, node);
+
+                closure->handler (closure->user_data, loop);
+                free (closure);
+        }
+
+        ply_list_free (loop->running_idle_closures);
+        loop->running_idle_closures = NULL;
+}
+
+static void
+ply_event_loop_run_idle_closures (ply_event_loop_t *loop)
+{
+        while (ply_list_get_length (loop->idle_closures) > 0) {
+                ply_event_loop_handle_idle_closures (loop);
+        }
+}
+
+static bool
+ply_event_loop_timeout_watch_is_due_before (ply_event_loop_timeout_watch_t *watch,
+                                            ply_event_loop_timeout_watch_t *other_watch)
+{
+        if (watch->timeout != other_watch->timeout)
+                return watch->timeout < other_watch->timeout;
+        return watch->serial < other_watch->serial;
+}
+
+static void
+ply_event_loop_set_timeout_heap_entry (ply_event_loop_t               *loop,
+                                       int                             index,
+                                       ply_event_loop_timeout_watch_t *watch)
+{
+        loop->timeout_heap[index] = watch;
+        watch->heap_index = index;
+}
+
+static void
+ply_event_loop_move_timeout_watch_up (ply_event_loop_t               *loop,
+                                      ply_event_loop_timeout_watch_t *watch)
+{
+        int index = watch->heap_index;
+
+        while (index > 0) {
+                int parent_index = (index - 1) / 2;
+                ply_event_loop_timeout_watch_t *parent = loop->timeout_heap[parent_index];
+
+                if (!ply_event_loop_timeout_watch_is_due_before (watch, parent))
+                        break;
+
+                ply_event_loop_set_timeout_heap_entry (loop, index, parent);
+                index = parent_index;
+        }
+        ply_event_loop_set_timeout_heap_entry (loop, index, watch);
+}
+
+static void
+ply_event_loop_move_timeout_watch_down (ply_event_loop_t               *loop,
+                                        ply_event_loop_timeout_watch_t *watch)
+{
+        int index = watch->heap_index;
+
+        while (2 * index + 1 < loop->timeout_count) {
+                int child_index = 2 * index + 1;
+                ply_event_loop_timeout_watch_t *child = loop->timeout_heap[child_index];
+
+                if (child_index + 1 < loop->timeout_count &&
+                    ply_event_loop_timeout_watch_is_due_before (loop->timeout_heap[child_index + 1], child)) {
+                        child_index++;
+                        child = loop->timeout_heap[child_index];
+                }
+
+                if (!ply_event_loop_timeout_watch_is_due_before (child, watch))
+                        break;
+
+                ply_event_loop_set_timeout_heap_entry (loop, index, child);
+                index = child_index;
+        }
+        ply_event_loop_set_timeout_heap_entry (loop, index, watch);
+}
+
+static void
+ply_event_loop_add_timeout_watch (ply_event_loop_t               *loop,
+                                  ply_event_loop_timeout_watch_t *watch)
+{
+        ply_event_loop_timeout_watch_t *first_watch;
+
+        if (loop->timeout_count == loop->timeout_heap_size) {
+                loop->timeout_heap_size = loop->timeout_heap_size ? loop->timeout_heap_size * 2 : 16;
+                loop->timeout_heap = realloc (loop->timeout_heap,
+                                              loop->timeout_heap_size * sizeof(ply_event_loop_timeout_watch_t *));
+        }
+        watch->heap_index = loop->timeout_count++;
+        ply_event_loop_move_timeout_watch_up (loop, watch);
+
+        first_watch = ply_hashtable_lookup (loop->timeout_watches, watch->user_data);
+        if (first_watch != NULL) {
+                watch->next_watch = first_watch->next_watch;
+                first_watch->next_watch = watch;
+        } else {
+                watch->next_watch = NULL;
+                ply_hashtable_insert (loop->timeout_watches, watch->user_data, watch);
+        }
+}
+
+static void
+ply_event_loop_remove_timeout_watch (ply_event_loop_t               *loop,
+                                     ply_event_loop_timeout_watch_t *watch)
+{
+        ply_event_loop_timeout_watch_t *first_watch;
+        ply_event_loop_timeout_watch_t *last_watch;
+
+        last_watch = loop->timeout_heap[--loop->timeout_count];
+        if (last_watch != watch) {
+                ply_event_loop_set_timeout_heap_entry (loop, watch->heap_index, last_watch);
+                ply_event_loop_move_timeout_watch_up (loop, last_watch);
+                ply_event_loop_move_timeout_watch_down (loop, last_watch);
+        }
+
+        first_watch = ply_hashtable_lookup (loop->timeout_watches, watch->user_data);
+        if (first_watch == watch) {
+                ply_hashtable_remove (loop->timeout_watches, watch->user_data);
+                if (watch->next_watch != NULL)
+                        ply_hashtable_insert (loop->timeout_watches, watch->user_data, watch->next_watch);
+        } else {
+                while (first_watch->next_watch != watch) {
+                        first_watch = first_watch->next_watch;
+                }
+                first_watch->next_watch = watch->next_watch;
+        }
+}
+
+/* Sets the timer to go off when the first timeout is due */
+static void
+ply_event_loop_update_timer (ply_event_loop_t *loop)
+{
+        struct itimerspec timer_spec = { { 0, 0 }, { 0, 0 } };
+        uint64_t wakeup_time;
+
+        if (loop->timeout_count > 0)
+                wakeup_time = loop->timeout_heap[0]->timeout;
+        else
+                wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
+
+        if (wakeup_time == loop->wakeup_time)
+                return;
+        loop->wakeup_time = wakeup_time;
+
+        if (loop->timer_fd < 0)
+                return;
+
+        if (wakeup_time != PLY_EVENT_LOOP_NO_TIMED_WAKEUP) {
+                timer_spec.it_value.tv_sec = wakeup_time / PLY_NANOSECONDS_PER_SECOND;
+                timer_spec.it_value.tv_nsec = wakeup_time % PLY_NANOSECONDS_PER_SECOND;
+        }
+
+        if (timerfd_settime (loop->timer_fd, TFD_TIMER_ABSTIME, &timer_spec, NULL) < 0)
+                ply_trace ("could not set timer: %m");
+}
+
+static void
+ply_event_loop_on_timer (ply_event_loop_t *loop,
+                         int               fd)
+{
+        uint64_t expirations;
+
+        if (read (fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                ply_trace ("could not read timer: %m");
+
+        /* Timeouts due now were handled before this, so whatever is left
+         * needs the timer setting again, even if it is for the same time.
+         */
+        loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
+        ply_event_loop_update_timer (loop);
+}
+
 void
 ply_event_loop_watch_for_timeout (ply_event_loop_t                *loop,
                                   double                           seconds,
                                   ply_event_loop_timeout_handler_t timeout_handler,
                                   void                            *user_data)
+{
+        assert (seconds > 0.0);
+
+        ply_event_loop_watch_for_deadline (loop,
+                                           ply_get_monotonic_time () + (uint64_t) (seconds * PLY_NANOSECONDS_PER_SECOND),
+                                           timeout_handler,
+                                           user_data);
+}
+
+/* Like ply_event_loop_watch_for_timeout, but at a time given by
+ * ply_get_monotonic_time, so repeating timeouts do not drift.
+ */
+void
+ply_event_loop_watch_for_deadline (ply_event_loop_t                *loop,
+                                   uint64_t                         deadline,
+                                   ply_event_loop_timeout_handler_t timeout_handler,
+                                   void                            *user_data)
 {
         ply_event_loop_timeout_watch_t *timeout_watch;
 
         assert (loop != NULL);
         assert (timeout_handler != NULL);
-        assert (seconds > 0.0);
 
         timeout_watch = calloc (1, sizeof(ply_event_loop_timeout_watch_t));
-        timeout_watch->timeout = ply_get_timestamp () + seconds;
+        timeout_watch->timeout = deadline;
+        timeout_watch->serial = loop->timeout_serial++;
         timeout_watch->handler = timeout_handler;
         timeout_watch->user_data = user_data;
 
-        if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0)
-                loop->wakeup_time = timeout_watch->timeout;
-        else
-                loop->wakeup_time = MIN (loop->wakeup_time, timeout_watch->timeout);
-
-        ply_list_append_data (loop->timeout_watches, timeout_watch);
+        ply_event_loop_add_timeout_watch (loop, timeout_watch);
+        ply_event_loop_update_timer (loop);
 }
 
 void
@@ -935,41 +1287,33 @@ ply_event_loop_stop_watching_for_timeout (ply_event_loop_t                *loop,
                                           ply_event_loop_timeout_handler_t timeout_handler,
                                           void                            *user_data)
 {
-        ply_list_node_t *node;
+        ply_event_loop_timeout_watch_t *timeout_watch;
         bool timeout_removed;
 
-        loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
-
         timeout_removed = false;
-        node = ply_list_get_first_node (loop->timeout_watches);
-        while (node != NULL) {
-                ply_list_node_t *next_node;
-                ply_event_loop_timeout_watch_t *timeout_watch;
+        timeout_watch = ply_hashtable_lookup (loop->timeout_watches, user_data);
+        while (timeout_watch != NULL) {
+                ply_event_loop_timeout_watch_t *next_watch;
 
-                timeout_watch = (ply_event_loop_timeout_watch_t *) ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (loop->timeout_watches, node);
+                next_watch = timeout_watch->next_watch;
 
-                if (timeout_watch->handler == timeout_handler &&
-                    timeout_watch->user_data == user_data) {
-                        ply_list_remove_node (loop->timeout_watches, node);
+                if (timeout_watch->handler == timeout_handler) {
+                        ply_event_loop_remove_timeout_watch (loop, timeout_watch);
                         free (timeout_watch);
 
                         if (timeout_removed)
                                 ply_trace ("multiple matching timeouts found for removal");
 
                         timeout_removed = true;
-                } else {
-                        if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0)
-                                loop->wakeup_time = timeout_watch->timeout;
-                        else
-                                loop->wakeup_time = MIN (loop->wakeup_time, timeout_watch->timeout);
                 }
 
-                node = next_node;
+                timeout_watch = next_watch;
         }
 
         if (!timeout_removed)
                 ply_trace ("no matching timeout found for removal");
+
+        ply_event_loop_update_timer (loop);
 }
 
 static ply_event_loop_fd_status_t
@@ -1098,26 +1442,18 @@ ply_event_loop_free_watches_for_source (ply_event_loop_t   *loop,
 static void
 ply_event_loop_free_timeout_watches (ply_event_loop_t *loop)
 {
-        ply_list_node_t *node;
-
         assert (loop != NULL);
 
-        node = ply_list_get_first_node (loop->timeout_watches);
-        while (node != NULL) {
-                ply_list_node_t *next_node;
+        while (loop->timeout_count > 0) {
                 ply_event_loop_timeout_watch_t *watch;
 
-                watch = (ply_event_loop_timeout_watch_t *) ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (loop->timeout_watches, node);
-
+                watch = loop->timeout_heap[loop->timeout_count - 1];
+                ply_event_loop_remove_timeout_watch (loop, watch);
                 free (watch);
-                ply_list_remove_node (loop->timeout_watches, node);
-
-                node = next_node;
         }
 
-        assert (ply_list_get_length (loop->timeout_watches) == 0);
-        loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
+        assert (ply_hashtable_get_size (loop->timeout_watches) == 0);
+        ply_event_loop_update_timer (loop);
 }
 
 static void
@@ -1170,41 +1506,24 @@ ply_event_loop_disconnect_source (ply_event_loop_t   *loop,
 static void
 ply_event_loop_handle_timeouts (ply_event_loop_t *loop)
 {
-        ply_list_node_t *node;
-        double now;
+        uint64_t now;
 
         assert (loop != NULL);
 
-        now = ply_get_timestamp ();
-        node = ply_list_get_first_node (loop->timeout_watches);
-        loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
-        while (node != NULL) {
-                ply_list_node_t *next_node;
+        now = ply_get_monotonic_time ();
+        while (loop->timeout_count > 0 && loop->timeout_heap[0]->timeout <= now) {
                 ply_event_loop_timeout_watch_t *watch;
 
-                watch = (ply_event_loop_timeout_watch_t *) ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (loop->timeout_watches, node);
-
-                if (watch->timeout <= now) {
-                        assert (watch->handler != NULL);
-
-                        ply_list_remove_node (loop->timeout_watches, node);
+                watch = loop->timeout_heap[0];
+                assert (watch->handler != NULL);
 
-                        watch->handler (watch->user_data, loop);
-                        free (watch);
-
-                        /* start over in case the handler invalidated the list
-                         */
-                        next_node = ply_list_get_first_node (loop->timeout_watches);
-                } else {
-                        if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0)
-                                loop->wakeup_time = watch->timeout;
-                        else
-                                loop->wakeup_time = MIN (loop->wakeup_time, watch->timeout);
-                }
+                ply_event_loop_remove_timeout_watch (loop, watch);
 
-                node = next_node;
+                watch->handler (watch->user_data, loop);
+                free (watch);
         }
+
+        ply_event_loop_update_timer (loop);
 }
 
 void
@@ -1221,11 +1540,19 @@ ply_event_loop_process_pending_events (ply_event_loop_t *loop)
         do {
                 int timeout;
 
-                if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0) {
+                if (ply_list_get_length (loop->idle_closures) > 0) {
+                        timeout = 0;
+                } else if (loop->timer_fd >= 0 ||
+                           loop->wakeup_time == PLY_EVENT_LOOP_NO_TIMED_WAKEUP) {
                         timeout = -1;
                 } else {
-                        timeout = (int) ((loop->wakeup_time - ply_get_timestamp ()) * 1000);
-                        timeout = MAX (timeout, 0);
+                        uint64_t now = ply_get_monotonic_time ();
+
+                        /* Rounded up, so the timeout is due on waking */
+                        if (loop->wakeup_time > now)
+                                timeout = MIN ((loop->wakeup_time - now + 999999) / 1000000, INT_MAX);
+                        else
+                                timeout = 0;
                 }
 
                 number_of_received_events = epoll_wait (loop->epoll_fd, events,
@@ -1292,6 +1619,8 @@ ply_event_loop_process_pending_events (ply_event_loop_t *loop)
 
                 ply_event_source_drop_reference (source);
         }
+
+        ply_event_loop_handle_idle_closures (loop);
 }
 
 void
@@ -1312,7 +1641,14 @@ ply_event_loop_run (ply_event_loop_t *loop)
                 ply_event_loop_process_pending_events (loop);
         }
 
+        /* Deferred work, like flushing the last frame drawn, still happens.
+         * Closures that keep queueing themselves get one more go before the
+         * exit closures, which are expected to stop them.
+         */
+        ply_event_loop_handle_idle_closures (loop);
         ply_event_loop_run_exit_closures (loop);
+        ply_event_loop_run_idle_closures (loop);
+
         ply_event_loop_free_sources (loop);
         ply_event_loop_free_timeout_watches (loop);
 
@@ -45,6 +45,8 @@ typedef void (*ply_event_loop_exit_handler_t) (void             *user_data,
                                                ply_event_loop_t *loop);
 typedef void (*ply_event_loop_timeout_handler_t) (void             *user_data,
                                                   ply_event_loop_t *loop);
+typedef void (*ply_event_loop_idle_handler_t) (void             *user_data,
+                                               ply_event_loop_t *loop);
 
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_event_loop_t *ply_event_loop_new (void);
@@ -75,11 +77,22 @@ void ply_event_loop_watch_for_timeout (ply_event_loop_t                *loop,
                                        double                           seconds,
                                        ply_event_loop_timeout_handler_t timeout_handler,
                                        void                            *user_data);
+void ply_event_loop_watch_for_deadline (ply_event_loop_t                *loop,
+                                        uint64_t                         deadline,
+                                        ply_event_loop_timeout_handler_t timeout_handler,
+                                        void                            *user_data);
 
 void ply_event_loop_stop_watching_for_timeout (ply_event_loop_t                *loop,
                                                ply_event_loop_timeout_handler_t timeout_handler,
                                                void                            *user_data);
 
+void ply_event_loop_watch_for_idle (ply_event_loop_t             *loop,
+                                    ply_event_loop_idle_handler_t idle_handler,
+                                    void                         *user_data);
+void ply_event_loop_stop_watching_for_idle (ply_event_loop_t             *loop,
+                                            ply_event_loop_idle_handler_t idle_handler,
+                                            void                         *user_data);
+
 int ply_event_loop_run (ply_event_loop_t *loop);
 void ply_event_loop_exit (ply_event_loop_t *loop,
                           int               exit_code);
@@ -53,8 +53,8 @@
 
 struct _ply_progress
 {
-        double      start_time;
-        double      pause_time;
+        uint64_t    start_time;
+        uint64_t    pause_time;
         double      scalar;
         double      last_percentage;
         double      last_percentage_time;
@@ -77,10 +77,9 @@ ply_progress_new (void)
 {
         ply_progress_t *progress = calloc (1, sizeof(ply_progress_t));
 
-        progress->start_time = ply_get_timestamp ();
+        progress->start_time = ply_get_monotonic_time ();
         progress->pause_time = 0;
         progress->scalar = 1.0 / DEFAULT_BOOT_DURATION;
-        progress->pause_time = 0.0;
         progress->last_percentage = 0.0;
         progress->last_percentage_time = 0.0;
         progress->dead_time = 0.0;
@@ -271,15 +270,20 @@ ply_progress_set_percentage (ply_progress_t *progress, double percentage)
 double
 ply_progress_get_time (ply_progress_t *progress)
 {
+        uint64_t now;
+
         if (progress->paused)
-                return progress->pause_time - progress->start_time;
-        return ply_get_timestamp () - progress->start_time;
+                now = progress->pause_time;
+        else
+                now = ply_get_monotonic_time ();
+
+        return (double) (now - progress->start_time) / PLY_NANOSECONDS_PER_SECOND;
 }
 
 void
 ply_progress_pause (ply_progress_t *progress)
 {
-        progress->pause_time = ply_get_timestamp ();
+        progress->pause_time = ply_get_monotonic_time ();
         progress->paused = true;
         return;
 }
@@ -288,7 +292,7 @@ ply_progress_pause (ply_progress_t *progress)
 void
 ply_progress_unpause (ply_progress_t *progress)
 {
-        progress->start_time += ply_get_timestamp () - progress->pause_time;
+        progress->start_time += ply_get_monotonic_time () - progress->pause_time;
         progress->paused = false;
         return;
 }
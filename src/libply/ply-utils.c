@@ -468,18 +468,23 @@ ply_string_has_prefix (const char *str, const char *prefix)
         return strncmp (str, prefix, strlen (prefix)) == 0;
 }
 
-double
-ply_get_timestamp (void)
+/* Nanoseconds on a clock that never jumps, for scheduling and for
+ * measuring how long things take.
+ */
+uint64_t
+ply_get_monotonic_time (void)
 {
-        const double nanoseconds_per_second = 1000000000.0;
-        double timestamp;
         struct timespec now = { 0L, /* zero-filled */ };
 
         clock_gettime (CLOCK_MONOTONIC, &now);
-        timestamp = ((nanoseconds_per_second * now.tv_sec) + now.tv_nsec) /
-                    nanoseconds_per_second;
 
-        return timestamp;
+        return (uint64_t) now.tv_sec * PLY_NANOSECONDS_PER_SECOND + now.tv_nsec;
+}
+
+double
+ply_get_timestamp (void)
+{
+        return ply_get_monotonic_time () / (double) PLY_NANOSECONDS_PER_SECOND;
 }
 
 void
@@ -43,6 +43,8 @@
 
 #define PLY_UTF8_CHARACTER_SIZE_MAX 4
 
+#define PLY_NANOSECONDS_PER_SECOND 1000000000ULL
+
 typedef intptr_t ply_module_handle_t;
 typedef void (*ply_module_function_t) (void);
 
@@ -86,6 +88,7 @@ bool ply_set_fd_as_blocking (int fd);
 char **ply_copy_string_array (const char *const *array);
 void ply_free_string_array (char **array);
 bool ply_string_has_prefix (const char *str, const char *prefix);
+uint64_t ply_get_monotonic_time (void);
 double ply_get_timestamp (void);
 
 void ply_save_errno (void);
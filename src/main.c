@@ -37,6 +37,7 @@
 #include <assert.h>
 #include <values.h>
 #include <locale.h>
+#include <signal.h>
 
 #include <linux/kd.h>
 #include <linux/vt.h>
@@ -94,7 +95,7 @@ typedef struct
         ply_trigger_t          *deactivate_trigger;
         ply_trigger_t          *quit_trigger;
 
-        double                  start_time;
+        uint64_t                start_time;
         double                  splash_delay;
         double                  device_timeout;
 
@@ -953,25 +954,23 @@ show_splash (state_t *state)
         if (state->boot_splash != NULL)
                 return;
 
-        if (!isnan (state->splash_delay)) {
-                double now, running_time;
-
-                now = ply_get_timestamp ();
-                running_time = now - state->start_time;
-                if (state->splash_delay > running_time) {
-                        double time_left = state->splash_delay - running_time;
+        if (!isnan (state->splash_delay) && state->splash_delay > 0) {
+                uint64_t now, show_time;
 
+                now = ply_get_monotonic_time ();
+                show_time = state->start_time + (uint64_t) (state->splash_delay * PLY_NANOSECONDS_PER_SECOND);
+                if (show_time > now) {
                         ply_trace ("delaying show splash for %lf seconds",
-                                   time_left);
+                                   (double) (show_time - now) / PLY_NANOSECONDS_PER_SECOND);
                         ply_event_loop_stop_watching_for_timeout (state->loop,
                                                                   (ply_event_loop_timeout_handler_t)
                                                                   show_splash,
                                                                   state);
-                        ply_event_loop_watch_for_timeout (state->loop,
-                                                          time_left,
-                                                          (ply_event_loop_timeout_handler_t)
-                                                          show_splash,
-                                                          state);
+                        ply_event_loop_watch_for_deadline (state->loop,
+                                                           show_time,
+                                                           (ply_event_loop_timeout_handler_t)
+                                                           show_splash,
+                                                           state);
                         /* Listen for ESC to show details */
                         ply_device_manager_activate_keyboards (state->device_manager);
                         return;
@@ -2104,6 +2103,11 @@ start_plymouthd_fd_escrow (void)
         pid = fork ();
         if (pid == 0) {
                 const char *argv[] = { PLYMOUTH_DRM_ESCROW_DIRECTORY "/plymouthd-fd-escrow", NULL };
+                sigset_t mask;
+
+                /* The event loop blocks the signals it watches */
+                sigemptyset (&mask);
+                sigprocmask (SIG_SETMASK, &mask, NULL);
 
                 execve (argv[0], (char * const *) argv, NULL);
                 ply_trace ("could not launch fd escrow process: %m");
@@ -2165,7 +2169,7 @@ main (int    argc,
         char *tty = NULL;
         ply_device_manager_flags_t device_manager_flags = PLY_DEVICE_MANAGER_FLAGS_NONE;
 
-        state.start_time = ply_get_timestamp ();
+        state.start_time = ply_get_monotonic_time ();
         state.command_parser = ply_command_parser_new ("plymouthd", "Splash server");
 
         state.loop = ply_event_loop_get_default ();
@@ -30,6 +30,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <string.h>
 #include <stdbool.h>
@@ -69,6 +70,22 @@
 #define DRM_MODE_ROTATE_0 (1<<0)
 #endif
 
+typedef struct
+{
+        uint32_t id;
+
+        uint32_t handle;
+        uint32_t width;
+        uint32_t height;
+        uint32_t row_stride;
+
+        void    *map_address;
+        uint32_t map_size;
+        int      map_count;
+
+        uint32_t added_fb : 1;
+} ply_renderer_buffer_t;
+
 struct _ply_renderer_head
 {
         ply_renderer_backend_t *backend;
@@ -88,6 +105,24 @@ struct _ply_renderer_head
 
         int                     gamma_size;
         uint16_t                *gamma;
+
+        /* The damaged areas of the shadow buffer being copied out, either
+         * right away or by the head's flush thread.  While a flush is
+         * pending the shadow buffer must not change.
+         */
+        ply_rectangle_t        *areas_to_flush;
+        int                     areas_to_flush_count;
+        int                     areas_to_flush_size;
+        char                   *flush_map_address;
+        ply_renderer_buffer_t  *flush_dirty_buffer;   /* NULL if not needed */
+        int                     flush_dirty_fb_result;
+
+        pthread_t               flush_thread;
+        pthread_mutex_t         flush_mutex;
+        pthread_cond_t          flush_cond;
+        bool                    has_flush_thread;
+        bool                    flush_is_pending;
+        bool                    flush_thread_should_exit;
 };
 
 struct _ply_renderer_input_source
@@ -101,22 +136,6 @@ struct _ply_renderer_input_source
         void                               *user_data;
 };
 
-typedef struct
-{
-        uint32_t id;
-
-        uint32_t handle;
-        uint32_t width;
-        uint32_t height;
-        uint32_t row_stride;
-
-        void    *map_address;
-        uint32_t map_size;
-        int      map_count;
-
-        uint32_t added_fb : 1;
-} ply_renderer_buffer_t;
-
 typedef struct
 {
         drmModeModeInfo mode;
@@ -157,6 +176,7 @@ struct _ply_renderer_backend
 
         uint32_t                         is_active : 1;
         uint32_t        requires_explicit_flushing : 1;
+        uint32_t                 use_flush_threads : 1;
 
         int                              panel_width;
         int                              panel_height;
@@ -169,6 +189,8 @@ static bool open_input_source (ply_renderer_backend_t      *backend,
                                ply_renderer_input_source_t *input_source);
 static void flush_head (ply_renderer_backend_t *backend,
                         ply_renderer_head_t    *head);
+static void ply_renderer_head_wait_for_flush (ply_renderer_head_t *head);
+static void ply_renderer_head_stop_flush_thread (ply_renderer_head_t *head);
 
 static bool
 ply_renderer_buffer_map (ply_renderer_backend_t *backend,
@@ -376,6 +398,32 @@ begin_flush (ply_renderer_backend_t *backend,
         return buffer->map_address;
 }
 
+/* Tells drivers which need it that the buffer changed.  This may be
+ * called from a flush thread, so the result is only acted on through
+ * handle_dirty_buffer_result on the main thread.
+ */
+static int
+dirty_buffer (ply_renderer_backend_t *backend,
+              ply_renderer_buffer_t  *buffer)
+{
+        struct drm_clip_rect flush_area;
+
+        flush_area.x1 = 0;
+        flush_area.y1 = 0;
+        flush_area.x2 = buffer->width;
+        flush_area.y2 = buffer->height;
+
+        return drmModeDirtyFB (backend->device_fd, buffer->id, &flush_area, 1);
+}
+
+static void
+handle_dirty_buffer_result (ply_renderer_backend_t *backend,
+                            int                     result)
+{
+        if (result == -ENOSYS)
+                backend->requires_explicit_flushing = false;
+}
+
 static void
 end_flush (ply_renderer_backend_t *backend,
            uint32_t                buffer_id)
@@ -386,20 +434,8 @@ end_flush (ply_renderer_backend_t *backend,
 
         assert (buffer != NULL);
 
-        if (backend->requires_explicit_flushing) {
-                struct drm_clip_rect flush_area;
-                int ret;
-
-                flush_area.x1 = 0;
-                flush_area.y1 = 0;
-                flush_area.x2 = buffer->width;
-                flush_area.y2 = buffer->height;
-
-                ret = drmModeDirtyFB (backend->device_fd, buffer->id, &flush_area, 1);
-
-                if (ret == -ENOSYS)
-                        backend->requires_explicit_flushing = false;
-        }
+        if (backend->requires_explicit_flushing)
+                handle_dirty_buffer_result (backend, dirty_buffer (backend, buffer));
 }
 
 static void
@@ -666,7 +702,9 @@ static void
 ply_renderer_head_free (ply_renderer_head_t *head)
 {
         ply_trace ("freeing %ldx%ld renderer head", head->area.width, head->area.height);
+        ply_renderer_head_stop_flush_thread (head);
         ply_pixel_buffer_free (head->pixel_buffer);
+        free (head->areas_to_flush);
 
         ply_array_free (head->connector_ids);
         free (head->gamma);
@@ -771,6 +809,7 @@ ply_renderer_head_unmap (ply_renderer_backend_t *backend,
                          ply_renderer_head_t    *head)
 {
         ply_trace ("unmapping %ldx%ld renderer head", head->area.width, head->area.height);
+        ply_renderer_head_wait_for_flush (head);
         unmap_buffer (backend, head->scan_out_buffer_id);
 
         destroy_output_buffer (backend, head->scan_out_buffer_id);
@@ -859,6 +898,123 @@ ply_renderer_head_flush_area (ply_renderer_head_t *head,
         flush_area (src, head->area.width * 4, dst, head->row_stride, area_to_flush);
 }
 
+static void
+ply_renderer_head_flush_areas (ply_renderer_head_t *head)
+{
+        int i;
+
+        for (i = 0; i < head->areas_to_flush_count; i++) {
+                ply_renderer_head_flush_area (head, &head->areas_to_flush[i],
+                                              head->flush_map_address);
+        }
+}
+
+static void *
+ply_renderer_head_flush_thread (void *user_data)
+{
+        ply_renderer_head_t *head = user_data;
+
+        pthread_mutex_lock (&head->flush_mutex);
+        while (true) {
+                while (!head->flush_is_pending && !head->flush_thread_should_exit) {
+                        pthread_cond_wait (&head->flush_cond, &head->flush_mutex);
+                }
+
+                if (!head->flush_is_pending)
+                        break;
+
+                pthread_mutex_unlock (&head->flush_mutex);
+
+                ply_renderer_head_flush_areas (head);
+
+                if (head->flush_dirty_buffer != NULL)
+                        head->flush_dirty_fb_result = dirty_buffer (head->backend,
+                                                                    head->flush_dirty_buffer);
+
+                pthread_mutex_lock (&head->flush_mutex);
+                head->flush_is_pending = false;
+                pthread_cond_broadcast (&head->flush_cond);
+        }
+        pthread_mutex_unlock (&head->flush_mutex);
+
+        return NULL;
+}
+
+static bool
+ply_renderer_head_start_flush_thread (ply_renderer_head_t *head)
+{
+        sigset_t all_signals, old_signals;
+        int error;
+
+        if (head->has_flush_thread)
+                return true;
+
+        pthread_mutex_init (&head->flush_mutex, NULL);
+        pthread_cond_init (&head->flush_cond, NULL);
+
+        /* Signals are left to the event loop, so the thread blocks them all */
+        sigfillset (&all_signals);
+        pthread_sigmask (SIG_SETMASK, &all_signals, &old_signals);
+        error = pthread_create (&head->flush_thread, NULL,
+                                ply_renderer_head_flush_thread, head);
+        pthread_sigmask (SIG_SETMASK, &old_signals, NULL);
+
+        if (error != 0) {
+                ply_trace ("could not start flush thread: %s", strerror (error));
+                pthread_cond_destroy (&head->flush_cond);
+                pthread_mutex_destroy (&head->flush_mutex);
+                head->backend->use_flush_threads = false;
+                return false;
+        }
+
+        head->has_flush_thread = true;
+        return true;
+}
+
+static void
+ply_renderer_head_stop_flush_thread (ply_renderer_head_t *head)
+{
+        if (!head->has_flush_thread)
+                return;
+
+        pthread_mutex_lock (&head->flush_mutex);
+        head->flush_thread_should_exit = true;
+        pthread_cond_broadcast (&head->flush_cond);
+        pthread_mutex_unlock (&head->flush_mutex);
+
+        pthread_join (head->flush_thread, NULL);
+
+        pthread_cond_destroy (&head->flush_cond);
+        pthread_mutex_destroy (&head->flush_mutex);
+        head->has_flush_thread = false;
+        head->flush_thread_should_exit = false;
+}
+
+static void
+ply_renderer_head_queue_flush (ply_renderer_head_t *head)
+{
+        pthread_mutex_lock (&head->flush_mutex);
+        head->flush_is_pending = true;
+        pthread_cond_broadcast (&head->flush_cond);
+        pthread_mutex_unlock (&head->flush_mutex);
+}
+
+static void
+ply_renderer_head_wait_for_flush (ply_renderer_head_t *head)
+{
+        if (!head->has_flush_thread)
+                return;
+
+        pthread_mutex_lock (&head->flush_mutex);
+        while (head->flush_is_pending) {
+                pthread_cond_wait (&head->flush_cond, &head->flush_mutex);
+        }
+        pthread_mutex_unlock (&head->flush_mutex);
+
+        handle_dirty_buffer_result (head->backend, head->flush_dirty_fb_result);
+        head->flush_dirty_fb_result = 0;
+}
+
 static void
 free_heads (ply_renderer_backend_t *backend)
 {
@@ -901,6 +1057,7 @@ create_backend (const char     *device_name,
         backend->input_source.key_buffer = ply_buffer_new ();
         backend->terminal = terminal;
         backend->requires_explicit_flushing = true;
+        backend->use_flush_threads = !ply_kernel_command_line_has_argument ("plymouth.no-threaded-flush");
         backend->output_buffers = ply_hashtable_new (ply_hashtable_direct_hash,
                                                      ply_hashtable_direct_compare);
         backend->heads_by_controller_id = ply_hashtable_new (NULL, NULL);
@@ -950,6 +1107,16 @@ activate (ply_renderer_backend_t *backend)
 static void
 deactivate (ply_renderer_backend_t *backend)
 {
+        ply_renderer_head_t *head;
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                head = (ply_renderer_head_t *) ply_list_node_get_data (node);
+                ply_renderer_head_wait_for_flush (head);
+                node = ply_list_get_next_node (backend->heads, node);
+        }
+
         ply_trace ("dropping master");
         drmDropMaster (backend->device_fd);
         backend->is_active = false;
@@ -1678,8 +1845,6 @@ flush_head (ply_renderer_backend_t *backend,
         ply_list_t *areas_to_flush;
         ply_list_node_t *node;
         ply_pixel_buffer_t *pixel_buffer;
-        char *map_address;
-        bool dirty = false;
 
         assert (backend != NULL);
 
@@ -1690,6 +1855,9 @@ flush_head (ply_renderer_backend_t *backend,
                 ply_terminal_set_mode (backend->terminal, PLY_TERMINAL_MODE_GRAPHICS);
                 ply_terminal_set_unbuffered_input (backend->terminal);
         }
+
+        ply_renderer_head_wait_for_flush (head);
+
         pixel_buffer = head->pixel_buffer;
         updated_region = ply_pixel_buffer_get_updated_areas (pixel_buffer);
         areas_to_flush = ply_region_get_sorted_rectangle_list (updated_region);
@@ -1700,27 +1868,54 @@ flush_head (ply_renderer_backend_t *backend,
                         return;
         }
 
-        map_address = begin_flush (backend, head->scan_out_buffer_id);
+        head->flush_map_address = begin_flush (backend, head->scan_out_buffer_id);
 
+        head->areas_to_flush_count = 0;
         node = ply_list_get_first_node (areas_to_flush);
         while (node != NULL) {
                 area_to_flush = (ply_rectangle_t *) ply_list_node_get_data (node);
 
-                ply_renderer_head_flush_area (head, area_to_flush, map_address);
-                dirty = true;
+                if (head->areas_to_flush_count == head->areas_to_flush_size) {
+                        head->areas_to_flush_size = MAX (2 * head->areas_to_flush_size, 16);
+                        head->areas_to_flush = realloc (head->areas_to_flush,
+                                                        head->areas_to_flush_size * sizeof(ply_rectangle_t));
+                }
+                head->areas_to_flush[head->areas_to_flush_count++] = *area_to_flush;
 
                 node = ply_list_get_next_node (areas_to_flush, node);
         }
 
-        if (dirty) {
+        ply_region_clear (updated_region);
+
+        if (head->areas_to_flush_count == 0)
+                return;
+
+        /* The copy is left to the head's thread, so heads flush in parallel
+         * and the event loop carries on.  The first flush after the scan out
+         * buffer changed is done in place, so it is filled in before it is shown.
+         */
+        if (backend->use_flush_threads &&
+            !head->scan_out_buffer_needs_reset &&
+            ply_renderer_head_start_flush_thread (head)) {
                 if (reset_scan_out_buffer_if_needed (backend, head))
                         ply_trace ("Needed to reset scan out buffer on %ldx%ld renderer head",
                                    head->area.width, head->area.height);
 
-                end_flush (backend, head->scan_out_buffer_id);
+                if (backend->requires_explicit_flushing)
+                        head->flush_dirty_buffer = get_buffer_from_id (backend, head->scan_out_buffer_id);
+                else
+                        head->flush_dirty_buffer = NULL;
+                ply_renderer_head_queue_flush (head);
+                return;
         }
 
-        ply_region_clear (updated_region);
+        ply_renderer_head_flush_areas (head);
+
+        if (reset_scan_out_buffer_if_needed (backend, head))
+                ply_trace ("Needed to reset scan out buffer on %ldx%ld renderer head",
+                           head->area.width, head->area.height);
+
+        end_flush (backend, head->scan_out_buffer_id);
 }
 
 static ply_list_t *
@@ -1736,6 +1931,9 @@ get_buffer_for_head (ply_renderer_backend_t *backend,
         if (head->backend != backend)
                 return NULL;
 
+        /* The caller is about to draw, which has to wait for the last flush */
+        ply_renderer_head_wait_for_flush (head);
+
         return head->pixel_buffer;
 }
 
@@ -57,6 +57,7 @@
 #include "script-parse.h"
 #include "script-object.h"
 #include "script-execute.h"
+#include "script-profile.h"
 #include "script-lib-image.h"
 #include "script-lib-sprite.h"
 #include "script-lib-plymouth.h"
@@ -78,6 +79,7 @@ struct _ply_boot_splash_plugin
 
         char                       *script_filename;
         char                       *image_dir;
+        char                       *profile_filename;
 
         ply_list_t                 *script_env_vars;
         script_op_t                *script_main_op;
@@ -90,6 +92,8 @@ struct _ply_boot_splash_plugin
         script_lib_string_data_t   *script_string_lib;
 
         uint32_t                    is_animating : 1;
+        uint32_t                    is_idle : 1;
+        uint32_t                    should_profile : 1;
 };
 
 typedef struct
@@ -175,6 +179,12 @@ create_plugin (ply_key_file_t *key_file)
         plugin->script_filename = ply_key_file_get_value (key_file,
                                                           "script",
                                                           "ScriptFile");
+        plugin->should_profile = ply_key_file_get_bool (key_file,
+                                                        "script",
+                                                        "Profile");
+        plugin->profile_filename = ply_key_file_get_value (key_file,
+                                                           "script",
+                                                           "ProfileFile");
 
         plugin->script_env_vars = ply_list_new ();
         ply_key_file_foreach_entry (key_file, add_script_env_var, plugin->script_env_vars);
@@ -212,6 +222,7 @@ destroy_plugin (ply_boot_splash_plugin_t *plugin)
         ply_list_free (plugin->script_env_vars);
         free (plugin->script_filename);
         free (plugin->image_dir);
+        free (plugin->profile_filename);
         free (plugin);
 }
 
@@ -219,7 +230,9 @@ static void
 on_timeout (ply_boot_splash_plugin_t *plugin)
 {
         double sleep_time;
+        bool damaged;
 
+        plugin->is_idle = false;
         sleep_time = 1.0 / plugin->script_plymouth_lib->refresh_rate;
         ply_event_loop_watch_for_timeout (plugin->loop,
                                           sleep_time,
@@ -230,8 +243,28 @@ on_timeout (ply_boot_splash_plugin_t *plugin)
                                         plugin->script_plymouth_lib);
 
         pause_displays (plugin);
-        script_lib_sprite_refresh (plugin->script_sprite_lib);
+        damaged = script_lib_sprite_refresh (plugin->script_sprite_lib);
         unpause_displays (plugin);
+
+        /* Without a refresh function the script only runs from the other
+         * callbacks, so once a frame has nothing to draw there is no point
+         * waking up again until one of them is called.
+         */
+        if (!damaged && !script_lib_plymouth_has_refresh_function (plugin->script_plymouth_lib)) {
+                ply_trace ("nothing to draw, stopping the frame timer");
+                ply_event_loop_stop_watching_for_timeout (plugin->loop,
+                                                          (ply_event_loop_timeout_handler_t)
+                                                          on_timeout, plugin);
+                plugin->is_idle = true;
+        }
+}
+
+/* Draws what a callback changed and restarts the frame timer if it stopped */
+static void
+wake_up (ply_boot_splash_plugin_t *plugin)
+{
+        if (plugin->is_idle && plugin->loop != NULL)
+                on_timeout (plugin);
 }
 
 static void
@@ -243,6 +276,21 @@ on_boot_progress (ply_boot_splash_plugin_t *plugin,
                                               plugin->script_plymouth_lib,
                                               duration,
                                               fraction_done);
+
+        /* Progress comes in many times a second, so only restart the frame
+         * timer if the callback actually moved something
+         */
+        if (plugin->is_idle && plugin->loop != NULL &&
+            script_lib_plymouth_has_boot_progress_function (plugin->script_plymouth_lib)) {
+                bool damaged;
+
+                pause_displays (plugin);
+                damaged = script_lib_sprite_refresh (plugin->script_sprite_lib);
+                unpause_displays (plugin);
+
+                if (damaged)
+                        wake_up (plugin);
+        }
 }
 
 static bool
@@ -277,6 +325,11 @@ start_script_animation (ply_boot_splash_plugin_t *plugin)
         plugin->script_math_lib = script_lib_math_setup (plugin->script_state);
         plugin->script_string_lib = script_lib_string_setup (plugin->script_state);
 
+        if (plugin->should_profile) {
+                ply_trace ("profiling script");
+                script_profile_start (plugin->profile_filename);
+        }
+
         ply_trace ("executing script file");
         script_return_t ret = script_execute (plugin->script_state,
                                               plugin->script_main_op);
@@ -314,6 +367,7 @@ stop_script_animation (ply_boot_splash_plugin_t *plugin)
         script_lib_plymouth_on_quit (plugin->script_state,
                                      plugin->script_plymouth_lib);
         script_lib_sprite_refresh (plugin->script_sprite_lib);
+        plugin->is_idle = false;
 
         if (plugin->loop != NULL)
                 ply_event_loop_stop_watching_for_timeout (plugin->loop,
@@ -334,6 +388,7 @@ stop_script_animation (ply_boot_splash_plugin_t *plugin)
         script_lib_plymouth_destroy (plugin->script_plymouth_lib);
         script_lib_math_destroy (plugin->script_math_lib);
         script_lib_string_destroy (plugin->script_string_lib);
+        script_profile_stop ();
 }
 
 static void
@@ -370,6 +425,7 @@ on_keyboard_input (ply_boot_splash_plugin_t *plugin,
         script_lib_plymouth_on_keyboard_input (plugin->script_state,
                                                plugin->script_plymouth_lib,
                                                keyboard_string);
+        wake_up (plugin);
 }
 
 static void
@@ -432,6 +488,7 @@ system_update (ply_boot_splash_plugin_t *plugin,
         script_lib_plymouth_on_system_update( plugin->script_state,
                                               plugin->script_plymouth_lib,
                                               progress);
+        wake_up (plugin);
 }
 
 static void
@@ -441,6 +498,7 @@ update_status (ply_boot_splash_plugin_t *plugin,
         script_lib_plymouth_on_update_status (plugin->script_state,
                                               plugin->script_plymouth_lib,
                                               status);
+        wake_up (plugin);
 }
 
 static void
@@ -465,6 +523,7 @@ on_root_mounted (ply_boot_splash_plugin_t *plugin)
 {
         script_lib_plymouth_on_root_mounted (plugin->script_state,
                                              plugin->script_plymouth_lib);
+        wake_up (plugin);
 }
 
 static void
@@ -481,6 +540,7 @@ display_normal (ply_boot_splash_plugin_t *plugin)
         script_lib_plymouth_on_display_normal (plugin->script_state,
                                                plugin->script_plymouth_lib);
         unpause_displays (plugin);
+        wake_up (plugin);
 }
 
 static void
@@ -494,6 +554,7 @@ display_password (ply_boot_splash_plugin_t *plugin,
                                                  prompt,
                                                  bullets);
         unpause_displays (plugin);
+        wake_up (plugin);
 }
 
 static void
@@ -507,6 +568,7 @@ display_question (ply_boot_splash_plugin_t *plugin,
                                                  prompt,
                                                  entry_text);
         unpause_displays (plugin);
+        wake_up (plugin);
 }
 
 static bool
@@ -514,10 +576,14 @@ validate_input (ply_boot_splash_plugin_t *plugin,
                 const char               *entry_text,
                 const char               *add_text)
 {
-        return script_lib_plymouth_on_validate_input (plugin->script_state,
-                                                      plugin->script_plymouth_lib,
-                                                      entry_text,
-                                                      add_text);
+        bool is_valid;
+
+        is_valid = script_lib_plymouth_on_validate_input (plugin->script_state,
+                                                          plugin->script_plymouth_lib,
+                                                          entry_text,
+                                                          add_text);
+        wake_up (plugin);
+        return is_valid;
 }
 
 static void
@@ -533,6 +599,7 @@ display_prompt (ply_boot_splash_plugin_t *plugin,
                                                entry_text,
                                                is_secret);
         unpause_displays (plugin);
+        wake_up (plugin);
 }
 
 static void
@@ -544,6 +611,7 @@ display_message (ply_boot_splash_plugin_t *plugin,
                                                 plugin->script_plymouth_lib,
                                                 message);
         unpause_displays (plugin);
+        wake_up (plugin);
 }
 
 static void
@@ -555,6 +623,7 @@ hide_message (ply_boot_splash_plugin_t *plugin,
                                              plugin->script_plymouth_lib,
                                              message);
         unpause_displays (plugin);
+        wake_up (plugin);
 }
 
 ply_boot_splash_plugin_interface_t *
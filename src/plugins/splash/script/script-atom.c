@@ -0,0 +1,112 @@
+/* script-atom.c - interned strings for script identifiers and keys
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ply-hashtable.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script-atom.h"
+
+static ply_hashtable_t *script_atom_table = NULL;
+
+/* FNV-1a, which spreads short identifiers like "x" and "y" far better than
+ * ply_hashtable_string_hash.
+ */
+static unsigned int script_atom_string_hash (void *element)
+{
+        const unsigned char *string = element;
+        unsigned int hash = 2166136261u;
+
+        while (*string) {
+                hash ^= *string++;
+                hash *= 16777619u;
+        }
+        return hash;
+}
+
+static int script_atom_string_index (const char *string)
+{
+        int index = 0;
+
+        if (string[0] == '0' && string[1] == '\0') return 0;
+        if (string[0] < '1' || string[0] > '9') return -1;
+        for (; *string; string++) {
+                if (*string < '0' || *string > '9') return -1;
+                index = index * 10 + *string - '0';
+                if (index >= SCRIPT_ATOM_INDEX_LIMIT) return -1;
+        }
+        return index;
+}
+
+unsigned int script_atom_hash (void *element)
+{
+        script_atom_t *atom = element;
+
+        return atom->hash;
+}
+
+/* Returns the atom for string if it exists, without taking a reference */
+script_atom_t *script_atom_lookup (const char *string)
+{
+        if (!script_atom_table) return NULL;
+        return ply_hashtable_lookup (script_atom_table, (void *) string);
+}
+
+script_atom_t *script_atom_get (const char *string)
+{
+        script_atom_t *atom = script_atom_lookup (string);
+        size_t length;
+
+        if (atom) return script_atom_ref (atom);
+
+        if (!script_atom_table)
+                script_atom_table = ply_hashtable_new (script_atom_string_hash,
+                                                       ply_hashtable_string_compare);
+        length = strlen (string);
+        atom = malloc (sizeof(script_atom_t) + length + 1);
+        atom->hash = script_atom_string_hash ((void *) string);
+        atom->refcount = 1;
+        atom->index = script_atom_string_index (string);
+        memcpy (atom->string, string, length + 1);
+        ply_hashtable_insert (script_atom_table, atom->string, atom);
+        return atom;
+}
+
+script_atom_t *script_atom_ref (script_atom_t *atom)
+{
+        atom->refcount++;
+        return atom;
+}
+
+void script_atom_unref (script_atom_t *atom)
+{
+        if (!atom) return;
+        assert (atom->refcount > 0);
+        atom->refcount--;
+        if (atom->refcount > 0) return;
+
+        ply_hashtable_remove (script_atom_table, atom->string);
+        free (atom);
+}
@@ -0,0 +1,44 @@
+/* script-atom.h - interned strings for script identifiers and keys
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_ATOM_H
+#define SCRIPT_ATOM_H
+
+/* Atoms are reference counted interned strings: two atoms are equal exactly
+ * when their pointers are, and each carries its hash so that script hashes
+ * never need to look at the characters again.
+ */
+/* Keys below this limit print the same with "%d" and "%g" */
+#define SCRIPT_ATOM_INDEX_LIMIT 1000000
+
+typedef struct script_atom_t
+{
+        unsigned int hash;
+        int          refcount;
+        int          index;     /* value if the string is a small array index, else -1 */
+        char         string[];
+} script_atom_t;
+
+script_atom_t *script_atom_get (const char *string);
+script_atom_t *script_atom_lookup (const char *string);
+script_atom_t *script_atom_ref (script_atom_t *atom);
+void script_atom_unref (script_atom_t *atom);
+unsigned int script_atom_hash (void *element);
+
+#endif /* SCRIPT_ATOM_H */
@@ -0,0 +1,666 @@
+/* script-cache.c - cache of parsed scripts
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ply-list.h"
+#include "ply-logger.h"
+#include "ply-utils.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "script.h"
+#include "script-cache.h"
+#include "script-debug.h"
+#include "script-parse.h"
+
+#define SCRIPT_CACHE_MAGIC 0x53504c50   /* "PLPS" */
+#define SCRIPT_CACHE_VERSION 1
+#define SCRIPT_CACHE_NULL 0xff
+
+/* A cache file holds the optimized parse tree of one script, written out in
+ * prefix order with sizes instead of pointers.  It is keyed by a checksum of
+ * the plymouth version, the node type numbering and the script's name and
+ * source, so a cache from another build is never loaded.  The payload has
+ * its own checksum so a damaged file is never trusted.
+ */
+typedef struct
+{
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint64_t checksum;
+        uint64_t size;
+} script_cache_header_t;
+
+typedef struct
+{
+        uint8_t *data;
+        size_t   size;
+        size_t   allocated;
+} script_cache_writer_t;
+
+typedef struct
+{
+        const uint8_t *data;
+        size_t         size;
+        size_t         offset;
+        const char    *name;
+        bool           failed;
+} script_cache_reader_t;
+
+static uint64_t script_cache_checksum (uint64_t    hash,
+                                       const void *data,
+                                       size_t      size)
+{
+        const uint8_t *bytes = data;
+        size_t i;
+
+        for (i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= 0x100000001b3ULL;
+        }
+        return hash;
+}
+
+static uint64_t script_cache_get_key (const char *source,
+                                      const char *name)
+{
+        uint32_t node_type_counts[] = { SCRIPT_OP_TYPE_CONTINUE + 1,
+                                        SCRIPT_EXP_TYPE_ASSIGN_EXTEND + 1 };
+        uint64_t key = 0xcbf29ce484222325ULL;
+
+        key = script_cache_checksum (key, PACKAGE_VERSION, strlen (PACKAGE_VERSION) + 1);
+        key = script_cache_checksum (key, node_type_counts, sizeof(node_type_counts));
+        key = script_cache_checksum (key, name, strlen (name) + 1);
+        return script_cache_checksum (key, source, strlen (source));
+}
+
+/* One file per script name, so an edited theme replaces its old cache */
+static char *script_cache_get_filename (const char *name)
+{
+        uint64_t hash = script_cache_checksum (0xcbf29ce484222325ULL, name, strlen (name));
+        char *filename = NULL;
+
+        asprintf (&filename, PLYMOUTH_STATE_DIRECTORY "script-%016llx.cache",
+                  (unsigned long long) hash);
+        return filename;
+}
+
+static void script_cache_write (script_cache_writer_t *writer,
+                                const void            *data,
+                                size_t                 size)
+{
+        if (writer->size + size > writer->allocated) {
+                writer->allocated = (writer->size + size) * 2;
+                writer->data = realloc (writer->data, writer->allocated);
+        }
+        memcpy (writer->data + writer->size, data, size);
+        writer->size += size;
+}
+
+static void script_cache_write_uint8 (script_cache_writer_t *writer,
+                                      uint8_t                value)
+{
+        script_cache_write (writer, &value, sizeof(value));
+}
+
+static void script_cache_write_int32 (script_cache_writer_t *writer,
+                                      int32_t                value)
+{
+        script_cache_write (writer, &value, sizeof(value));
+}
+
+static void script_cache_write_string (script_cache_writer_t *writer,
+                                       const char            *string)
+{
+        int32_t length = strlen (string);
+
+        script_cache_write_int32 (writer, length);
+        script_cache_write (writer, string, length);
+}
+
+/* Every node of a parsed script has a location, but the name is that of the
+ * script itself so only the position is stored.
+ */
+static void script_cache_write_location (script_cache_writer_t *writer,
+                                         void                  *element)
+{
+        script_debug_location_t *location = script_debug_lookup_element (element);
+
+        script_cache_write_int32 (writer, location ? location->line_index : -1);
+        script_cache_write_int32 (writer, location ? location->column_index : -1);
+}
+
+static void script_cache_write_op (script_cache_writer_t *writer,
+                                   script_op_t           *op);
+
+static void script_cache_write_exp (script_cache_writer_t *writer,
+                                    script_exp_t          *exp);
+
+static void script_cache_write_exp_list (script_cache_writer_t *writer,
+                                         ply_list_t            *list)
+{
+        ply_list_node_t *node;
+
+        script_cache_write_int32 (writer, ply_list_get_length (list));
+        for (node = ply_list_get_first_node (list);
+             node;
+             node = ply_list_get_next_node (list, node)) {
+                script_cache_write_exp (writer, ply_list_node_get_data (node));
+        }
+}
+
+static void script_cache_write_exp (script_cache_writer_t *writer,
+                                    script_exp_t          *exp)
+{
+        ply_list_node_t *node;
+
+        if (!exp) {
+                script_cache_write_uint8 (writer, SCRIPT_CACHE_NULL);
+                return;
+        }
+        script_cache_write_uint8 (writer, exp->type);
+        script_cache_write_location (writer, exp);
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                script_cache_write_exp (writer, exp->data.dual.sub_a);
+                script_cache_write_exp (writer, exp->data.dual.sub_b);
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                script_cache_write_exp (writer, exp->data.sub);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+                script_cache_write (writer, &exp->data.number, sizeof(script_number_t));
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                script_cache_write_string (writer, exp->data.string);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                script_cache_write_exp_list (writer, exp->data.parameters);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                script_cache_write_exp (writer, exp->data.function_exe.name);
+                script_cache_write_exp_list (writer, exp->data.function_exe.parameters);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                /* the parser only creates script functions */
+                script_cache_write_int32 (writer, ply_list_get_length (exp->data.function_def->parameters));
+                for (node = ply_list_get_first_node (exp->data.function_def->parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.function_def->parameters, node)) {
+                        script_cache_write_string (writer, ply_list_node_get_data (node));
+                }
+                script_cache_write_op (writer, exp->data.function_def->data.script);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                break;
+        }
+}
+
+static void script_cache_write_op (script_cache_writer_t *writer,
+                                   script_op_t           *op)
+{
+        ply_list_node_t *node;
+
+        if (!op) {
+                script_cache_write_uint8 (writer, SCRIPT_CACHE_NULL);
+                return;
+        }
+        script_cache_write_uint8 (writer, op->type);
+        script_cache_write_location (writer, op);
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                script_cache_write_exp (writer, op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                script_cache_write_int32 (writer, ply_list_get_length (op->data.list));
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        script_cache_write_op (writer, ply_list_node_get_data (node));
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                script_cache_write_exp (writer, op->data.cond_op.cond);
+                script_cache_write_op (writer, op->data.cond_op.op1);
+                script_cache_write_op (writer, op->data.cond_op.op2);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+}
+
+static const void *script_cache_read (script_cache_reader_t *reader,
+                                      size_t                 size)
+{
+        const void *data;
+
+        if (reader->failed || size > reader->size - reader->offset) {
+                reader->failed = true;
+                return NULL;
+        }
+        data = reader->data + reader->offset;
+        reader->offset += size;
+        return data;
+}
+
+static uint8_t script_cache_read_uint8 (script_cache_reader_t *reader)
+{
+        const uint8_t *data = script_cache_read (reader, sizeof(uint8_t));
+
+        return data ? *data : SCRIPT_CACHE_NULL;
+}
+
+static int32_t script_cache_read_int32 (script_cache_reader_t *reader)
+{
+        const void *data = script_cache_read (reader, sizeof(int32_t));
+        int32_t value = 0;
+
+        if (data)
+                memcpy (&value, data, sizeof(int32_t));
+        return value;
+}
+
+static char *script_cache_read_string (script_cache_reader_t *reader)
+{
+        int32_t length = script_cache_read_int32 (reader);
+        const char *data;
+
+        if (length < 0) {
+                reader->failed = true;
+                return NULL;
+        }
+        data = script_cache_read (reader, length);
+        return data ? strndup (data, length) : NULL;
+}
+
+/* Counts which cannot fit in what is left are refused before allocating */
+static int32_t script_cache_read_count (script_cache_reader_t *reader)
+{
+        int32_t count = script_cache_read_int32 (reader);
+
+        if (count < 0 || (size_t) count > reader->size - reader->offset) {
+                reader->failed = true;
+                return 0;
+        }
+        return count;
+}
+
+static void script_cache_read_location (script_cache_reader_t *reader,
+                                        void                  *element)
+{
+        script_debug_location_t location;
+
+        location.line_index = script_cache_read_int32 (reader);
+        location.column_index = script_cache_read_int32 (reader);
+        location.name = (char *) reader->name;
+        if (location.line_index >= 0)
+                script_debug_add_element (element, &location);
+}
+
+static script_op_t *script_cache_read_op (script_cache_reader_t *reader);
+
+static script_exp_t *script_cache_read_exp (script_cache_reader_t *reader);
+
+static ply_list_t *script_cache_read_exp_list (script_cache_reader_t *reader)
+{
+        ply_list_t *list = ply_list_new ();
+        int32_t count = script_cache_read_count (reader);
+        int32_t i;
+
+        for (i = 0; i < count && !reader->failed; i++) {
+                script_exp_t *exp = script_cache_read_exp (reader);
+                if (exp)
+                        ply_list_append_data (list, exp);
+        }
+        return list;
+}
+
+/* On failure the partial tree is still well formed, so it can be freed */
+static script_exp_t *script_cache_read_exp (script_cache_reader_t *reader)
+{
+        uint8_t type = script_cache_read_uint8 (reader);
+        script_function_t *function;
+        script_exp_t *exp;
+        int32_t count, i;
+
+        if (type == SCRIPT_CACHE_NULL)
+                return NULL;
+        if (type > SCRIPT_EXP_TYPE_ASSIGN_EXTEND) {
+                reader->failed = true;
+                return NULL;
+        }
+
+        exp = malloc (sizeof(script_exp_t));
+        exp->type = type;
+        script_cache_read_location (reader, exp);
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                exp->data.dual.sub_a = script_cache_read_exp (reader);
+                exp->data.dual.sub_b = script_cache_read_exp (reader);
+                if (!exp->data.dual.sub_a || !exp->data.dual.sub_b)
+                        reader->failed = true;
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                exp->data.sub = script_cache_read_exp (reader);
+                if (!exp->data.sub)
+                        reader->failed = true;
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+        {
+                const void *data = script_cache_read (reader, sizeof(script_number_t));
+                exp->data.number = 0;
+                if (data)
+                        memcpy (&exp->data.number, data, sizeof(script_number_t));
+                break;
+        }
+
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                exp->data.string = script_cache_read_string (reader);
+                if (!exp->data.string) {
+                        exp->data.string = strdup ("");
+                        reader->failed = true;
+                }
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                exp->data.parameters = script_cache_read_exp_list (reader);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                exp->data.function_exe.name = script_cache_read_exp (reader);
+                exp->data.function_exe.parameters = script_cache_read_exp_list (reader);
+                if (!exp->data.function_exe.name)
+                        reader->failed = true;
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                function = script_function_script_new (NULL, NULL, ply_list_new ());
+                exp->data.function_def = function;
+                count = script_cache_read_count (reader);
+                for (i = 0; i < count && !reader->failed; i++) {
+                        char *parameter = script_cache_read_string (reader);
+                        if (parameter)
+                                ply_list_append_data (function->parameters, parameter);
+                }
+                function->data.script = script_cache_read_op (reader);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                break;
+        }
+        return exp;
+}
+
+static script_op_t *script_cache_read_op (script_cache_reader_t *reader)
+{
+        uint8_t type = script_cache_read_uint8 (reader);
+        script_op_t *op;
+        int32_t count, i;
+
+        if (type == SCRIPT_CACHE_NULL)
+                return NULL;
+        if (type > SCRIPT_OP_TYPE_CONTINUE) {
+                reader->failed = true;
+                return NULL;
+        }
+
+        op = malloc (sizeof(script_op_t));
+        op->type = type;
+        script_cache_read_location (reader, op);
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+                op->data.exp = script_cache_read_exp (reader);
+                if (!op->data.exp)
+                        reader->failed = true;
+                break;
+
+        case SCRIPT_OP_TYPE_RETURN:
+                op->data.exp = script_cache_read_exp (reader);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                op->data.list = ply_list_new ();
+                count = script_cache_read_count (reader);
+                for (i = 0; i < count && !reader->failed; i++) {
+                        script_op_t *sub_op = script_cache_read_op (reader);
+                        if (sub_op)
+                                ply_list_append_data (op->data.list, sub_op);
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                op->data.cond_op.cond = script_cache_read_exp (reader);
+                op->data.cond_op.op1 = script_cache_read_op (reader);
+                op->data.cond_op.op2 = script_cache_read_op (reader);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+        return op;
+}
+
+/* Returns the parse tree cached for this exact source, or NULL */
+script_op_t *script_cache_load (const char *source,
+                                const char *name)
+{
+        script_cache_header_t header;
+        script_cache_reader_t reader;
+        struct stat file_info;
+        script_op_t *op = NULL;
+        uint8_t *map;
+        char *filename;
+        int fd;
+
+        filename = script_cache_get_filename (name);
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
+        free (filename);
+        if (fd < 0)
+                return NULL;
+
+        if (fstat (fd, &file_info) < 0 ||
+            (size_t) file_info.st_size < sizeof(script_cache_header_t)) {
+                close (fd);
+                return NULL;
+        }
+
+        map = mmap (NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close (fd);
+        if (map == MAP_FAILED)
+                return NULL;
+
+        memcpy (&header, map, sizeof(script_cache_header_t));
+        if (header.magic != SCRIPT_CACHE_MAGIC ||
+            header.version != SCRIPT_CACHE_VERSION ||
+            header.size != file_info.st_size - sizeof(script_cache_header_t) ||
+            header.key != script_cache_get_key (source, name) ||
+            header.checksum != script_cache_checksum (0xcbf29ce484222325ULL,
+                                                      map + sizeof(script_cache_header_t),
+                                                      header.size)) {
+                ply_trace ("script cache for %s is stale", name);
+                goto out;
+        }
+
+        reader.data = map + sizeof(script_cache_header_t);
+        reader.size = header.size;
+        reader.offset = 0;
+        reader.name = name;
+        reader.failed = false;
+
+        op = script_cache_read_op (&reader);
+        if (reader.failed || !op || reader.offset != reader.size) {
+                ply_trace ("script cache for %s is damaged", name);
+                script_parse_op_free (op);
+                op = NULL;
+        }
+out:
+        munmap (map, file_info.st_size);
+        return op;
+}
+
+/* Only writes the cache if the state directory is already there, like the
+ * two-step background cache.
+ */
+void script_cache_save (const char  *source,
+                        const char  *name,
+                        script_op_t *op)
+{
+        script_cache_writer_t writer = { NULL, 0, 0 };
+        script_cache_header_t header;
+        char *filename, *temporary_filename;
+        bool saved;
+        int fd;
+
+        if (!ply_directory_exists (PLYMOUTH_STATE_DIRECTORY))
+                return;
+
+        script_cache_write_op (&writer, op);
+
+        memset (&header, 0, sizeof(header));
+        header.magic = SCRIPT_CACHE_MAGIC;
+        header.version = SCRIPT_CACHE_VERSION;
+        header.key = script_cache_get_key (source, name);
+        header.checksum = script_cache_checksum (0xcbf29ce484222325ULL, writer.data, writer.size);
+        header.size = writer.size;
+
+        filename = script_cache_get_filename (name);
+        asprintf (&temporary_filename, "%s.XXXXXX", filename);
+
+        fd = mkostemp (temporary_filename, O_CLOEXEC);
+        if (fd < 0) {
+                ply_trace ("could not create script cache %s: %m", temporary_filename);
+                goto out;
+        }
+
+        saved = ply_write (fd, &header, sizeof(header)) &&
+                ply_write (fd, writer.data, writer.size);
+        saved = close (fd) == 0 && saved;
+
+        if (saved && rename (temporary_filename, filename) == 0) {
+                ply_trace ("saved script cache %s for %s", filename, name);
+        } else {
+                ply_trace ("could not save script cache %s: %m", filename);
+                unlink (temporary_filename);
+        }
+out:
+        free (temporary_filename);
+        free (filename);
+        free (writer.data);
+}
@@ -0,0 +1,31 @@
+/* script-cache.h - cache of parsed scripts
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_CACHE_H
+#define SCRIPT_CACHE_H
+
+#include "script.h"
+
+script_op_t *script_cache_load (const char *source,
+                                const char *name);
+void script_cache_save (const char  *source,
+                        const char  *name,
+                        script_op_t *op);
+
+#endif /* SCRIPT_CACHE_H */
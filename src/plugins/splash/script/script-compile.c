@@ -0,0 +1,802 @@
+/* script-compile.c - compilation of scripts into bytecode
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script.h"
+#include "script-atom.h"
+#include "script-compile.h"
+#include "script-object.h"
+#include "script-profile.h"
+
+typedef struct
+{
+        int *jumps;
+        int  jump_count;
+} script_compile_fixups_t;
+
+typedef struct script_compile_loop_t
+{
+        struct script_compile_loop_t *enclosing;
+        script_compile_fixups_t       break_fixups;
+        script_compile_fixups_t       continue_fixups;
+} script_compile_loop_t;
+
+typedef struct
+{
+        script_code_t         *code;
+        int                    instruction_size;
+        int                    number_size;
+        int                    string_size;
+        int                    element_size;
+        int                    constant_size;
+        int                    atom_size;
+        int                    slot_size;
+        int                    stack_depth;
+        ply_hashtable_t       *atoms;
+        ply_hashtable_t       *slots;
+        script_compile_loop_t *loop;
+} script_compile_t;
+
+static void script_compile_exp (script_compile_t *compile,
+                                script_exp_t     *exp);
+static void script_compile_op (script_compile_t *compile,
+                               script_op_t      *op);
+
+static void *script_compile_grow (void *array,
+                                  int  *size,
+                                  int   count,
+                                  size_t element_size)
+{
+        if (count < *size)
+                return array;
+        *size = *size ? *size * 2 : 16;
+        return realloc (array, *size * element_size);
+}
+
+static void script_compile_adjust_stack (script_compile_t *compile,
+                                         int               change)
+{
+        compile->stack_depth += change;
+        assert (compile->stack_depth >= 0);
+        if (compile->stack_depth > compile->code->stack_size)
+                compile->code->stack_size = compile->stack_depth;
+}
+
+static int script_compile_emit (script_compile_t *compile,
+                                script_opcode_t   opcode,
+                                int               count,
+                                int               operand,
+                                int               stack_change)
+{
+        script_code_t *code = compile->code;
+        script_instruction_t *instruction;
+
+        assert (count >= 0 && count <= UINT16_MAX);
+
+        code->instructions = script_compile_grow (code->instructions,
+                                                  &compile->instruction_size,
+                                                  code->instruction_count,
+                                                  sizeof(script_instruction_t));
+        instruction = &code->instructions[code->instruction_count];
+        instruction->opcode = opcode;
+        instruction->count = count;
+        instruction->operand = operand;
+        script_compile_adjust_stack (compile, stack_change);
+        return code->instruction_count++;
+}
+
+static int script_compile_here (script_compile_t *compile)
+{
+        return compile->code->instruction_count;
+}
+
+static void script_compile_patch (script_compile_t *compile,
+                                  int               jump,
+                                  int               target)
+{
+        compile->code->instructions[jump].operand = target;
+}
+
+static void script_compile_fixups_add (script_compile_fixups_t *fixups,
+                                       int                      jump)
+{
+        fixups->jumps = realloc (fixups->jumps, (fixups->jump_count + 1) * sizeof(int));
+        fixups->jumps[fixups->jump_count++] = jump;
+}
+
+static void script_compile_fixups_resolve (script_compile_t        *compile,
+                                           script_compile_fixups_t *fixups,
+                                           int                      target)
+{
+        int i;
+
+        for (i = 0; i < fixups->jump_count; i++) {
+                script_compile_patch (compile, fixups->jumps[i], target);
+        }
+        free (fixups->jumps);
+        fixups->jumps = NULL;
+        fixups->jump_count = 0;
+}
+
+static int script_compile_add_number (script_compile_t *compile,
+                                      script_number_t   number)
+{
+        script_code_t *code = compile->code;
+
+        code->numbers = script_compile_grow (code->numbers,
+                                             &compile->number_size,
+                                             code->number_count,
+                                             sizeof(script_number_t));
+        code->numbers[code->number_count] = number;
+        return code->number_count++;
+}
+
+static int script_compile_add_string (script_compile_t *compile,
+                                      char             *string)
+{
+        script_code_t *code = compile->code;
+
+        code->strings = script_compile_grow (code->strings,
+                                             &compile->string_size,
+                                             code->string_count,
+                                             sizeof(char *));
+        code->strings[code->string_count] = string;
+        return code->string_count++;
+}
+
+static int script_compile_add_element (script_compile_t *compile,
+                                       void             *element)
+{
+        script_code_t *code = compile->code;
+
+        code->elements = script_compile_grow (code->elements,
+                                              &compile->element_size,
+                                              code->element_count,
+                                              sizeof(void *));
+        code->elements[code->element_count] = element;
+        return code->element_count++;
+}
+
+static int script_compile_add_atom (script_compile_t *compile,
+                                    script_atom_t    *atom)
+{
+        script_code_t *code = compile->code;
+        void *index = ply_hashtable_lookup (compile->atoms, atom);
+
+        if (index) {
+                script_atom_unref (atom);
+                return (intptr_t) index - 1;
+        }
+
+        code->atoms = script_compile_grow (code->atoms,
+                                           &compile->atom_size,
+                                           code->atom_count,
+                                           sizeof(script_atom_t *));
+        code->atoms[code->atom_count] = atom;
+        code->atom_count++;
+        ply_hashtable_insert (compile->atoms, atom, (void *) (intptr_t) code->atom_count);
+        return code->atom_count - 1;
+}
+
+/* Reserves lookup caches for an instruction and returns the count operand
+ * naming them, which is the index of the first plus one, or 0 for none.
+ */
+static int script_compile_add_caches (script_compile_t *compile,
+                                      int               count)
+{
+        script_code_t *code = compile->code;
+        int first = code->cache_count;
+
+        if (first + count >= UINT16_MAX)
+                return 0;
+        code->cache_count += count;
+        return first + 1;
+}
+
+/* Returns the atom index of a key known at compile time, or -1 */
+static int script_compile_get_constant_key (script_compile_t *compile,
+                                            script_exp_t     *exp)
+{
+        char buffer[64];
+
+        if (!exp) return -1;
+        if (exp->type == SCRIPT_EXP_TYPE_TERM_STRING)
+                return script_compile_add_atom (compile, script_atom_get (exp->data.string));
+        if (exp->type == SCRIPT_EXP_TYPE_TERM_NUMBER) {
+                snprintf (buffer, sizeof(buffer), "%g", exp->data.number);
+                return script_compile_add_atom (compile, script_atom_get (buffer));
+        }
+        return -1;
+}
+
+/* Each distinct variable name gets a slot, which the VM uses to remember
+ * where the name was last found in the local hash.
+ */
+static int script_compile_get_slot (script_compile_t *compile,
+                                    char             *name)
+{
+        script_code_t *code = compile->code;
+        script_atom_t *atom = script_atom_get (name);
+        void *slot = ply_hashtable_lookup (compile->slots, atom);
+
+        if (slot) {
+                script_atom_unref (atom);
+                return (intptr_t) slot - 1;
+        }
+
+        code->slot_names = script_compile_grow (code->slot_names,
+                                                &compile->slot_size,
+                                                code->slot_count,
+                                                sizeof(script_atom_t *));
+        code->slot_names[code->slot_count] = atom;
+        code->slot_count++;
+        if (!strcmp (name, "_args"))
+                code->uses_args = true;
+        ply_hashtable_insert (compile->slots, atom, (void *) (intptr_t) code->slot_count);
+        return code->slot_count - 1;
+}
+
+static int script_compile_add_constant (script_compile_t *compile,
+                                        script_number_t   number)
+{
+        script_code_t *code = compile->code;
+        int index;
+
+        for (index = 0; index < code->constant_count; index++) {
+                if (script_obj_as_number (code->constants[index]) == number &&
+                    signbit (script_obj_as_number (code->constants[index])) == signbit (number))
+                        return index;
+        }
+        code->constants = script_compile_grow (code->constants,
+                                               &compile->constant_size,
+                                               code->constant_count,
+                                               sizeof(script_obj_t *));
+        code->constants[code->constant_count] = script_obj_new_number (number);
+        return code->constant_count++;
+}
+
+/* Compiles an operand which the consuming instruction only reads.  Number
+ * literals there never escape, so they can share one object owned by the
+ * code rather than being allocated on every evaluation.
+ */
+static void script_compile_operand (script_compile_t *compile,
+                                    script_exp_t     *exp)
+{
+        if (exp && exp->type == SCRIPT_EXP_TYPE_TERM_NUMBER)
+                script_compile_emit (compile, SCRIPT_OPCODE_PUSH_CONSTANT, 0,
+                                     script_compile_add_constant (compile, exp->data.number), 1);
+        else
+                script_compile_exp (compile, exp);
+}
+
+static void script_compile_dual (script_compile_t *compile,
+                                 script_exp_t     *exp,
+                                 script_opcode_t   opcode,
+                                 int               operand)
+{
+        bool reads_a, reads_b;
+
+        reads_a = (opcode >= SCRIPT_OPCODE_PLUS && opcode <= SCRIPT_OPCODE_MOD) ||
+                  opcode == SCRIPT_OPCODE_CMP;
+        reads_b = reads_a ||
+                  (opcode >= SCRIPT_OPCODE_ASSIGN_PLUS && opcode <= SCRIPT_OPCODE_ASSIGN_MOD);
+
+        if (reads_a)
+                script_compile_operand (compile, exp->data.dual.sub_a);
+        else
+                script_compile_exp (compile, exp->data.dual.sub_a);
+        if (reads_b)
+                script_compile_operand (compile, exp->data.dual.sub_b);
+        else
+                script_compile_exp (compile, exp->data.dual.sub_b);
+        script_compile_emit (compile, opcode, 0, operand, -1);
+}
+
+/* Returns the script_obj_cmp_result_t mask of a comparison, or 0 */
+static int script_compile_cmp_mask (script_exp_t *exp)
+{
+        if (!exp) return 0;
+        if (exp->type == SCRIPT_EXP_TYPE_EQ)
+                return SCRIPT_OBJ_CMP_RESULT_EQ;
+        if (exp->type == SCRIPT_EXP_TYPE_NE)
+                return SCRIPT_OBJ_CMP_RESULT_NE |
+                       SCRIPT_OBJ_CMP_RESULT_LT |
+                       SCRIPT_OBJ_CMP_RESULT_GT;
+        if (exp->type == SCRIPT_EXP_TYPE_GT)
+                return SCRIPT_OBJ_CMP_RESULT_GT;
+        if (exp->type == SCRIPT_EXP_TYPE_GE)
+                return SCRIPT_OBJ_CMP_RESULT_GT |
+                       SCRIPT_OBJ_CMP_RESULT_EQ;
+        if (exp->type == SCRIPT_EXP_TYPE_LT)
+                return SCRIPT_OBJ_CMP_RESULT_LT;
+        if (exp->type == SCRIPT_EXP_TYPE_LE)
+                return SCRIPT_OBJ_CMP_RESULT_LT |
+                       SCRIPT_OBJ_CMP_RESULT_EQ;
+        return 0;
+}
+
+/* Compiles a condition and a jump taken when it is false.  Comparisons
+ * branch on the result directly instead of materialising it as a number.
+ */
+static int script_compile_jump_if_false (script_compile_t *compile,
+                                         script_exp_t     *cond)
+{
+        int mask = script_compile_cmp_mask (cond);
+
+        if (!mask) {
+                script_compile_exp (compile, cond);
+                return script_compile_emit (compile, SCRIPT_OPCODE_JUMP_IF_FALSE, 0, -1, -1);
+        }
+        script_compile_operand (compile, cond->data.dual.sub_a);
+        script_compile_operand (compile, cond->data.dual.sub_b);
+        return script_compile_emit (compile, SCRIPT_OPCODE_JUMP_UNLESS_CMP, mask, -1, -2);
+}
+
+static void script_compile_logic (script_compile_t *compile,
+                                  script_exp_t     *exp,
+                                  script_opcode_t   opcode)
+{
+        int jump;
+
+        script_compile_exp (compile, exp->data.dual.sub_a);
+        jump = script_compile_emit (compile, opcode, 0, -1, -1);
+        script_compile_exp (compile, exp->data.dual.sub_b);
+        script_compile_patch (compile, jump, script_compile_here (compile));
+}
+
+static int script_compile_parameters (script_compile_t *compile,
+                                      ply_list_t       *parameters)
+{
+        ply_list_node_t *node;
+        int count = 0;
+
+        for (node = ply_list_get_first_node (parameters);
+             node;
+             node = ply_list_get_next_node (parameters, node)) {
+                script_exp_t *data_exp = ply_list_node_get_data (node);
+                script_compile_exp (compile, data_exp);
+                count++;
+        }
+        return count;
+}
+
+/* The function is resolved before the arguments are evaluated, and a method
+ * key is evaluated before the object it indexes, as the interpreter always did.
+ */
+static void script_compile_function_exe (script_compile_t *compile,
+                                         script_exp_t     *exp)
+{
+        script_exp_t *name_exp = exp->data.function_exe.name;
+        int count, key;
+
+        if (name_exp && name_exp->type == SCRIPT_EXP_TYPE_HASH) {
+                key = script_compile_get_constant_key (compile, name_exp->data.dual.sub_b);
+                if (key >= 0) {
+                        script_compile_exp (compile, name_exp->data.dual.sub_a);
+                        script_compile_emit (compile, SCRIPT_OPCODE_LOOKUP_METHOD_ATOM,
+                                             script_compile_add_caches (compile, 3), key, 1);
+                } else {
+                        script_compile_exp (compile, name_exp->data.dual.sub_b);
+                        script_compile_exp (compile, name_exp->data.dual.sub_a);
+                        script_compile_emit (compile, SCRIPT_OPCODE_LOOKUP_METHOD, 0, 0, 0);
+                }
+        } else if (name_exp && name_exp->type == SCRIPT_EXP_TYPE_TERM_VAR) {
+                script_compile_emit (compile, SCRIPT_OPCODE_LOOKUP_FUNCTION,
+                                     script_compile_add_caches (compile, 3),
+                                     script_compile_get_slot (compile, name_exp->data.string), 2);
+        } else {
+                script_compile_emit (compile, SCRIPT_OPCODE_PUSH_NO_THIS, 0, 0, 1);
+                script_compile_exp (compile, name_exp);
+        }
+
+        count = script_compile_parameters (compile, exp->data.function_exe.parameters);
+        script_compile_emit (compile, SCRIPT_OPCODE_CALL, count, 0, -(count + 1));
+}
+
+static void script_compile_exp (script_compile_t *compile,
+                                script_exp_t     *exp)
+{
+        int element;
+
+        if (!exp) {
+                script_compile_emit (compile, SCRIPT_OPCODE_PUSH_NULL, 0, 0, 1);
+                return;
+        }
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_PLUS, 0);
+                break;
+        case SCRIPT_EXP_TYPE_MINUS:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_MINUS, 0);
+                break;
+        case SCRIPT_EXP_TYPE_MUL:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_MUL, 0);
+                break;
+        case SCRIPT_EXP_TYPE_DIV:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_DIV, 0);
+                break;
+        case SCRIPT_EXP_TYPE_MOD:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_MOD, 0);
+                break;
+        case SCRIPT_EXP_TYPE_EXTEND:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_EXTEND, 0);
+                break;
+
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_CMP,
+                                     script_compile_cmp_mask (exp));
+                break;
+
+        case SCRIPT_EXP_TYPE_AND:
+                script_compile_logic (compile, exp, SCRIPT_OPCODE_AND);
+                break;
+        case SCRIPT_EXP_TYPE_OR:
+                script_compile_logic (compile, exp, SCRIPT_OPCODE_OR);
+                break;
+
+        case SCRIPT_EXP_TYPE_POS:
+                script_compile_exp (compile, exp->data.sub);
+                break;
+        case SCRIPT_EXP_TYPE_NOT:
+                script_compile_exp (compile, exp->data.sub);
+                script_compile_emit (compile, SCRIPT_OPCODE_NOT, 0, 0, 0);
+                break;
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+        {
+                script_opcode_t opcode;
+
+                if (exp->type == SCRIPT_EXP_TYPE_NEG) opcode = SCRIPT_OPCODE_NEG;
+                else if (exp->type == SCRIPT_EXP_TYPE_PRE_INC) opcode = SCRIPT_OPCODE_PRE_INC;
+                else if (exp->type == SCRIPT_EXP_TYPE_PRE_DEC) opcode = SCRIPT_OPCODE_PRE_DEC;
+                else if (exp->type == SCRIPT_EXP_TYPE_POST_INC) opcode = SCRIPT_OPCODE_POST_INC;
+                else opcode = SCRIPT_OPCODE_POST_DEC;
+
+                script_compile_exp (compile, exp->data.sub);
+                element = script_compile_add_element (compile, exp);
+                script_compile_emit (compile, opcode, 0, element, 0);
+                break;
+        }
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+                script_compile_emit (compile, SCRIPT_OPCODE_PUSH_NUMBER, 0,
+                                     script_compile_add_number (compile, exp->data.number), 1);
+                break;
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+                script_compile_emit (compile, SCRIPT_OPCODE_PUSH_STRING, 0,
+                                     script_compile_add_string (compile, exp->data.string), 1);
+                break;
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+                script_compile_emit (compile, SCRIPT_OPCODE_PUSH_NULL, 0, 0, 1);
+                break;
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+                compile->code->uses_args = true;
+                script_compile_emit (compile, SCRIPT_OPCODE_PUSH_LOCAL, 0, 0, 1);
+                break;
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+                script_compile_emit (compile, SCRIPT_OPCODE_PUSH_GLOBAL, 0, 0, 1);
+                break;
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                script_compile_emit (compile, SCRIPT_OPCODE_PUSH_THIS, 0, 0, 1);
+                break;
+        case SCRIPT_EXP_TYPE_TERM_SET:
+        {
+                int count = script_compile_parameters (compile, exp->data.parameters);
+                script_compile_emit (compile, SCRIPT_OPCODE_SET, count, 0, 1 - count);
+                break;
+        }
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                script_compile_emit (compile, SCRIPT_OPCODE_VAR,
+                                     script_compile_add_caches (compile, 3),
+                                     script_compile_get_slot (compile, exp->data.string), 1);
+                break;
+
+        case SCRIPT_EXP_TYPE_ASSIGN:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_ASSIGN, 0);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_ASSIGN_PLUS, 0);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_ASSIGN_MINUS, 0);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_ASSIGN_MUL, 0);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_ASSIGN_DIV, 0);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_ASSIGN_MOD, 0);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                script_compile_dual (compile, exp, SCRIPT_OPCODE_ASSIGN_EXTEND, 0);
+                break;
+
+        case SCRIPT_EXP_TYPE_HASH:
+        {
+                int key = script_compile_get_constant_key (compile, exp->data.dual.sub_b);
+
+                if (key >= 0) {
+                        script_compile_exp (compile, exp->data.dual.sub_a);
+                        script_compile_emit (compile, SCRIPT_OPCODE_HASH_ATOM, 0, key, 0);
+                } else {
+                        script_compile_dual (compile, exp, SCRIPT_OPCODE_HASH, 0);
+                }
+                break;
+        }
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                script_compile_function_exe (compile, exp);
+                break;
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                element = script_compile_add_element (compile, exp->data.function_def);
+                script_compile_emit (compile, SCRIPT_OPCODE_PUSH_FUNCTION, 0, element, 1);
+                break;
+
+        default:
+                script_compile_emit (compile, SCRIPT_OPCODE_PUSH_NULL, 0, 0, 1);
+                break;
+        }
+}
+
+/* Marks where the statement starts when profiling, so its cost can be
+ * attributed to its line.
+ */
+static void script_compile_profile (script_compile_t *compile,
+                                    void             *element)
+{
+        script_profile_entry_t *line;
+
+        if (!script_profile_is_enabled ())
+                return;
+        line = script_profile_get_line (element);
+        if (line)
+                script_compile_emit (compile, SCRIPT_OPCODE_PROFILE, 0,
+                                     script_compile_add_element (compile, line), 0);
+}
+
+/* A while loop that finishes right after a "continue" hands the continue on
+ * to whatever contains it, just like the interpreter did.
+ */
+static void script_compile_pass_continue (script_compile_t *compile)
+{
+        int jump = script_compile_emit (compile, SCRIPT_OPCODE_PASS_CONTINUE, 0, -1, 0);
+
+        if (compile->loop)
+                script_compile_fixups_add (&compile->loop->continue_fixups, jump);
+}
+
+static void script_compile_loop (script_compile_t *compile,
+                                 script_op_t      *op)
+{
+        script_compile_loop_t loop = { compile->loop };
+        int top, exit_jump = -1;
+
+        compile->loop = &loop;
+        script_compile_emit (compile, SCRIPT_OPCODE_CLEAR_REPLY, 0, 0, 0);
+
+        if (op->type == SCRIPT_OP_TYPE_DO_WHILE) {
+                top = script_compile_here (compile);
+                script_compile_emit (compile, SCRIPT_OPCODE_CLEAR_REPLY, 0, 0, 0);
+                script_compile_op (compile, op->data.cond_op.op1);
+                script_compile_fixups_resolve (compile, &loop.continue_fixups,
+                                               script_compile_here (compile));
+                script_compile_profile (compile, op);
+                script_compile_exp (compile, op->data.cond_op.cond);
+                script_compile_emit (compile, SCRIPT_OPCODE_JUMP_IF_TRUE, 0, top, -1);
+        } else {
+                top = script_compile_here (compile);
+                script_compile_profile (compile, op);
+                exit_jump = script_compile_jump_if_false (compile, op->data.cond_op.cond);
+                script_compile_emit (compile, SCRIPT_OPCODE_CLEAR_REPLY, 0, 0, 0);
+                script_compile_op (compile, op->data.cond_op.op1);
+                script_compile_fixups_resolve (compile, &loop.continue_fixups,
+                                               script_compile_here (compile));
+                if (op->data.cond_op.op2) {
+                        script_compile_emit (compile, SCRIPT_OPCODE_CLEAR_REPLY, 0, 0, 0);
+                        script_compile_op (compile, op->data.cond_op.op2);
+                }
+                script_compile_emit (compile, SCRIPT_OPCODE_JUMP, 0, top, 0);
+                script_compile_patch (compile, exit_jump, script_compile_here (compile));
+        }
+
+        compile->loop = loop.enclosing;
+        if (!op->data.cond_op.op2)
+                script_compile_pass_continue (compile);
+        script_compile_fixups_resolve (compile, &loop.break_fixups,
+                                       script_compile_here (compile));
+}
+
+static void script_compile_op (script_compile_t *compile,
+                               script_op_t      *op)
+{
+        if (!op) return;
+
+        if (op->type != SCRIPT_OP_TYPE_OP_BLOCK &&
+            op->type != SCRIPT_OP_TYPE_WHILE &&
+            op->type != SCRIPT_OP_TYPE_DO_WHILE &&
+            op->type != SCRIPT_OP_TYPE_FOR)
+                script_compile_profile (compile, op);
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+                script_compile_exp (compile, op->data.exp);
+                script_compile_emit (compile, SCRIPT_OPCODE_SET_REPLY, 0, 0, -1);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+        {
+                ply_list_node_t *node;
+                bool first = true;
+
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        script_op_t *sub_op = ply_list_node_get_data (node);
+                        if (!first)
+                                script_compile_emit (compile, SCRIPT_OPCODE_CLEAR_REPLY, 0, 0, 0);
+                        script_compile_op (compile, sub_op);
+                        first = false;
+                }
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_IF:
+        {
+                int else_jump, end_jump;
+
+                else_jump = script_compile_jump_if_false (compile, op->data.cond_op.cond);
+                script_compile_op (compile, op->data.cond_op.op1);
+                if (op->data.cond_op.op2) {
+                        end_jump = script_compile_emit (compile, SCRIPT_OPCODE_JUMP, 0, -1, 0);
+                        script_compile_patch (compile, else_jump, script_compile_here (compile));
+                        script_compile_op (compile, op->data.cond_op.op2);
+                        script_compile_patch (compile, end_jump, script_compile_here (compile));
+                } else {
+                        script_compile_patch (compile, else_jump, script_compile_here (compile));
+                }
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                script_compile_loop (compile, op);
+                break;
+
+        case SCRIPT_OP_TYPE_RETURN:
+                script_compile_exp (compile, op->data.exp);
+                script_compile_emit (compile, SCRIPT_OPCODE_RETURN, 0, 0, -1);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+                script_compile_emit (compile, SCRIPT_OPCODE_LEAVE, 0, SCRIPT_RETURN_TYPE_FAIL, 0);
+                break;
+
+        case SCRIPT_OP_TYPE_BREAK:
+                if (compile->loop) {
+                        int jump = script_compile_emit (compile, SCRIPT_OPCODE_BREAK, 0, -1, 0);
+                        script_compile_fixups_add (&compile->loop->break_fixups, jump);
+                } else {
+                        script_compile_emit (compile, SCRIPT_OPCODE_LEAVE, 0, SCRIPT_RETURN_TYPE_BREAK, 0);
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_CONTINUE:
+                if (compile->loop) {
+                        int jump = script_compile_emit (compile, SCRIPT_OPCODE_CONTINUE, 0, -1, 0);
+                        script_compile_fixups_add (&compile->loop->continue_fixups, jump);
+                } else {
+                        script_compile_emit (compile, SCRIPT_OPCODE_LEAVE, 0, SCRIPT_RETURN_TYPE_CONTINUE, 0);
+                }
+                break;
+        }
+}
+
+script_code_t *script_compile (script_op_t *op)
+{
+        script_compile_t compile;
+
+        memset (&compile, 0, sizeof(compile));
+        compile.code = calloc (1, sizeof(script_code_t));
+        compile.atoms = ply_hashtable_new (script_atom_hash, NULL);
+        compile.slots = ply_hashtable_new (script_atom_hash, NULL);
+
+        if (script_profile_is_enabled ())
+                compile.code->profile = script_profile_get_function (op);
+        script_compile_op (&compile, op);
+        script_compile_emit (&compile, SCRIPT_OPCODE_END, 0, 0, 0);
+        assert (compile.stack_depth == 0);
+        compile.code->caches = calloc (compile.code->cache_count + 1,
+                                       sizeof(script_obj_hash_cache_t));
+
+        ply_hashtable_free (compile.atoms);
+        ply_hashtable_free (compile.slots);
+        return compile.code;
+}
+
+script_code_t *script_compile_function (script_function_t *function)
+{
+        script_code_t *code = script_compile (function->data.script);
+        ply_list_node_t *node;
+        int index = 0;
+
+        code->parameter_count = ply_list_get_length (function->parameters);
+        code->parameters = malloc (code->parameter_count * sizeof(script_atom_t *));
+        for (node = ply_list_get_first_node (function->parameters);
+             node;
+             node = ply_list_get_next_node (function->parameters, node)) {
+                char *name = ply_list_node_get_data (node);
+                code->parameters[index++] = script_atom_get (name);
+        }
+        return code;
+}
+
+void script_code_free (script_code_t *code)
+{
+        int i;
+
+        if (!code) return;
+        for (i = 0; i < code->atom_count; i++) {
+                script_atom_unref (code->atoms[i]);
+        }
+        for (i = 0; i < code->slot_count; i++) {
+                script_atom_unref (code->slot_names[i]);
+        }
+        for (i = 0; i < code->parameter_count; i++) {
+                script_atom_unref (code->parameters[i]);
+        }
+        for (i = 0; i < code->constant_count; i++) {
+                script_obj_unref (code->constants[i]);
+        }
+        free (code->constants);
+        free (code->caches);
+        free (code->atoms);
+        free (code->parameters);
+        free (code->instructions);
+        free (code->numbers);
+        free (code->strings);
+        free (code->elements);
+        free (code->slot_names);
+        free (code);
+}
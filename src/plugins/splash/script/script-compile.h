@@ -0,0 +1,127 @@
+/* script-compile.h - compilation of scripts into bytecode
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_COMPILE_H
+#define SCRIPT_COMPILE_H
+
+#include <stdint.h>
+
+#include "script.h"
+#include "script-atom.h"
+#include "script-object.h"
+#include "script-profile.h"
+
+/* Every expression leaves exactly one owned reference on the stack.  Ops
+ * do not touch the stack; they update the reply register which mirrors the
+ * script_return_t the tree walker used to pass around.
+ */
+typedef enum
+{
+        SCRIPT_OPCODE_PUSH_NULL,
+        SCRIPT_OPCODE_PUSH_NUMBER,      /* operand: number index */
+        SCRIPT_OPCODE_PUSH_STRING,      /* operand: string index */
+        SCRIPT_OPCODE_PUSH_CONSTANT,    /* operand: constant index, read-only operands only */
+        SCRIPT_OPCODE_PUSH_LOCAL,
+        SCRIPT_OPCODE_PUSH_GLOBAL,
+        SCRIPT_OPCODE_PUSH_THIS,
+        SCRIPT_OPCODE_PUSH_FUNCTION,    /* operand: element index */
+        SCRIPT_OPCODE_PUSH_NO_THIS,     /* pushes a NULL pointer, not a null object */
+        SCRIPT_OPCODE_VAR,              /* operand: slot, count: caches */
+        SCRIPT_OPCODE_SET,              /* count: elements */
+        SCRIPT_OPCODE_HASH,
+        SCRIPT_OPCODE_HASH_ATOM,        /* operand: atom index of a constant key */
+        SCRIPT_OPCODE_PLUS,
+        SCRIPT_OPCODE_MINUS,
+        SCRIPT_OPCODE_MUL,
+        SCRIPT_OPCODE_DIV,
+        SCRIPT_OPCODE_MOD,
+        SCRIPT_OPCODE_EXTEND,
+        SCRIPT_OPCODE_CMP,              /* operand: script_obj_cmp_result_t mask */
+        SCRIPT_OPCODE_ASSIGN,
+        SCRIPT_OPCODE_ASSIGN_PLUS,
+        SCRIPT_OPCODE_ASSIGN_MINUS,
+        SCRIPT_OPCODE_ASSIGN_MUL,
+        SCRIPT_OPCODE_ASSIGN_DIV,
+        SCRIPT_OPCODE_ASSIGN_MOD,
+        SCRIPT_OPCODE_ASSIGN_EXTEND,
+        SCRIPT_OPCODE_NOT,
+        SCRIPT_OPCODE_NEG,              /* operand: element index of the expression */
+        SCRIPT_OPCODE_PRE_INC,          /* operand: element index of the expression */
+        SCRIPT_OPCODE_PRE_DEC,
+        SCRIPT_OPCODE_POST_INC,
+        SCRIPT_OPCODE_POST_DEC,
+        SCRIPT_OPCODE_AND,              /* operand: target if the top is false, else pops */
+        SCRIPT_OPCODE_OR,               /* operand: target if the top is true, else pops */
+        SCRIPT_OPCODE_LOOKUP_FUNCTION,  /* operand: slot, count: caches, pushes this and function */
+        SCRIPT_OPCODE_LOOKUP_METHOD,    /* pops key and object, pushes this and function */
+        SCRIPT_OPCODE_LOOKUP_METHOD_ATOM, /* operand: atom index, count: caches, pops object */
+        SCRIPT_OPCODE_CALL,             /* count: arguments above this and function */
+        SCRIPT_OPCODE_SET_REPLY,
+        SCRIPT_OPCODE_CLEAR_REPLY,
+        SCRIPT_OPCODE_JUMP,             /* operand: target */
+        SCRIPT_OPCODE_JUMP_IF_FALSE,    /* operand: target, pops the condition */
+        SCRIPT_OPCODE_JUMP_IF_TRUE,     /* operand: target, pops the condition */
+        SCRIPT_OPCODE_JUMP_UNLESS_CMP,  /* count: cmp mask, operand: target, pops two */
+        SCRIPT_OPCODE_BREAK,            /* operand: target */
+        SCRIPT_OPCODE_CONTINUE,         /* operand: target */
+        SCRIPT_OPCODE_PASS_CONTINUE,    /* operand: target, or -1 to leave */
+        SCRIPT_OPCODE_RETURN,
+        SCRIPT_OPCODE_LEAVE,            /* operand: script_return_type_t */
+        SCRIPT_OPCODE_PROFILE,          /* operand: element index of the line's profile entry */
+        SCRIPT_OPCODE_END,
+        SCRIPT_OPCODE_COUNT,
+} script_opcode_t;
+
+typedef struct
+{
+        uint8_t  opcode;
+        uint16_t count;
+        int32_t  operand;
+} script_instruction_t;
+
+typedef struct script_code_t
+{
+        script_instruction_t *instructions;
+        int                   instruction_count;
+        script_number_t      *numbers;
+        int                   number_count;
+        char                **strings;       /* owned by the parse tree */
+        int                   string_count;
+        void                **elements;      /* parse tree nodes */
+        int                   element_count;
+        script_obj_t        **constants;     /* shared number operands */
+        int                   constant_count;
+        script_obj_hash_cache_t *caches;  /* for the lookups of VAR and LOOKUP_* */
+        int                   cache_count;
+        script_atom_t       **atoms;         /* constant hash keys */
+        int                   atom_count;
+        script_atom_t       **slot_names;
+        int                   slot_count;
+        script_atom_t       **parameters;
+        int                   parameter_count;
+        int                   stack_size;
+        bool                  uses_args;       /* reads _args or the local hash */
+        script_profile_entry_t *profile;       /* set when compiled while profiling */
+} script_code_t;
+
+script_code_t *script_compile (script_op_t *op);
+script_code_t *script_compile_function (script_function_t *function);
+void script_code_free (script_code_t *code);
+
+#endif /* SCRIPT_COMPILE_H */
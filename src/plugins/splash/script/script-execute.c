@@ -38,16 +38,17 @@
 #include <math.h>
 
 #include "script.h"
+#include "script-compile.h"
 #include "script-debug.h"
 #include "script-execute.h"
 #include "script-object.h"
+#include "script-profile.h"
 
-static script_obj_t *script_evaluate (script_state_t *state,
-                                      script_exp_t   *exp);
-static script_return_t script_execute_function_with_parlist (script_state_t    *state,
-                                                             script_function_t *function,
-                                                             script_obj_t      *this,
-                                                             ply_list_t        *parameter_data);
+static script_return_t script_execute_function_with_args (script_state_t    *state,
+                                                          script_function_t *function,
+                                                          script_obj_t      *this,
+                                                          script_obj_t     **args,
+                                                          int                arg_count);
 
 
 static void script_execute_error (void       *element,
@@ -67,169 +68,83 @@ static void script_execute_error (void       *element,
 }
 
 
-static script_obj_t *script_evaluate_apply_function (script_state_t                                                  *state,
-                                                     script_exp_t                                                    *exp,
-                                                     script_obj_t                                                     *(*function)(script_obj_t *,
-                                                                                                         script_obj_t *))
-{
-        script_obj_t *script_obj_a = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *script_obj_b = script_evaluate (state, exp->data.dual.sub_b);
-        script_obj_t *obj = function (script_obj_a, script_obj_b);
-
-        script_obj_unref (script_obj_a);
-        script_obj_unref (script_obj_b);
-        return obj;
-}
 
-static script_obj_t *script_evaluate_apply_function_and_assign (script_state_t                                                  *state,
-                                                                script_exp_t                                                    *exp,
-                                                                script_obj_t                                                     *(*function)(script_obj_t *,
-                                                                                                                    script_obj_t *))
+static script_obj_t *script_execute_set (script_obj_t **elements,
+                                         int            count)
 {
-        script_obj_t *script_obj_a = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *script_obj_b = script_evaluate (state, exp->data.dual.sub_b);
-        script_obj_t *obj = function (script_obj_a, script_obj_b);
+        script_obj_t *obj = script_obj_new_hash ();
+        int index;
 
-        script_obj_assign (script_obj_a, obj);
-        script_obj_unref (script_obj_a);
-        script_obj_unref (script_obj_b);
+        for (index = 0; index < count; index++) {
+                script_obj_hash_add_element_index (obj, elements[index], index);
+                script_obj_unref (elements[index]);
+        }
         return obj;
 }
 
-static script_obj_t *script_evaluate_hash (script_state_t *state,
-                                           script_exp_t   *exp)
+static void script_execute_make_hash (script_obj_t *hash)
 {
-        script_obj_t *hash = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *key = script_evaluate (state, exp->data.dual.sub_b);
-        script_obj_t *obj;
-        char *name = script_obj_as_string (key);
-
         if (!script_obj_is_hash (hash)) {
                 script_obj_t *newhash = script_obj_new_hash ();
                 script_obj_assign (hash, newhash);
                 script_obj_unref (newhash);
         }
-
-        obj = script_obj_hash_get_element (hash, name);
-        free (name);
-
-        script_obj_unref (hash);
-        script_obj_unref (key);
-        return obj;
 }
 
-static script_obj_t *script_evaluate_var (script_state_t *state,
-                                          script_exp_t   *exp)
+static script_obj_t *script_execute_hash_atom (script_obj_t  *hash,
+                                               script_atom_t *name)
 {
-        char *name = exp->data.string;
-        script_obj_t *obj = script_obj_hash_peek_element (state->local, name);
+        script_obj_t *obj;
 
-        if (obj) return obj;
-        obj = script_obj_hash_peek_element (state->this, name);
-        if (obj) return obj;
-        obj = script_obj_hash_peek_element (state->global, name);
-        if (obj) return obj;
-        obj = script_obj_hash_get_element (state->local, name);
+        script_execute_make_hash (hash);
+        obj = script_obj_hash_get_element_atom (hash, name);
+
+        script_obj_unref (hash);
         return obj;
 }
 
-static script_obj_t *script_evaluate_set (script_state_t *state,
-                                          script_exp_t   *exp)
+static script_obj_t *script_execute_hash (script_obj_t *hash,
+                                          script_obj_t *key)
 {
-        ply_list_t *parameter_data = exp->data.parameters;
-        ply_list_node_t *node_data = ply_list_get_first_node (parameter_data);
-        int index = 0;
-        script_obj_t *obj = script_obj_new_hash ();
-
-        while (node_data) {
-                script_exp_t *data_exp = ply_list_node_get_data (node_data);
-                script_obj_t *data_obj = script_evaluate (state, data_exp);
-                char *name;
-                asprintf (&name, "%d", index);
-                index++;
-                script_obj_hash_add_element (obj, data_obj, name);
-                free (name);
+        script_atom_t *name;
+        script_obj_t *obj;
+        int index;
 
-                node_data = ply_list_get_next_node (parameter_data, node_data);
+        if (script_obj_key_as_index (key, &index)) {
+                script_execute_make_hash (hash);
+                obj = script_obj_hash_get_element_index (hash, index);
+                script_obj_unref (hash);
+        } else {
+                name = script_obj_as_atom (key);
+                obj = script_execute_hash_atom (hash, name);
+                script_atom_unref (name);
         }
+        script_obj_unref (key);
         return obj;
 }
 
-static script_obj_t *script_evaluate_assign (script_state_t *state,
-                                             script_exp_t   *exp)
-{
-        script_obj_t *script_obj_a = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *script_obj_b = script_evaluate (state, exp->data.dual.sub_b);
-
-        script_obj_assign (script_obj_a, script_obj_b);
-
-        script_obj_unref (script_obj_b);
-        return script_obj_a;
-}
-
-static script_obj_t *script_evaluate_cmp (script_state_t         *state,
-                                          script_exp_t           *exp,
-                                          script_obj_cmp_result_t condition)
-{
-        script_obj_t *script_obj_a = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *script_obj_b = script_evaluate (state, exp->data.dual.sub_b);
-        script_obj_cmp_result_t cmp_result = script_obj_cmp (script_obj_a, script_obj_b);
-
-        script_obj_unref (script_obj_a);
-        script_obj_unref (script_obj_b);
-
-        if (cmp_result & condition)
-                return script_obj_new_number (1);
-        return script_obj_new_number (0);
-}
-
-static script_obj_t *script_evaluate_logic (script_state_t *state,
-                                            script_exp_t   *exp)
+static script_obj_t *script_execute_neg (script_exp_t *exp,
+                                         script_obj_t *obj)
 {
-        script_obj_t *obj = script_evaluate (state, exp->data.dual.sub_a);
+        script_obj_t *new_obj;
 
-        if ((exp->type == SCRIPT_EXP_TYPE_AND) && !script_obj_as_bool (obj))
-                return obj;
-        else if (exp->type == SCRIPT_EXP_TYPE_OR && script_obj_as_bool (obj))
-                return obj;
+        if (script_obj_is_number (obj)) {
+                new_obj = script_obj_new_number (-script_obj_as_number (obj));
+        } else {
+                script_execute_error (exp, "Cannot negate non number objects");
+                new_obj = script_obj_new_null ();
+        }
         script_obj_unref (obj);
-        obj = script_evaluate (state, exp->data.dual.sub_b);
-        return obj;
+        return new_obj;
 }
 
-static script_obj_t *script_evaluate_unary (script_state_t *state,
-                                            script_exp_t   *exp)
+static script_obj_t *script_execute_step (script_exp_t *exp,
+                                          script_obj_t *obj,
+                                          int           change,
+                                          bool          change_pre)
 {
-        script_obj_t *obj = script_evaluate (state, exp->data.sub);
         script_obj_t *new_obj;
 
-        if (exp->type == SCRIPT_EXP_TYPE_NOT) {
-                new_obj = script_obj_new_number (!script_obj_as_bool (obj));
-                script_obj_unref (obj);
-                return new_obj;
-        }
-        if (exp->type == SCRIPT_EXP_TYPE_POS) /* FIXME what should happen on non number operands? */
-                return obj;                   /* Does nothing, maybe just remove at parse stage */
-        if (exp->type == SCRIPT_EXP_TYPE_NEG) {
-                if (script_obj_is_number (obj)) {
-                        new_obj = script_obj_new_number (-script_obj_as_number (obj));
-                } else {
-                        script_execute_error (exp, "Cannot negate non number objects");
-                        new_obj = script_obj_new_null ();
-                }
-                script_obj_unref (obj);
-                return new_obj;
-        }
-        int change_pre = 0;
-        int change = -1;
-
-        if ((exp->type == SCRIPT_EXP_TYPE_PRE_INC) ||
-            (exp->type == SCRIPT_EXP_TYPE_POST_INC))
-                change = 1;
-        if ((exp->type == SCRIPT_EXP_TYPE_PRE_INC) ||
-            (exp->type == SCRIPT_EXP_TYPE_PRE_DEC))
-                change_pre = 1;
-
         if (script_obj_is_number (obj)) {
                 if (change_pre) {
                         new_obj = script_obj_new_number (script_obj_as_number (obj) + change);
@@ -249,11 +164,13 @@ static script_obj_t *script_evaluate_unary (script_state_t *state,
         script_obj_unref (obj);
         return new_obj;
 }
+
 typedef struct
 {
         script_state_t *state;
         script_obj_t   *this;
-        ply_list_t     *parameter_data;
+        script_obj_t  **args;
+        int             arg_count;
 } script_obj_execute_data_t;
 
 static void *script_obj_execute (script_obj_t *obj,
@@ -263,26 +180,29 @@ static void *script_obj_execute (script_obj_t *obj,
 
         if (obj->type == SCRIPT_OBJ_TYPE_FUNCTION) {
                 script_function_t *function = obj->data.function;
-                script_return_t reply = script_execute_function_with_parlist (execute_data->state,
-                                                                              function,
-                                                                              execute_data->this,
-                                                                              execute_data->parameter_data);
+                script_return_t reply = script_execute_function_with_args (execute_data->state,
+                                                                           function,
+                                                                           execute_data->this,
+                                                                           execute_data->args,
+                                                                           execute_data->arg_count);
                 if (reply.type != SCRIPT_RETURN_TYPE_FAIL)
                         return reply.object ? reply.object : script_obj_new_null ();
         }
         return NULL;
 }
 
-static script_return_t script_execute_object_with_parlist (script_state_t *state,
-                                                           script_obj_t   *obj,
-                                                           script_obj_t   *this,
-                                                           ply_list_t     *parameter_data)
+static script_return_t script_execute_object_with_args (script_state_t *state,
+                                                        script_obj_t   *obj,
+                                                        script_obj_t   *this,
+                                                        script_obj_t  **args,
+                                                        int             arg_count)
 {
         script_obj_execute_data_t execute_data;
 
         execute_data.state = state;
         execute_data.this = this;
-        execute_data.parameter_data = parameter_data;
+        execute_data.args = args;
+        execute_data.arg_count = arg_count;
 
         obj = script_obj_as_custom (obj, script_obj_execute, &execute_data);
 
@@ -290,318 +210,643 @@ static script_return_t script_execute_object_with_parlist (script_state_t *state
         return script_return_fail ();
 }
 
-static script_obj_t *script_evaluate_func (script_state_t *state,
-                                           script_exp_t   *exp)
+/* Slots remember where a variable was found in the local hash so repeated
+ * accesses skip the lookup.  Variables are never removed from a hash, so a
+ * remembered variable is good for as long as the same hash is the local one.
+ */
+typedef struct
 {
-        script_obj_t *this_obj = NULL;
-        script_obj_t *func_obj;
-        script_exp_t *name_exp = exp->data.function_exe.name;
-
-        if (name_exp->type == SCRIPT_EXP_TYPE_HASH) {
-                script_obj_t *this_key = script_evaluate (state, name_exp->data.dual.sub_b);
-                this_obj = script_evaluate (state, name_exp->data.dual.sub_a);
-                char *this_key_name = script_obj_as_string (this_key);
-                script_obj_unref (this_key);
-                func_obj = script_obj_hash_peek_element (this_obj, this_key_name);
-
-                if (!func_obj && script_obj_is_string (this_obj)) {
-                        script_obj_t *string_hash = script_obj_hash_peek_element (state->global, "String");
-                        func_obj = script_obj_hash_peek_element (string_hash, this_key_name);
-                        script_obj_unref (string_hash);
-                }
+        script_obj_t  *hash;
+        script_obj_t **slots;
+        int            slot_count;
+} script_execute_locals_t;
+
+static void script_execute_remember_local (script_state_t          *state,
+                                           script_execute_locals_t *locals,
+                                           int                      slot,
+                                           script_obj_t            *obj)
+{
+        script_obj_t *hash = script_obj_deref_direct (state->local);
 
-                if (!func_obj)
-                        func_obj = script_obj_hash_get_element (this_obj, this_key_name);
-
-                free (this_key_name);
-        } else if (name_exp->type == SCRIPT_EXP_TYPE_TERM_VAR) {
-                char *name = name_exp->data.string;
-                func_obj = script_obj_hash_peek_element (state->local, name);
-                if (!func_obj) {
-                        func_obj = script_obj_hash_peek_element (state->this, name);
-                        if (func_obj) {
-                                this_obj = state->this;
-                                script_obj_ref (this_obj);
-                        } else {
-                                func_obj = script_obj_hash_peek_element (state->global, name);
-                                if (!func_obj) func_obj = script_obj_new_null ();
-                        }
-                }
-        } else {
-                func_obj = script_evaluate (state, name_exp);
+        if (hash->type != SCRIPT_OBJ_TYPE_HASH)
+                return;
+        if (hash != locals->hash) {
+                script_obj_ref (hash);
+                script_obj_unref (locals->hash);
+                locals->hash = hash;
+                memset (locals->slots, 0, locals->slot_count * sizeof(script_obj_t *));
         }
+        locals->slots[slot] = obj;
+}
 
-        ply_list_t *parameter_expressions = exp->data.function_exe.parameters;
-        ply_list_t *parameter_data = ply_list_new ();
-
-        ply_list_node_t *node_expression = ply_list_get_first_node (parameter_expressions);
-        while (node_expression) {
-                script_exp_t *data_exp = ply_list_node_get_data (node_expression);
-                script_obj_t *data_obj = script_evaluate (state, data_exp);
-                ply_list_append_data (parameter_data, data_obj);
-                node_expression = ply_list_get_next_node (parameter_expressions,
-                                                          node_expression);
-        }
+/* Lookups of a constant name keep caches in the instruction, if it has any */
+static script_obj_t *script_execute_peek (script_obj_t            *hash,
+                                          script_atom_t           *name,
+                                          script_obj_hash_cache_t *caches,
+                                          int                      cache)
+{
+        if (caches)
+                return script_obj_hash_peek_element_cached (hash, name, &caches[cache]);
+        return script_obj_hash_peek_element_atom (hash, name);
+}
 
-        script_return_t reply = script_execute_object_with_parlist (state, func_obj, this_obj, parameter_data);
+static script_obj_t *script_execute_peek_local (script_state_t          *state,
+                                                script_execute_locals_t *locals,
+                                                script_atom_t           *name,
+                                                int                      slot,
+                                                script_obj_hash_cache_t *caches)
+{
+        script_obj_t *hash = script_obj_deref_direct (state->local);
+        script_obj_t *obj;
 
-        ply_list_node_t *node_data = ply_list_get_first_node (parameter_data);
-        while (node_data) {
-                script_obj_t *data_obj = ply_list_node_get_data (node_data);
-                script_obj_unref (data_obj);
-                node_data = ply_list_get_next_node (parameter_data, node_data);
+        if (hash == locals->hash && hash->type == SCRIPT_OBJ_TYPE_HASH) {
+                obj = locals->slots[slot];
+                if (obj) {
+                        script_obj_ref (obj);
+                        return obj;
+                }
         }
-        ply_list_free (parameter_data);
-
-        script_obj_unref (func_obj);
-        if (this_obj) script_obj_unref (this_obj);
 
-        return reply.object ? reply.object : script_obj_new_null ();
+        obj = script_execute_peek (state->local, name, caches, 0);
+        if (obj)
+                script_execute_remember_local (state, locals, slot, obj);
+        return obj;
 }
 
-static script_obj_t *script_evaluate (script_state_t *state,
-                                      script_exp_t   *exp)
+static script_obj_t *script_execute_var (script_state_t          *state,
+                                         script_execute_locals_t *locals,
+                                         script_atom_t           *name,
+                                         int                      slot,
+                                         script_obj_hash_cache_t *caches)
 {
-        switch (exp->type) {
-        case SCRIPT_EXP_TYPE_PLUS:
-        {
-                return script_evaluate_apply_function (state, exp, script_obj_plus);
-        }
-        case SCRIPT_EXP_TYPE_MINUS:
-        {
-                return script_evaluate_apply_function (state, exp, script_obj_minus);
-        }
+        script_obj_t *obj = script_execute_peek_local (state, locals, name, slot, caches);
 
-        case SCRIPT_EXP_TYPE_MUL:
-        {
-                return script_evaluate_apply_function (state, exp, script_obj_mul);
-        }
-        case SCRIPT_EXP_TYPE_DIV:
-        {
-                return script_evaluate_apply_function (state, exp, script_obj_div);
-        }
-        case SCRIPT_EXP_TYPE_MOD:
-        {
-                return script_evaluate_apply_function (state, exp, script_obj_mod);
-        }
-
-        case SCRIPT_EXP_TYPE_EQ:
-        {
-                return script_evaluate_cmp (state, exp, SCRIPT_OBJ_CMP_RESULT_EQ);
-        }
-        case SCRIPT_EXP_TYPE_NE:
-        {
-                return script_evaluate_cmp (state, exp, SCRIPT_OBJ_CMP_RESULT_NE |
-                                            SCRIPT_OBJ_CMP_RESULT_LT |
-                                            SCRIPT_OBJ_CMP_RESULT_GT);
-        }
-        case SCRIPT_EXP_TYPE_GT:
-        {
-                return script_evaluate_cmp (state, exp, SCRIPT_OBJ_CMP_RESULT_GT);
-        }
-        case SCRIPT_EXP_TYPE_GE:
-        {
-                return script_evaluate_cmp (state, exp, SCRIPT_OBJ_CMP_RESULT_GT |
-                                            SCRIPT_OBJ_CMP_RESULT_EQ);
-        }
-        case SCRIPT_EXP_TYPE_LT:
-        {
-                return script_evaluate_cmp (state, exp, SCRIPT_OBJ_CMP_RESULT_LT);
-        }
-        case SCRIPT_EXP_TYPE_LE:
-        {
-                return script_evaluate_cmp (state, exp, SCRIPT_OBJ_CMP_RESULT_LT |
-                                            SCRIPT_OBJ_CMP_RESULT_EQ);
-        }
+        if (obj) return obj;
+        obj = script_execute_peek (state->this, name, caches, 1);
+        if (obj) return obj;
+        obj = script_execute_peek (state->global, name, caches, 2);
+        if (obj) return obj;
+        obj = script_obj_hash_get_element_atom (state->local, name);
+        script_execute_remember_local (state, locals, slot, obj);
+        return obj;
+}
 
-        case SCRIPT_EXP_TYPE_AND:
-        case SCRIPT_EXP_TYPE_OR:
-        {
-                return script_evaluate_logic (state, exp);
-        }
+static script_obj_t *script_execute_lookup_function (script_state_t          *state,
+                                                     script_execute_locals_t *locals,
+                                                     script_atom_t           *name,
+                                                     int                      slot,
+                                                     script_obj_hash_cache_t *caches,
+                                                     script_obj_t           **this_obj)
+{
+        script_obj_t *func_obj = script_execute_peek_local (state, locals, name, slot, caches);
 
-        case SCRIPT_EXP_TYPE_EXTEND:
-        {
-                return script_evaluate_apply_function (state, exp, script_obj_new_extend);
-        }
+        *this_obj = NULL;
+        if (func_obj) return func_obj;
 
-        case SCRIPT_EXP_TYPE_NOT:
-        case SCRIPT_EXP_TYPE_POS:
-        case SCRIPT_EXP_TYPE_NEG:
-        case SCRIPT_EXP_TYPE_PRE_INC:
-        case SCRIPT_EXP_TYPE_PRE_DEC:
-        case SCRIPT_EXP_TYPE_POST_INC:
-        case SCRIPT_EXP_TYPE_POST_DEC:
-        {
-                return script_evaluate_unary (state, exp);
+        func_obj = script_execute_peek (state->this, name, caches, 1);
+        if (func_obj) {
+                *this_obj = state->this;
+                script_obj_ref (*this_obj);
+                return func_obj;
         }
+        func_obj = script_execute_peek (state->global, name, caches, 2);
+        if (!func_obj) func_obj = script_obj_new_null ();
+        return func_obj;
+}
 
-        case SCRIPT_EXP_TYPE_TERM_NUMBER:
-        {
-                return script_obj_new_number (exp->data.number);
-        }
+static script_obj_t *script_execute_lookup_method (script_state_t          *state,
+                                                   script_atom_t           *this_key_name,
+                                                   script_obj_t            *this_obj,
+                                                   script_obj_hash_cache_t *caches)
+{
+        static script_atom_t *string_name;
+        script_obj_t *func_obj = script_execute_peek (this_obj, this_key_name, caches, 0);
 
-        case SCRIPT_EXP_TYPE_TERM_STRING:
-        {
-                return script_obj_new_string (exp->data.string);
-        }
+        if (!func_obj && script_obj_is_string (this_obj)) {
+                script_obj_t *string_hash;
 
-        case SCRIPT_EXP_TYPE_TERM_NULL:
-        {
-                return script_obj_new_null ();
+                if (!string_name)
+                        string_name = script_atom_get ("String");
+                string_hash = script_execute_peek (state->global, string_name, caches, 1);
+                if (string_hash) {
+                        func_obj = script_execute_peek (string_hash, this_key_name, caches, 2);
+                        script_obj_unref (string_hash);
+                }
         }
 
-        case SCRIPT_EXP_TYPE_TERM_LOCAL:
-        {
-                script_obj_ref (state->local);
-                return state->local;
-        }
+        if (!func_obj)
+                func_obj = script_obj_hash_get_element_atom (this_obj, this_key_name);
 
-        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
-        {
-                script_obj_ref (state->global);
-                return state->global;
-        }
+        return func_obj;
+}
 
-        case SCRIPT_EXP_TYPE_TERM_THIS:
-        {
-                script_obj_ref (state->this);
-                return state->this;
-        }
+/* Arithmetic on a temporary only the stack refers to reuses it for the
+ * result rather than allocating a fresh number.
+ */
+static inline script_obj_t *script_execute_number_result (script_obj_t   *obj_a,
+                                                          script_obj_t   *obj_b,
+                                                          script_number_t value)
+{
+        if (obj_a->refcount == 1 && obj_a->type == SCRIPT_OBJ_TYPE_NUMBER) {
+                obj_a->data.number = value;
+                script_obj_unref (obj_b);
+                return obj_a;
+        }
+        if (obj_b->refcount == 1 && obj_b->type == SCRIPT_OBJ_TYPE_NUMBER) {
+                obj_b->data.number = value;
+                script_obj_unref (obj_a);
+                return obj_b;
+        }
+        script_obj_unref (obj_a);
+        script_obj_unref (obj_b);
+        return script_obj_new_number (value);
+}
 
-        case SCRIPT_EXP_TYPE_TERM_SET:
-        {
-                return script_evaluate_set (state, exp);
-        }
+static script_obj_cmp_result_t script_execute_cmp (script_obj_t *obj_a,
+                                                   script_obj_t *obj_b)
+{
+        script_obj_t *num_a = script_obj_deref_direct (obj_a);
+        script_obj_t *num_b = script_obj_deref_direct (obj_b);
 
-        case SCRIPT_EXP_TYPE_TERM_VAR:
-        {
-                return script_evaluate_var (state, exp);
+        if (num_a->type == SCRIPT_OBJ_TYPE_NUMBER && num_b->type == SCRIPT_OBJ_TYPE_NUMBER) {
+                if (num_a->data.number < num_b->data.number) return SCRIPT_OBJ_CMP_RESULT_LT;
+                if (num_a->data.number > num_b->data.number) return SCRIPT_OBJ_CMP_RESULT_GT;
+                if (num_a->data.number == num_b->data.number) return SCRIPT_OBJ_CMP_RESULT_EQ;
+                return SCRIPT_OBJ_CMP_RESULT_NE;
         }
+        return script_obj_cmp (obj_a, obj_b);
+}
 
-        case SCRIPT_EXP_TYPE_ASSIGN:
-        {
-                return script_evaluate_assign (state, exp);
-        }
+#ifdef __GNUC__
+#define SCRIPT_EXECUTE_COMPUTED_GOTO
+#endif
 
-        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
-        {
-                return script_evaluate_apply_function_and_assign (state,
-                                                                  exp,
-                                                                  script_obj_plus);
-        }
+#ifdef SCRIPT_EXECUTE_COMPUTED_GOTO
+#define VM_OP(name) op_ ## name
+#define VM_NEXT() do { instruction = &code->instructions[pc++];               \
+                       goto *dispatch_table[instruction->opcode]; } while (0)
+#else
+#define VM_OP(name) case SCRIPT_OPCODE_ ## name
+#define VM_NEXT() goto dispatch
+#endif
 
-        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
-        {
-                return script_evaluate_apply_function_and_assign (state,
-                                                                  exp,
-                                                                  script_obj_minus);
-        }
+#define VM_CACHES() (instruction->count ? &code->caches[instruction->count - 1] : NULL)
+
+#define VM_BINARY(function) do { script_obj_t *obj_b = *--sp;                 \
+                                 script_obj_t *obj_a = *--sp;                 \
+                                 *sp++ = function (obj_a, obj_b);             \
+                                 script_obj_unref (obj_a);                    \
+                                 script_obj_unref (obj_b); } while (0)
+
+#define VM_BINARY_ASSIGN(function) do { script_obj_t *obj_b = *--sp;          \
+                                        script_obj_t *obj_a = *--sp;          \
+                                        script_obj_t *obj = function (obj_a, obj_b); \
+                                        script_obj_assign (obj_a, obj);       \
+                                        script_obj_unref (obj_a);             \
+                                        script_obj_unref (obj_b);             \
+                                        *sp++ = obj; } while (0)
+
+#define VM_ARITH(expression, function) do {                                   \
+                script_obj_t *obj_b = *--sp;                                  \
+                script_obj_t *obj_a = *--sp;                                  \
+                script_obj_t *num_a = script_obj_deref_direct (obj_a);        \
+                script_obj_t *num_b = script_obj_deref_direct (obj_b);        \
+                if (num_a->type == SCRIPT_OBJ_TYPE_NUMBER &&                  \
+                    num_b->type == SCRIPT_OBJ_TYPE_NUMBER) {                  \
+                        script_number_t a = num_a->data.number;               \
+                        script_number_t b = num_b->data.number;               \
+                        *sp++ = script_execute_number_result (obj_a, obj_b, (expression)); \
+                } else {                                                      \
+                        *sp++ = function (obj_a, obj_b);                      \
+                        script_obj_unref (obj_a);                             \
+                        script_obj_unref (obj_b);                             \
+                } } while (0)
+
+/* A variable holding the only reference to its number is updated in place */
+#define VM_ARITH_ASSIGN(expression, function) do {                            \
+                script_obj_t *obj_b = sp[-1];                                 \
+                script_obj_t *obj_a = sp[-2];                                 \
+                script_obj_t *num_a = script_obj_deref_direct (obj_a);        \
+                script_obj_t *num_b = script_obj_deref_direct (obj_b);        \
+                if (obj_a->type == SCRIPT_OBJ_TYPE_REF &&                     \
+                    obj_a->data.obj == num_a && num_a->refcount == 1 &&       \
+                    num_a->type == SCRIPT_OBJ_TYPE_NUMBER &&                  \
+                    num_b->type == SCRIPT_OBJ_TYPE_NUMBER) {                  \
+                        script_number_t a = num_a->data.number;               \
+                        script_number_t b = num_b->data.number;               \
+                        num_a->data.number = (expression);                    \
+                        script_obj_ref (num_a);                               \
+                        script_obj_unref (obj_a);                             \
+                        script_obj_unref (obj_b);                             \
+                        sp -= 2;                                              \
+                        *sp++ = num_a;                                        \
+                } else {                                                      \
+                        VM_BINARY_ASSIGN (function);                          \
+                } } while (0)
+
+static script_return_t script_execute_code (script_state_t *state,
+                                            script_code_t  *code)
+{
+        script_obj_t *stack[code->stack_size + 1];
+        script_obj_t *slots[code->slot_count + 1];
+        script_obj_t **sp = stack;
+        script_execute_locals_t locals = { NULL, slots, code->slot_count };
+        script_return_t reply = script_return_normal ();
+        script_instruction_t *instruction;
+        script_profile_frame_t profile_frame;
+        int pc = 0;
+
+        memset (slots, 0, sizeof(slots));
+        if (code->profile)
+                script_profile_enter (&profile_frame, code->profile);
+
+#ifdef SCRIPT_EXECUTE_COMPUTED_GOTO
+        static const void *dispatch_table[SCRIPT_OPCODE_COUNT] = {
+                [SCRIPT_OPCODE_PUSH_NULL] = &&op_PUSH_NULL,
+                [SCRIPT_OPCODE_PUSH_NUMBER] = &&op_PUSH_NUMBER,
+                [SCRIPT_OPCODE_PUSH_STRING] = &&op_PUSH_STRING,
+                [SCRIPT_OPCODE_PUSH_CONSTANT] = &&op_PUSH_CONSTANT,
+                [SCRIPT_OPCODE_PUSH_LOCAL] = &&op_PUSH_LOCAL,
+                [SCRIPT_OPCODE_PUSH_GLOBAL] = &&op_PUSH_GLOBAL,
+                [SCRIPT_OPCODE_PUSH_THIS] = &&op_PUSH_THIS,
+                [SCRIPT_OPCODE_PUSH_FUNCTION] = &&op_PUSH_FUNCTION,
+                [SCRIPT_OPCODE_PUSH_NO_THIS] = &&op_PUSH_NO_THIS,
+                [SCRIPT_OPCODE_VAR] = &&op_VAR,
+                [SCRIPT_OPCODE_SET] = &&op_SET,
+                [SCRIPT_OPCODE_HASH] = &&op_HASH,
+                [SCRIPT_OPCODE_HASH_ATOM] = &&op_HASH_ATOM,
+                [SCRIPT_OPCODE_PLUS] = &&op_PLUS,
+                [SCRIPT_OPCODE_MINUS] = &&op_MINUS,
+                [SCRIPT_OPCODE_MUL] = &&op_MUL,
+                [SCRIPT_OPCODE_DIV] = &&op_DIV,
+                [SCRIPT_OPCODE_MOD] = &&op_MOD,
+                [SCRIPT_OPCODE_EXTEND] = &&op_EXTEND,
+                [SCRIPT_OPCODE_CMP] = &&op_CMP,
+                [SCRIPT_OPCODE_ASSIGN] = &&op_ASSIGN,
+                [SCRIPT_OPCODE_ASSIGN_PLUS] = &&op_ASSIGN_PLUS,
+                [SCRIPT_OPCODE_ASSIGN_MINUS] = &&op_ASSIGN_MINUS,
+                [SCRIPT_OPCODE_ASSIGN_MUL] = &&op_ASSIGN_MUL,
+                [SCRIPT_OPCODE_ASSIGN_DIV] = &&op_ASSIGN_DIV,
+                [SCRIPT_OPCODE_ASSIGN_MOD] = &&op_ASSIGN_MOD,
+                [SCRIPT_OPCODE_ASSIGN_EXTEND] = &&op_ASSIGN_EXTEND,
+                [SCRIPT_OPCODE_NOT] = &&op_NOT,
+                [SCRIPT_OPCODE_NEG] = &&op_NEG,
+                [SCRIPT_OPCODE_PRE_INC] = &&op_PRE_INC,
+                [SCRIPT_OPCODE_PRE_DEC] = &&op_PRE_DEC,
+                [SCRIPT_OPCODE_POST_INC] = &&op_POST_INC,
+                [SCRIPT_OPCODE_POST_DEC] = &&op_POST_DEC,
+                [SCRIPT_OPCODE_AND] = &&op_AND,
+                [SCRIPT_OPCODE_OR] = &&op_OR,
+                [SCRIPT_OPCODE_LOOKUP_FUNCTION] = &&op_LOOKUP_FUNCTION,
+                [SCRIPT_OPCODE_LOOKUP_METHOD] = &&op_LOOKUP_METHOD,
+                [SCRIPT_OPCODE_LOOKUP_METHOD_ATOM] = &&op_LOOKUP_METHOD_ATOM,
+                [SCRIPT_OPCODE_CALL] = &&op_CALL,
+                [SCRIPT_OPCODE_SET_REPLY] = &&op_SET_REPLY,
+                [SCRIPT_OPCODE_CLEAR_REPLY] = &&op_CLEAR_REPLY,
+                [SCRIPT_OPCODE_JUMP] = &&op_JUMP,
+                [SCRIPT_OPCODE_JUMP_IF_FALSE] = &&op_JUMP_IF_FALSE,
+                [SCRIPT_OPCODE_JUMP_IF_TRUE] = &&op_JUMP_IF_TRUE,
+                [SCRIPT_OPCODE_JUMP_UNLESS_CMP] = &&op_JUMP_UNLESS_CMP,
+                [SCRIPT_OPCODE_BREAK] = &&op_BREAK,
+                [SCRIPT_OPCODE_CONTINUE] = &&op_CONTINUE,
+                [SCRIPT_OPCODE_PASS_CONTINUE] = &&op_PASS_CONTINUE,
+                [SCRIPT_OPCODE_RETURN] = &&op_RETURN,
+                [SCRIPT_OPCODE_LEAVE] = &&op_LEAVE,
+                [SCRIPT_OPCODE_PROFILE] = &&op_PROFILE,
+                [SCRIPT_OPCODE_END] = &&op_END,
+        };
+
+        VM_NEXT ();
+        {
+#else
+dispatch:
+        instruction = &code->instructions[pc++];
+        switch (instruction->opcode) {
+#endif
+        VM_OP (PUSH_NULL):
+                *sp++ = script_obj_new_null ();
+                VM_NEXT ();
+        VM_OP (PUSH_NUMBER):
+                *sp++ = script_obj_new_number (code->numbers[instruction->operand]);
+                VM_NEXT ();
+        VM_OP (PUSH_STRING):
+                *sp++ = script_obj_new_string (code->strings[instruction->operand]);
+                VM_NEXT ();
+        VM_OP (PUSH_CONSTANT):
+                script_obj_ref (code->constants[instruction->operand]);
+                *sp++ = code->constants[instruction->operand];
+                VM_NEXT ();
+        VM_OP (PUSH_LOCAL):
+                script_obj_ref (state->local);
+                *sp++ = state->local;
+                VM_NEXT ();
+        VM_OP (PUSH_GLOBAL):
+                script_obj_ref (state->global);
+                *sp++ = state->global;
+                VM_NEXT ();
+        VM_OP (PUSH_THIS):
+                script_obj_ref (state->this);
+                *sp++ = state->this;
+                VM_NEXT ();
+        VM_OP (PUSH_FUNCTION):
+                *sp++ = script_obj_new_function (code->elements[instruction->operand]);
+                VM_NEXT ();
+        VM_OP (PUSH_NO_THIS):
+                *sp++ = NULL;
+                VM_NEXT ();
+        VM_OP (VAR):
+                *sp++ = script_execute_var (state,
+                                            &locals,
+                                            code->slot_names[instruction->operand],
+                                            instruction->operand,
+                                            VM_CACHES ());
+                VM_NEXT ();
+        VM_OP (SET):
+                sp -= instruction->count;
+                *sp = script_execute_set (sp, instruction->count);
+                sp++;
+                VM_NEXT ();
+        VM_OP (HASH):
+        {
+                script_obj_t *key = *--sp;
+                script_obj_t *hash = *--sp;
+                *sp++ = script_execute_hash (hash, key);
+                VM_NEXT ();
+        }
+        VM_OP (HASH_ATOM):
+                sp[-1] = script_execute_hash_atom (sp[-1], code->atoms[instruction->operand]);
+                VM_NEXT ();
+        VM_OP (PLUS):
+                VM_ARITH (a + b, script_obj_plus);
+                VM_NEXT ();
+        VM_OP (MINUS):
+                VM_ARITH (a - b, script_obj_minus);
+                VM_NEXT ();
+        VM_OP (MUL):
+                VM_ARITH (a * b, script_obj_mul);
+                VM_NEXT ();
+        VM_OP (DIV):
+                VM_ARITH (a / b, script_obj_div);
+                VM_NEXT ();
+        VM_OP (MOD):
+                VM_ARITH (fmodl (a, b), script_obj_mod);
+                VM_NEXT ();
+        VM_OP (EXTEND):
+                VM_BINARY (script_obj_new_extend);
+                VM_NEXT ();
+        VM_OP (CMP):
+        {
+                script_obj_t *obj_b = *--sp;
+                script_obj_t *obj_a = *--sp;
+                script_obj_cmp_result_t cmp_result = script_execute_cmp (obj_a, obj_b);
+
+                *sp++ = script_execute_number_result (obj_a, obj_b,
+                                                      (cmp_result & instruction->operand) ? 1 : 0);
+                VM_NEXT ();
+        }
+        VM_OP (ASSIGN):
+        {
+                script_obj_t *obj_b = *--sp;
+                script_obj_assign (sp[-1], obj_b);
+                script_obj_unref (obj_b);
+                VM_NEXT ();
+        }
+        VM_OP (ASSIGN_PLUS):
+                VM_ARITH_ASSIGN (a + b, script_obj_plus);
+                VM_NEXT ();
+        VM_OP (ASSIGN_MINUS):
+                VM_ARITH_ASSIGN (a - b, script_obj_minus);
+                VM_NEXT ();
+        VM_OP (ASSIGN_MUL):
+                VM_ARITH_ASSIGN (a * b, script_obj_mul);
+                VM_NEXT ();
+        VM_OP (ASSIGN_DIV):
+                VM_ARITH_ASSIGN (a / b, script_obj_div);
+                VM_NEXT ();
+        VM_OP (ASSIGN_MOD):
+                VM_ARITH_ASSIGN (fmodl (a, b), script_obj_mod);
+                VM_NEXT ();
+        VM_OP (ASSIGN_EXTEND):
+                VM_BINARY_ASSIGN (script_obj_new_extend);
+                VM_NEXT ();
+        VM_OP (NOT):
+        {
+                script_obj_t *obj = sp[-1];
+                sp[-1] = script_obj_new_number (!script_obj_as_bool (obj));
+                script_obj_unref (obj);
+                VM_NEXT ();
+        }
+        VM_OP (NEG):
+                sp[-1] = script_execute_neg (code->elements[instruction->operand], sp[-1]);
+                VM_NEXT ();
+        VM_OP (PRE_INC):
+                sp[-1] = script_execute_step (code->elements[instruction->operand], sp[-1], 1, true);
+                VM_NEXT ();
+        VM_OP (PRE_DEC):
+                sp[-1] = script_execute_step (code->elements[instruction->operand], sp[-1], -1, true);
+                VM_NEXT ();
+        VM_OP (POST_INC):
+                sp[-1] = script_execute_step (code->elements[instruction->operand], sp[-1], 1, false);
+                VM_NEXT ();
+        VM_OP (POST_DEC):
+                sp[-1] = script_execute_step (code->elements[instruction->operand], sp[-1], -1, false);
+                VM_NEXT ();
+        VM_OP (AND):
+                if (!script_obj_as_bool (sp[-1]))
+                        pc = instruction->operand;
+                else
+                        script_obj_unref (*--sp);
+                VM_NEXT ();
+        VM_OP (OR):
+                if (script_obj_as_bool (sp[-1]))
+                        pc = instruction->operand;
+                else
+                        script_obj_unref (*--sp);
+                VM_NEXT ();
+        VM_OP (LOOKUP_FUNCTION):
+        {
+                script_obj_t *this_obj;
+                script_obj_t *func_obj = script_execute_lookup_function (state,
+                                                                         &locals,
+                                                                         code->slot_names[instruction->operand],
+                                                                         instruction->operand,
+                                                                         VM_CACHES (),
+                                                                         &this_obj);
+                *sp++ = this_obj;
+                *sp++ = func_obj;
+                VM_NEXT ();
+        }
+        VM_OP (LOOKUP_METHOD):
+        {
+                script_obj_t *this_obj = sp[-1];
+                script_obj_t *this_key = sp[-2];
+                script_atom_t *this_key_name = script_obj_as_atom (this_key);
 
-        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
-        {
-                return script_evaluate_apply_function_and_assign (state,
-                                                                  exp,
-                                                                  script_obj_mul);
-        }
+                script_obj_unref (this_key);
+                sp[-2] = this_obj;
+                sp[-1] = script_execute_lookup_method (state, this_key_name, this_obj, NULL);
+                script_atom_unref (this_key_name);
+                VM_NEXT ();
+        }
+        VM_OP (LOOKUP_METHOD_ATOM):
+        {
+                script_obj_t *this_obj = sp[-1];
+                *sp++ = script_execute_lookup_method (state,
+                                                      code->atoms[instruction->operand],
+                                                      this_obj,
+                                                      VM_CACHES ());
+                VM_NEXT ();
+        }
+        VM_OP (CALL):
+        {
+                int arg_count = instruction->count;
+                script_obj_t **args = sp - arg_count;
+                script_obj_t *func_obj = args[-1];
+                script_obj_t *this_obj = args[-2];
+                script_return_t call_reply;
+                int i;
+
+                call_reply = script_execute_object_with_args (state, func_obj, this_obj, args, arg_count);
+                for (i = 0; i < arg_count; i++) {
+                        script_obj_unref (args[i]);
+                }
+                script_obj_unref (func_obj);
+                script_obj_unref (this_obj);
 
-        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
-        {
-                return script_evaluate_apply_function_and_assign (state,
-                                                                  exp,
-                                                                  script_obj_div);
+                sp = args - 2;
+                *sp++ = call_reply.object ? call_reply.object : script_obj_new_null ();
+                VM_NEXT ();
         }
-
-        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
-        {
-                return script_evaluate_apply_function_and_assign (state,
-                                                                  exp,
-                                                                  script_obj_mod);
+        VM_OP (SET_REPLY):
+                script_obj_unref (reply.object);
+                reply = script_return_normal_obj (*--sp);
+                VM_NEXT ();
+        VM_OP (CLEAR_REPLY):
+                script_obj_unref (reply.object);
+                reply = script_return_normal ();
+                VM_NEXT ();
+        VM_OP (JUMP):
+                pc = instruction->operand;
+                VM_NEXT ();
+        VM_OP (JUMP_IF_FALSE):
+        {
+                script_obj_t *obj = *--sp;
+                bool cond = script_obj_as_bool (obj);
+                script_obj_unref (obj);
+                if (!cond)
+                        pc = instruction->operand;
+                VM_NEXT ();
         }
-
-        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+        VM_OP (JUMP_IF_TRUE):
         {
-                return script_evaluate_apply_function_and_assign (state,
-                                                                  exp,
-                                                                  script_obj_new_extend);
+                script_obj_t *obj = *--sp;
+                bool cond = script_obj_as_bool (obj);
+                script_obj_unref (obj);
+                if (cond)
+                        pc = instruction->operand;
+                VM_NEXT ();
         }
-
-        case SCRIPT_EXP_TYPE_HASH:
+        VM_OP (JUMP_UNLESS_CMP):
         {
-                return script_evaluate_hash (state, exp);
-        }
+                script_obj_t *obj_b = *--sp;
+                script_obj_t *obj_a = *--sp;
+                script_obj_cmp_result_t cmp_result = script_execute_cmp (obj_a, obj_b);
 
-        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
-        {
-                return script_evaluate_func (state, exp);
+                script_obj_unref (obj_a);
+                script_obj_unref (obj_b);
+                if (!(cmp_result & instruction->count))
+                        pc = instruction->operand;
+                VM_NEXT ();
         }
-        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
-        {
-                return script_obj_new_function (exp->data.function_def);
-        }
-        }
-        return script_obj_new_null ();
-}
-
-static script_return_t script_execute_list (script_state_t *state,
-                                            ply_list_t     *op_list)                      /* FIXME script_execute returns the return obj */
-{
-        script_return_t reply = script_return_normal ();
-        ply_list_node_t *node = ply_list_get_first_node (op_list);
-
-        for (node = ply_list_get_first_node (op_list);
-             node;
-             node = ply_list_get_next_node (op_list, node)) {
-                script_op_t *op = ply_list_node_get_data (node);
+        VM_OP (BREAK):
                 script_obj_unref (reply.object);
-                reply = script_execute (state, op);
-                switch (reply.type) {
-                case SCRIPT_RETURN_TYPE_NORMAL:
-                        break;
-                case SCRIPT_RETURN_TYPE_RETURN:
-                case SCRIPT_RETURN_TYPE_FAIL:
-                case SCRIPT_RETURN_TYPE_BREAK:
-                case SCRIPT_RETURN_TYPE_CONTINUE:
-                        return reply;
+                reply = script_return_normal ();
+                pc = instruction->operand;
+                VM_NEXT ();
+        VM_OP (CONTINUE):
+                script_obj_unref (reply.object);
+                reply = script_return_continue ();
+                pc = instruction->operand;
+                VM_NEXT ();
+        VM_OP (PASS_CONTINUE):
+                if (reply.type == SCRIPT_RETURN_TYPE_CONTINUE) {
+                        if (instruction->operand < 0)
+                                goto leave;
+                        pc = instruction->operand;
                 }
-        }
+                VM_NEXT ();
+        VM_OP (RETURN):
+                script_obj_unref (reply.object);
+                reply = script_return_obj (*--sp);
+                goto leave;
+        VM_OP (LEAVE):
+                script_obj_unref (reply.object);
+                reply.type = instruction->operand;
+                reply.object = NULL;
+                goto leave;
+        VM_OP (PROFILE):
+                script_profile_line (code->elements[instruction->operand]);
+                VM_NEXT ();
+        VM_OP (END):
+                goto leave;
+        }
+
+leave:
+        assert (sp == stack);
+        script_obj_unref (locals.hash);
+        if (code->profile)
+                script_profile_leave (&profile_frame);
         return reply;
 }
 
-/* parameter_data list should be freed by caller */
-static script_return_t script_execute_function_with_parlist (script_state_t    *state,
-                                                             script_function_t *function,
-                                                             script_obj_t      *this,
-                                                             ply_list_t        *parameter_data)
+/* args are owned by the caller */
+static script_return_t script_execute_function_with_args (script_state_t    *state,
+                                                          script_function_t *function,
+                                                          script_obj_t      *this,
+                                                          script_obj_t     **args,
+                                                          int                arg_count)
 {
         script_state_t *sub_state = script_state_init_sub (state, this);
         ply_list_t *parameter_names = function->parameters;
         ply_list_node_t *node_name = ply_list_get_first_node (parameter_names);
-        ply_list_node_t *node_data = ply_list_get_first_node (parameter_data);
-        int index = 0;
-        script_obj_t *arg_obj = script_obj_new_hash ();
-
-        while (node_data) {
-                script_obj_t *data_obj = ply_list_node_get_data (node_data);
-                char *name;
-                asprintf (&name, "%d", index);
-                index++;
-                script_obj_hash_add_element (arg_obj, data_obj, name);
-                free (name);
-
-                if (node_name) {
-                        name = ply_list_node_get_data (node_name);
+        script_code_t *code = NULL;
+        int index;
+
+        if (function->type == SCRIPT_FUNCTION_TYPE_SCRIPT) {
+                if (!function->code)
+                        function->code = script_compile_function (function);
+                code = function->code;
+        }
+
+        for (index = 0; index < arg_count; index++) {
+                script_obj_t *data_obj = args[index];
+
+                if (code) {
+                        if (index < code->parameter_count)
+                                script_obj_hash_add_element_atom (sub_state->local, data_obj,
+                                                                  code->parameters[index]);
+                } else if (node_name) {
+                        char *name = ply_list_node_get_data (node_name);
                         script_obj_hash_add_element (sub_state->local, data_obj, name);
                         node_name = ply_list_get_next_node (parameter_names, node_name);
                 }
-                node_data = ply_list_get_next_node (parameter_data, node_data);
         }
 
-        script_obj_t *count_obj = script_obj_new_number (index);
-        script_obj_hash_add_element (arg_obj, count_obj, "count");
-        script_obj_hash_add_element (sub_state->local, arg_obj, "_args");
-        script_obj_unref (count_obj);
-        script_obj_unref (arg_obj);
+        /* Only the function's own code can reach its local hash, so _args is
+         * not built for functions that never mention it.
+         */
+        if (!code || code->uses_args) {
+                script_obj_t *arg_obj = script_obj_new_hash ();
+                script_obj_t *count_obj = script_obj_new_number (arg_count);
+
+                for (index = 0; index < arg_count; index++) {
+                        script_obj_hash_add_element_index (arg_obj, args[index], index);
+                }
+                script_obj_hash_add_element (arg_obj, count_obj, "count");
+                script_obj_hash_add_element (sub_state->local, arg_obj, "_args");
+                script_obj_unref (count_obj);
+                script_obj_unref (arg_obj);
+        }
 
         if (this)
                 script_obj_hash_add_element (sub_state->local, this, "this");
@@ -610,8 +855,7 @@ static script_return_t script_execute_function_with_parlist (script_state_t    *
         switch (function->type) {
         case SCRIPT_FUNCTION_TYPE_SCRIPT:
         {
-                script_op_t *op = function->data.script;
-                reply = script_execute (sub_state, op);
+                reply = script_execute_code (sub_state, code);
                 break;
         }
 
@@ -633,124 +877,38 @@ script_return_t script_execute_object (script_state_t *state,
                                        script_obj_t   *first_arg,
                                        ...)
 {
-        script_return_t reply;
         va_list args;
         script_obj_t *arg;
-        ply_list_t *parameter_data = ply_list_new ();
+        int arg_count = 0;
 
         arg = first_arg;
         va_start (args, first_arg);
         while (arg) {
-                ply_list_append_data (parameter_data, arg);
+                arg_count++;
                 arg = va_arg (args, script_obj_t *);
         }
         va_end (args);
 
-        reply = script_execute_object_with_parlist (state, function, this, parameter_data);
-        ply_list_free (parameter_data);
+        script_obj_t *arg_objs[arg_count + 1];
+        int index = 0;
 
-        return reply;
+        arg = first_arg;
+        va_start (args, first_arg);
+        while (arg) {
+                arg_objs[index++] = arg;
+                arg = va_arg (args, script_obj_t *);
+        }
+        va_end (args);
+
+        return script_execute_object_with_args (state, function, this, arg_objs, arg_count);
 }
 
 script_return_t script_execute (script_state_t *state,
                                 script_op_t    *op)
 {
-        script_return_t reply = script_return_normal ();
-
-        if (!op) return reply;
-        switch (op->type) {
-        case SCRIPT_OP_TYPE_EXPRESSION:
-        {
-                reply.object = script_evaluate (state, op->data.exp);
-                break;
-        }
-
-        case SCRIPT_OP_TYPE_OP_BLOCK:
-        {
-                reply = script_execute_list (state, op->data.list);
-                break;
-        }
+        script_code_t *code = script_compile (op);
+        script_return_t reply = script_execute_code (state, code);
 
-        case SCRIPT_OP_TYPE_IF:
-        {
-                script_obj_t *obj = script_evaluate (state, op->data.cond_op.cond);
-                if (script_obj_as_bool (obj))
-                        reply = script_execute (state, op->data.cond_op.op1);
-                else
-                        reply = script_execute (state, op->data.cond_op.op2);
-                script_obj_unref (obj);
-                break;
-        }
-
-        case SCRIPT_OP_TYPE_DO_WHILE:
-        case SCRIPT_OP_TYPE_WHILE:
-        case SCRIPT_OP_TYPE_FOR:
-        {
-                script_obj_t *obj = NULL;
-                bool cond = false;
-                if (op->type == SCRIPT_OP_TYPE_DO_WHILE) cond = true;
-                while (1) {
-                        if (!cond) {
-                                obj = script_evaluate (state, op->data.cond_op.cond);
-                                cond = script_obj_as_bool (obj);
-                                script_obj_unref (obj);
-                        }
-
-                        if (cond) {
-                                script_obj_unref (reply.object);
-                                reply = script_execute (state, op->data.cond_op.op1);
-                                switch (reply.type) {
-                                case SCRIPT_RETURN_TYPE_NORMAL:
-                                        break;
-
-                                case SCRIPT_RETURN_TYPE_RETURN:
-                                case SCRIPT_RETURN_TYPE_FAIL:
-                                        return reply;
-
-                                case SCRIPT_RETURN_TYPE_BREAK:
-                                        return script_return_normal ();
-
-                                case SCRIPT_RETURN_TYPE_CONTINUE:
-                                        break;
-                                }
-                                if (op->data.cond_op.op2) {
-                                        script_obj_unref (reply.object);
-                                        reply = script_execute (state, op->data.cond_op.op2);
-                                }
-                        } else {
-                                break;
-                        }
-                        cond = false;
-                }
-                break;
-        }
-
-        case SCRIPT_OP_TYPE_RETURN:
-        {
-                script_obj_t *obj;
-                if (op->data.exp) obj = script_evaluate (state, op->data.exp);
-                else obj = script_obj_new_null ();
-                reply = script_return_obj (obj);
-                break;
-        }
-
-        case SCRIPT_OP_TYPE_FAIL:
-        {
-                reply = script_return_fail ();
-                break;
-        }
-
-        case SCRIPT_OP_TYPE_BREAK:
-        {
-                reply = script_return_break ();
-                break;
-        }
-
-        case SCRIPT_OP_TYPE_CONTINUE:
-        {
-                reply = script_return_continue ();
-                break;
-        }
-        }
+        script_code_free (code);
         return reply;
 }
@@ -22,8 +22,10 @@
 
 #include "config.h"
 
+#include "ply-hashtable.h"
 #include "ply-image.h"
 #include "ply-label.h"
+#include "ply-list.h"
 #include "ply-pixel-buffer.h"
 #include "ply-utils.h"
 #include "ply-logger.h"
@@ -34,15 +36,195 @@
 #include "script-execute.h"
 #include "script-lib-image.h"
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "script-lib-image.script.h"
 
+/* Results of Rotate and Scale are filed by source image, so themes which
+ * step through the same few angles or sizes get the same buffer back.  A
+ * result is only kept once it has been asked for twice, so transforms which
+ * never repeat do not fill the cache.  The limits cover the results of all
+ * sources together.
+ */
+#define IMAGE_TRANSFORM_CACHE_MAX_ENTRIES 256
+#define IMAGE_TRANSFORM_CACHE_MAX_BYTES   (16 * 1024 * 1024)
+#define IMAGE_ROTATE_STEPS                8192
+
+typedef enum
+{
+        IMAGE_TRANSFORM_ROTATE,
+        IMAGE_TRANSFORM_SCALE,
+} image_transform_type_t;
+
+/* The source is not referenced; image_free drops the cache of an image
+ * before letting go of it, so the pointer never outlives the buffer.
+ */
+typedef struct
+{
+        ply_pixel_buffer_t *source;
+        ply_list_t         *transforms;
+} image_transform_cache_t;
+
+typedef struct
+{
+        image_transform_type_t   type;
+        long                     first;
+        long                     second;
+        ply_pixel_buffer_t      *buffer;     /* NULL if only asked for once */
+        image_transform_cache_t *cache;
+        ply_list_node_t         *cache_node;
+        ply_list_node_t         *node;       /* in data->transforms */
+} image_transform_t;
+
+static size_t
+image_get_size_in_bytes (ply_pixel_buffer_t *buffer)
+{
+        return ply_pixel_buffer_get_width (buffer) *
+               ply_pixel_buffer_get_height (buffer) *
+               sizeof(uint32_t);
+}
+
+static void
+image_transform_free (script_lib_image_data_t *data,
+                      image_transform_t       *transform)
+{
+        ply_list_remove_node (transform->cache->transforms, transform->cache_node);
+        ply_list_remove_node (data->transforms, transform->node);
+
+        if (transform->buffer != NULL) {
+                data->transform_bytes -= image_get_size_in_bytes (transform->buffer);
+                ply_pixel_buffer_free (transform->buffer);
+        }
+        free (transform);
+}
+
+static void
+image_transform_cache_free (script_lib_image_data_t *data,
+                            image_transform_cache_t *cache)
+{
+        ply_list_node_t *node;
+
+        ply_hashtable_remove (data->transform_caches, cache->source);
+
+        while ((node = ply_list_get_first_node (cache->transforms)) != NULL) {
+                image_transform_free (data, ply_list_node_get_data (node));
+        }
+        ply_list_free (cache->transforms);
+        free (cache);
+}
+
+/* Finds a transform of the source, moving it to the most recently used end */
+static image_transform_t *
+image_transform_find (script_lib_image_data_t *data,
+                      image_transform_cache_t *cache,
+                      image_transform_type_t   type,
+                      long                     first,
+                      long                     second)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (cache->transforms);
+             node;
+             node = ply_list_get_next_node (cache->transforms, node)) {
+                image_transform_t *transform = ply_list_node_get_data (node);
+
+                if (transform->type != type ||
+                    transform->first != first ||
+                    transform->second != second)
+                        continue;
+
+                ply_list_remove_node (data->transforms, transform->node);
+                transform->node = ply_list_append_data (data->transforms, transform);
+                return transform;
+        }
+
+        return NULL;
+}
+
+static ply_pixel_buffer_t *
+image_transform_lookup (script_lib_image_data_t *data,
+                        ply_pixel_buffer_t      *source,
+                        image_transform_type_t   type,
+                        long                     first,
+                        long                     second)
+{
+        image_transform_cache_t *cache;
+        image_transform_t *transform;
+
+        cache = ply_hashtable_lookup (data->transform_caches, source);
+        if (cache == NULL)
+                return NULL;
+
+        transform = image_transform_find (data, cache, type, first, second);
+        if (transform == NULL || transform->buffer == NULL)
+                return NULL;
+
+        ply_pixel_buffer_take_reference (transform->buffer);
+        return transform->buffer;
+}
+
+static void
+image_transform_insert (script_lib_image_data_t *data,
+                        ply_pixel_buffer_t      *source,
+                        image_transform_type_t   type,
+                        long                     first,
+                        long                     second,
+                        ply_pixel_buffer_t      *buffer)
+{
+        image_transform_cache_t *cache;
+        image_transform_t *transform;
+
+        cache = ply_hashtable_lookup (data->transform_caches, source);
+        if (cache == NULL) {
+                cache = calloc (1, sizeof(image_transform_cache_t));
+                cache->source = source;
+                cache->transforms = ply_list_new ();
+                ply_hashtable_insert (data->transform_caches, source, cache);
+        }
+
+        transform = image_transform_find (data, cache, type, first, second);
+        if (transform == NULL) {
+                transform = calloc (1, sizeof(image_transform_t));
+                transform->type = type;
+                transform->first = first;
+                transform->second = second;
+                transform->cache = cache;
+                transform->cache_node = ply_list_append_data (cache->transforms, transform);
+                transform->node = ply_list_append_data (data->transforms, transform);
+        } else if (transform->buffer == NULL) {
+                transform->buffer = buffer;
+                ply_pixel_buffer_take_reference (buffer);
+                data->transform_bytes += image_get_size_in_bytes (buffer);
+        }
+
+        while (ply_list_get_length (data->transforms) > IMAGE_TRANSFORM_CACHE_MAX_ENTRIES ||
+               data->transform_bytes > IMAGE_TRANSFORM_CACHE_MAX_BYTES) {
+                ply_list_node_t *node = ply_list_get_first_node (data->transforms);
+
+                transform = ply_list_node_get_data (node);
+                cache = transform->cache;
+                image_transform_free (data, transform);
+
+                if (ply_list_get_length (cache->transforms) == 0)
+                        image_transform_cache_free (data, cache);
+        }
+}
+
 static void image_free (script_obj_t *obj)
 {
         ply_pixel_buffer_t *image = obj->data.native.object_data;
+        script_lib_image_data_t *data = obj->data.native.class->user_data;
+        image_transform_cache_t *cache;
+
+        /* Done whether or not the buffer is shared, as the cache would
+         * otherwise be left pointing at it once it goes
+         */
+        cache = ply_hashtable_lookup (data->transform_caches, image);
+        if (cache != NULL)
+                image_transform_cache_free (data, cache);
 
         ply_pixel_buffer_free (image);
 }
@@ -119,13 +301,26 @@ static script_return_t image_rotate (script_state_t *state,
         ply_pixel_buffer_t *image = script_obj_as_native_of_class (state->this, data->class);
         float angle = script_obj_hash_get_number (state->local, "angle");
         ply_rectangle_t size;
+        long step;
 
         if (image) {
-                ply_pixel_buffer_get_size (image, &size);
-                ply_pixel_buffer_t *new_image = ply_pixel_buffer_rotate (image,
-                                                                         size.width / 2,
-                                                                         size.height / 2,
-                                                                         angle);
+                /* Angles are rounded to a step, making repeats hit the cache */
+                step = lround (angle / (2 * M_PI) * IMAGE_ROTATE_STEPS) % IMAGE_ROTATE_STEPS;
+                if (step < 0)
+                        step += IMAGE_ROTATE_STEPS;
+
+                ply_pixel_buffer_t *new_image = image_transform_lookup (data, image,
+                                                                        IMAGE_TRANSFORM_ROTATE,
+                                                                        step, 0);
+                if (new_image == NULL) {
+                        ply_pixel_buffer_get_size (image, &size);
+                        new_image = ply_pixel_buffer_rotate (image,
+                                                             size.width / 2,
+                                                             size.height / 2,
+                                                             step * 2 * M_PI / IMAGE_ROTATE_STEPS);
+                        image_transform_insert (data, image, IMAGE_TRANSFORM_ROTATE,
+                                                step, 0, new_image);
+                }
                 return script_return_obj (script_obj_new_native (new_image, data->class));
         }
         return script_return_obj_null ();
@@ -159,7 +354,14 @@ static script_return_t image_scale (script_state_t *state,
         int height = script_obj_hash_get_number (state->local, "height");
 
         if (image) {
-                ply_pixel_buffer_t *new_image = ply_pixel_buffer_resize (image, width, height);
+                ply_pixel_buffer_t *new_image = image_transform_lookup (data, image,
+                                                                        IMAGE_TRANSFORM_SCALE,
+                                                                        width, height);
+                if (new_image == NULL) {
+                        new_image = ply_pixel_buffer_resize (image, width, height);
+                        image_transform_insert (data, image, IMAGE_TRANSFORM_SCALE,
+                                                width, height, new_image);
+                }
                 return script_return_obj (script_obj_new_native (new_image, data->class));
         }
         return script_return_obj_null ();
@@ -267,6 +469,10 @@ script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
 
         data->class = script_obj_native_class_new (image_free, "image", data);
         data->image_dir = strdup (image_dir);
+        data->transform_caches = ply_hashtable_new (ply_hashtable_direct_hash,
+                                                    ply_hashtable_direct_compare);
+        data->transforms = ply_list_new ();
+        data->transform_bytes = 0;
 
         script_obj_t *image_hash = script_obj_hash_get_element (state->global, "Image");
 
@@ -335,8 +541,32 @@ script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
         return data;
 }
 
+static void
+image_transform_cache_destroy (void *key,
+                               void *value,
+                               void *user_data)
+{
+        image_transform_cache_t *cache = value;
+
+        ply_list_free (cache->transforms);
+        free (cache);
+}
+
 void script_lib_image_destroy (script_lib_image_data_t *data)
 {
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (data->transforms);
+             node;
+             node = ply_list_get_next_node (data->transforms, node)) {
+                image_transform_t *transform = ply_list_node_get_data (node);
+                if (transform->buffer != NULL)
+                        ply_pixel_buffer_free (transform->buffer);
+                free (transform);
+        }
+        ply_list_free (data->transforms);
+        ply_hashtable_foreach (data->transform_caches, image_transform_cache_destroy, NULL);
+        ply_hashtable_free (data->transform_caches);
         script_obj_native_class_destroy (data->class);
         free (data->image_dir);
         script_parse_op_free (data->script_main_op);
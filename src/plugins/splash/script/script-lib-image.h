@@ -22,6 +22,8 @@
 #ifndef SCRIPT_LIB_IMAGE_H
 #define SCRIPT_LIB_IMAGE_H
 
+#include "ply-hashtable.h"
+#include "ply-list.h"
 #include "script.h"
 
 typedef struct
@@ -29,6 +31,9 @@ typedef struct
         script_obj_native_class_t *class;
         script_op_t               *script_main_op;
         char                      *image_dir;
+        ply_hashtable_t           *transform_caches;  /* by source pixel buffer */
+        ply_list_t                *transforms;        /* least recently used first */
+        size_t                     transform_bytes;
 } script_lib_image_data_t;
 
 script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
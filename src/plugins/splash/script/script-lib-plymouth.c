@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include "ply-boot-splash-plugin.h"
+#include "ply-logger.h"
 #include "ply-utils.h"
 #include "script.h"
 #include "script-parse.h"
@@ -112,6 +113,9 @@ script_lib_plymouth_data_t *script_lib_plymouth_setup (script_state_t        *st
         data->script_system_update_func = script_obj_new_null ();
         data->mode = mode;
         data->refresh_rate = refresh_rate;
+        data->refresh_count = 0;
+        data->refresh_allocations = 0;
+        data->refresh_allocations_max = 0;
 
         script_obj_t *plymouth_hash = script_obj_hash_get_element (state->global, "Plymouth");
         script_add_native_function (plymouth_hash,
@@ -220,6 +224,12 @@ script_lib_plymouth_data_t *script_lib_plymouth_setup (script_state_t        *st
 
 void script_lib_plymouth_destroy (script_lib_plymouth_data_t *data)
 {
+        if (data->refresh_count > 0)
+                ply_trace ("refresh function ran %lu times, allocating %lu objects per call on average and %lu at most",
+                           data->refresh_count,
+                           data->refresh_allocations / data->refresh_count,
+                           data->refresh_allocations_max);
+
         script_parse_op_free (data->script_main_op);
         script_obj_unref (data->script_refresh_func);
         script_obj_unref (data->script_boot_progress_func);
@@ -238,15 +248,32 @@ void script_lib_plymouth_destroy (script_lib_plymouth_data_t *data)
         free (data);
 }
 
+bool script_lib_plymouth_has_refresh_function (script_lib_plymouth_data_t *data)
+{
+        return !script_obj_is_null (data->script_refresh_func);
+}
+
+bool script_lib_plymouth_has_boot_progress_function (script_lib_plymouth_data_t *data)
+{
+        return !script_obj_is_null (data->script_boot_progress_func);
+}
+
 void script_lib_plymouth_on_refresh (script_state_t             *state,
                                      script_lib_plymouth_data_t *data)
 {
+        unsigned long allocations = script_obj_get_allocation_count ();
         script_return_t ret = script_execute_object (state,
                                                      data->script_refresh_func,
                                                      NULL,
                                                      NULL);
 
         script_obj_unref (ret.object);
+
+        allocations = script_obj_get_allocation_count () - allocations;
+        data->refresh_count++;
+        data->refresh_allocations += allocations;
+        if (allocations > data->refresh_allocations_max)
+                data->refresh_allocations_max = allocations;
 }
 
 void script_lib_plymouth_on_boot_progress (script_state_t             *state,
@@ -44,6 +44,9 @@ typedef struct
         script_obj_t           *script_system_update_func;
         ply_boot_splash_mode_t mode;
         int                    refresh_rate;
+        unsigned long          refresh_count;
+        unsigned long          refresh_allocations;     /* objects and variables */
+        unsigned long          refresh_allocations_max;
 } script_lib_plymouth_data_t;
 
 script_lib_plymouth_data_t *script_lib_plymouth_setup (script_state_t        *state,
@@ -51,6 +54,8 @@ script_lib_plymouth_data_t *script_lib_plymouth_setup (script_state_t        *st
                                                        int refresh_rate);
 void script_lib_plymouth_destroy (script_lib_plymouth_data_t *data);
 
+bool script_lib_plymouth_has_refresh_function (script_lib_plymouth_data_t *data);
+bool script_lib_plymouth_has_boot_progress_function (script_lib_plymouth_data_t *data);
 void script_lib_plymouth_on_refresh (script_state_t             *state,
                                      script_lib_plymouth_data_t *data);
 void script_lib_plymouth_on_boot_progress (script_state_t             *state,
@@ -33,16 +33,365 @@
 #include "script-lib-image.h"
 #include "script-lib-sprite.h"
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <math.h>
 
 #include "script-lib-sprite.script.h"
 
+#define SPRITE_GRID_CELL_SIZE 64
+#define SPRITE_MAX_OCCLUDERS 16
+#define SPRITE_BATCH_MAX_DAMAGE_AREAS 64
+
+static void
+sprite_array_append (script_lib_sprite_array_t *array,
+                     sprite_t                  *sprite)
+{
+        if (array->count == array->size) {
+                array->size = array->size ? array->size * 2 : 16;
+                array->sprites = realloc (array->sprites, array->size * sizeof(sprite_t *));
+        }
+        array->sprites[array->count++] = sprite;
+}
+
+static void
+sprite_array_remove (script_lib_sprite_array_t *array,
+                     sprite_t                  *sprite)
+{
+        int i;
+
+        for (i = 0; i < array->count; i++) {
+                if (array->sprites[i] == sprite) {
+                        array->sprites[i] = array->sprites[--array->count];
+                        return;
+                }
+        }
+}
+
+static void
+sprite_mark_dirty (script_lib_sprite_data_t *data,
+                   sprite_t                 *sprite)
+{
+        if (sprite->is_dirty)
+                return;
+        sprite->is_dirty = true;
+        sprite_array_append (&data->dirty_sprites, sprite);
+}
+
+/* Converts an area in screen coordinates to the range of grid cells it
+ * overlaps, clipped to the grid.  An empty range has x1 == x2.
+ */
+static void
+sprite_grid_get_cells (script_lib_sprite_data_t *data,
+                       long                      x,
+                       long                      y,
+                       long                      width,
+                       long                      height,
+                       int                      *cells)
+{
+        long x1, y1, x2, y2;
+
+        x1 = MAX (x - data->grid_x, 0);
+        y1 = MAX (y - data->grid_y, 0);
+        x2 = MIN (x + width - data->grid_x, (long) data->grid_width * SPRITE_GRID_CELL_SIZE);
+        y2 = MIN (y + height - data->grid_y, (long) data->grid_height * SPRITE_GRID_CELL_SIZE);
+
+        if (width <= 0 || height <= 0 || x1 >= x2 || y1 >= y2) {
+                cells[0] = cells[1] = cells[2] = cells[3] = 0;
+                return;
+        }
+
+        cells[0] = x1 / SPRITE_GRID_CELL_SIZE;
+        cells[1] = y1 / SPRITE_GRID_CELL_SIZE;
+        cells[2] = (x2 + SPRITE_GRID_CELL_SIZE - 1) / SPRITE_GRID_CELL_SIZE;
+        cells[3] = (y2 + SPRITE_GRID_CELL_SIZE - 1) / SPRITE_GRID_CELL_SIZE;
+}
+
+static void
+sprite_grid_remove (script_lib_sprite_data_t *data,
+                    sprite_t                 *sprite)
+{
+        int cell_x, cell_y;
+
+        for (cell_y = sprite->cell_y1; cell_y < sprite->cell_y2; cell_y++) {
+                for (cell_x = sprite->cell_x1; cell_x < sprite->cell_x2; cell_x++) {
+                        sprite_array_remove (&data->grid[cell_y * data->grid_width + cell_x],
+                                             sprite);
+                }
+        }
+        sprite->cell_x1 = sprite->cell_y1 = sprite->cell_x2 = sprite->cell_y2 = 0;
+}
+
+/* Files the sprite under the cells of the area it was last drawn in */
+static void
+sprite_grid_update (script_lib_sprite_data_t *data,
+                    sprite_t                 *sprite)
+{
+        int cells[4];
+        int cell_x, cell_y;
+
+        sprite_grid_get_cells (data,
+                               sprite->old_area.x,
+                               sprite->old_area.y,
+                               sprite->old_area.width,
+                               sprite->old_area.height,
+                               cells);
+
+        if (cells[0] == sprite->cell_x1 && cells[1] == sprite->cell_y1 &&
+            cells[2] == sprite->cell_x2 && cells[3] == sprite->cell_y2)
+                return;
+
+        sprite_grid_remove (data, sprite);
+
+        for (cell_y = cells[1]; cell_y < cells[3]; cell_y++) {
+                for (cell_x = cells[0]; cell_x < cells[2]; cell_x++) {
+                        sprite_array_append (&data->grid[cell_y * data->grid_width + cell_x],
+                                             sprite);
+                }
+        }
+        sprite->cell_x1 = cells[0];
+        sprite->cell_y1 = cells[1];
+        sprite->cell_x2 = cells[2];
+        sprite->cell_y2 = cells[3];
+}
+
+static void
+sprite_grid_free (script_lib_sprite_data_t *data)
+{
+        int i;
+
+        for (i = 0; i < data->grid_width * data->grid_height; i++) {
+                free (data->grid[i].sprites);
+        }
+        free (data->grid);
+        data->grid = NULL;
+        data->grid_width = 0;
+        data->grid_height = 0;
+}
+
+/* Sizes the grid to cover every display and refiles all sprites */
+static void
+sprite_grid_rebuild (script_lib_sprite_data_t *data)
+{
+        ply_list_node_t *node;
+        long x1, y1, x2, y2;
+        int i;
+
+        sprite_grid_free (data);
+
+        x1 = y1 = LONG_MAX;
+        x2 = y2 = LONG_MIN;
+        for (node = ply_list_get_first_node (data->displays);
+             node;
+             node = ply_list_get_next_node (data->displays, node)) {
+                script_lib_display_t *display = ply_list_node_get_data (node);
+
+                x1 = MIN (x1, display->x);
+                y1 = MIN (y1, display->y);
+                x2 = MAX (x2, display->x + (long) ply_pixel_display_get_width (display->pixel_display));
+                y2 = MAX (y2, display->y + (long) ply_pixel_display_get_height (display->pixel_display));
+        }
+
+        if (x1 < x2 && y1 < y2) {
+                data->grid_x = x1;
+                data->grid_y = y1;
+                data->grid_width = (x2 - x1 + SPRITE_GRID_CELL_SIZE - 1) / SPRITE_GRID_CELL_SIZE;
+                data->grid_height = (y2 - y1 + SPRITE_GRID_CELL_SIZE - 1) / SPRITE_GRID_CELL_SIZE;
+                data->grid = calloc (data->grid_width * data->grid_height,
+                                     sizeof(script_lib_sprite_array_t));
+        }
+
+        for (i = 0; i < data->sprites.count; i++) {
+                sprite_t *sprite = data->sprites.sprites[i];
+
+                sprite->cell_x1 = sprite->cell_y1 = sprite->cell_x2 = sprite->cell_y2 = 0;
+                if (sprite->image && !sprite->remove_me)
+                        sprite_grid_update (data, sprite);
+        }
+}
+
+static bool
+sprite_is_transformed (sprite_t *sprite)
+{
+        return sprite->rotation != 0 || sprite->scale_x != 1 || sprite->scale_y != 1 ||
+               sprite->transform[0] != 1 || sprite->transform[1] != 0 ||
+               sprite->transform[2] != 0 || sprite->transform[3] != 1;
+}
+
+/* Maps the sprite's image onto the screen, turning it about its centre.
+ * Returns false if the image is drawn as it is.
+ */
+static bool
+sprite_get_transform (sprite_t *sprite,
+                      double    transform[6])
+{
+        double width, height;
+        double xx, xy, yx, yy;
+
+        if (!sprite_is_transformed (sprite))
+                return false;
+
+        width = ply_pixel_buffer_get_width (sprite->image);
+        height = ply_pixel_buffer_get_height (sprite->image);
+
+        xx = cos (sprite->rotation) * sprite->scale_x;
+        xy = -sin (sprite->rotation) * sprite->scale_y;
+        yx = sin (sprite->rotation) * sprite->scale_x;
+        yy = cos (sprite->rotation) * sprite->scale_y;
+
+        transform[0] = sprite->transform[0] * xx + sprite->transform[1] * yx;
+        transform[1] = sprite->transform[0] * xy + sprite->transform[1] * yy;
+        transform[2] = sprite->transform[2] * xx + sprite->transform[3] * yx;
+        transform[3] = sprite->transform[2] * xy + sprite->transform[3] * yy;
+        transform[4] = sprite->x + width / 2 - (transform[0] * width + transform[1] * height) / 2;
+        transform[5] = sprite->y + height / 2 - (transform[2] * width + transform[3] * height) / 2;
+        return true;
+}
+
+static void
+sprite_batch_get_particle_area (sprite_t        *sprite,
+                                int              index,
+                                ply_rectangle_t *area)
+{
+        sprite_particle_t *particle = &sprite->batch->particles[index];
+
+        area->x = floor (sprite->x + particle->x);
+        area->y = floor (sprite->y + particle->y);
+        area->width = ply_pixel_buffer_get_width (sprite->image);
+        area->height = ply_pixel_buffer_get_height (sprite->image);
+}
+
+static void
+sprite_batch_get_area (sprite_t        *sprite,
+                       ply_rectangle_t *area)
+{
+        long x1, y1, x2, y2;
+        int i;
+
+        if (sprite->batch->count == 0) {
+                area->x = sprite->x;
+                area->y = sprite->y;
+                area->width = 0;
+                area->height = 0;
+                return;
+        }
+
+        x1 = y1 = LONG_MAX;
+        x2 = y2 = LONG_MIN;
+        for (i = 0; i < sprite->batch->count; i++) {
+                ply_rectangle_t particle_area;
+
+                sprite_batch_get_particle_area (sprite, i, &particle_area);
+                x1 = MIN (x1, particle_area.x);
+                y1 = MIN (y1, particle_area.y);
+                x2 = MAX (x2, particle_area.x + (long) particle_area.width);
+                y2 = MAX (y2, particle_area.y + (long) particle_area.height);
+        }
+
+        area->x = x1;
+        area->y = y1;
+        area->width = x2 - x1;
+        area->height = y2 - y1;
+}
+
+/* The screen area the sprite's image covers */
+static void
+sprite_get_area (sprite_t        *sprite,
+                 ply_rectangle_t *area)
+{
+        double transform[6];
+        double min_x, min_y, max_x, max_y;
+        double width, height;
+        int i;
+
+        if (sprite->batch != NULL) {
+                sprite_batch_get_area (sprite, area);
+                return;
+        }
+
+        width = ply_pixel_buffer_get_width (sprite->image);
+        height = ply_pixel_buffer_get_height (sprite->image);
+
+        if (!sprite_get_transform (sprite, transform)) {
+                area->x = sprite->x;
+                area->y = sprite->y;
+                area->width = width;
+                area->height = height;
+                return;
+        }
+
+        min_x = max_x = transform[4];
+        min_y = max_y = transform[5];
+        for (i = 1; i < 4; i++) {
+                double corner_x = (i & 1) ? width : 0;
+                double corner_y = (i & 2) ? height : 0;
+                double x = transform[0] * corner_x + transform[1] * corner_y + transform[4];
+                double y = transform[2] * corner_x + transform[3] * corner_y + transform[5];
+
+                min_x = MIN (min_x, x);
+                min_y = MIN (min_y, y);
+                max_x = MAX (max_x, x);
+                max_y = MAX (max_y, y);
+        }
+
+        area->x = floor (min_x);
+        area->y = floor (min_y);
+        area->width = ceil (max_x) - area->x;
+        area->height = ceil (max_y) - area->y;
+}
+
+/* Damages where each particle was and where it is now, unless there are so
+ * many that the region would cost more to build than drawing over the whole
+ * batch does.
+ */
+static void
+sprite_batch_add_damage (sprite_t        *sprite,
+                         ply_region_t    *region,
+                         ply_rectangle_t *area)
+{
+        sprite_batch_t *batch = sprite->batch;
+        bool each_particle;
+        int i;
+
+        each_particle = batch->old_count + batch->count <= SPRITE_BATCH_MAX_DAMAGE_AREAS;
+        if (each_particle) {
+                for (i = 0; i < batch->old_count; i++) {
+                        ply_region_add_rectangle (region, &batch->old_areas[i]);
+                }
+        } else {
+                ply_region_add_rectangle (region, area);
+                ply_region_add_rectangle (region, &sprite->old_area);
+        }
+
+        if (batch->count > 0)
+                batch->old_areas = realloc (batch->old_areas, batch->count * sizeof(ply_rectangle_t));
+        batch->old_count = batch->count;
+        for (i = 0; i < batch->count; i++) {
+                sprite_batch_get_particle_area (sprite, i, &batch->old_areas[i]);
+                if (each_particle)
+                        ply_region_add_rectangle (region, &batch->old_areas[i]);
+        }
+}
+
+static void
+sprite_destroy (sprite_t *sprite)
+{
+        script_obj_unref (sprite->image_obj);
+        if (sprite->batch != NULL) {
+                free (sprite->batch->particles);
+                free (sprite->batch->old_areas);
+                free (sprite->batch);
+        }
+        free (sprite);
+}
+
 static void sprite_free (script_obj_t *obj)
 {
         sprite_t *sprite = obj->data.native.object_data;
+        script_lib_sprite_data_t *data = obj->data.native.class->user_data;
 
         sprite->remove_me = true;
+        sprite_mark_dirty (data, sprite);
 }
 
 static script_return_t sprite_new (script_state_t *state,
@@ -60,14 +409,28 @@ static script_return_t sprite_new (script_state_t *state,
         sprite->old_x = 0;
         sprite->old_y = 0;
         sprite->old_z = 0;
-        sprite->old_width = 0;
-        sprite->old_height = 0;
+        sprite->old_area.x = 0;
+        sprite->old_area.y = 0;
+        sprite->old_area.width = 0;
+        sprite->old_area.height = 0;
         sprite->old_opacity = 1.0;
+        sprite->rotation = 0;
+        sprite->scale_x = 1;
+        sprite->scale_y = 1;
+        sprite->transform[0] = 1;
+        sprite->transform[1] = 0;
+        sprite->transform[2] = 0;
+        sprite->transform[3] = 1;
         sprite->refresh_me = false;
         sprite->remove_me = false;
         sprite->image = NULL;
         sprite->image_obj = NULL;
-        ply_list_append_data (data->sprite_list, sprite);
+
+        /* New sprites follow the existing ones until they are sorted in */
+        sprite->index = data->sprites.count;
+        sprite->resort_me = true;
+        sprite_array_append (&data->sprites, sprite);
+        sprite_mark_dirty (data, sprite);
 
         reply = script_obj_new_native (sprite, data->class);
         return script_return_obj (reply);
@@ -104,6 +467,7 @@ static script_return_t sprite_set_image (script_state_t *state,
                 sprite->image = image;
                 sprite->image_obj = script_obj_image;
                 sprite->refresh_me = true;
+                sprite_mark_dirty (data, sprite);
         }
         script_obj_unref (script_obj_image);
 
@@ -160,8 +524,10 @@ static script_return_t sprite_set_x (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
+        if (sprite) {
                 sprite->x = script_obj_hash_get_number (state->local, "value");
+                sprite_mark_dirty (data, sprite);
+        }
         return script_return_obj_null ();
 }
 
@@ -171,8 +537,10 @@ static script_return_t sprite_set_y (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
+        if (sprite) {
                 sprite->y = script_obj_hash_get_number (state->local, "value");
+                sprite_mark_dirty (data, sprite);
+        }
         return script_return_obj_null ();
 }
 
@@ -182,8 +550,11 @@ static script_return_t sprite_set_z (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
+        if (sprite) {
                 sprite->z = script_obj_hash_get_number (state->local, "value");
+                sprite->resort_me = true;
+                sprite_mark_dirty (data, sprite);
+        }
         return script_return_obj_null ();
 }
 
@@ -193,8 +564,342 @@ static script_return_t sprite_set_opacity (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
+        if (sprite) {
                 sprite->opacity = script_obj_hash_get_number (state->local, "value");
+                sprite_mark_dirty (data, sprite);
+        }
+        return script_return_obj_null ();
+}
+
+static script_return_t sprite_get_rotation (script_state_t *state,
+                                            void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
+
+        if (sprite)
+                return script_return_obj (script_obj_new_number (sprite->rotation));
+        return script_return_obj_null ();
+}
+
+static script_return_t sprite_get_scale_x (script_state_t *state,
+                                           void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
+
+        if (sprite)
+                return script_return_obj (script_obj_new_number (sprite->scale_x));
+        return script_return_obj_null ();
+}
+
+static script_return_t sprite_get_scale_y (script_state_t *state,
+                                           void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
+
+        if (sprite)
+                return script_return_obj (script_obj_new_number (sprite->scale_y));
+        return script_return_obj_null ();
+}
+
+static script_return_t sprite_set_rotation (script_state_t *state,
+                                            void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
+        double rotation;
+
+        if (sprite) {
+                rotation = script_obj_hash_get_number (state->local, "value");
+                if (rotation != sprite->rotation) {
+                        sprite->rotation = rotation;
+                        sprite->refresh_me = true;
+                        sprite_mark_dirty (data, sprite);
+                }
+        }
+        return script_return_obj_null ();
+}
+
+/* The vertical scale defaults to the horizontal one */
+static script_return_t sprite_set_scale (script_state_t *state,
+                                         void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
+        script_obj_t *y_obj;
+        double scale_x, scale_y;
+
+        if (sprite) {
+                scale_x = script_obj_hash_get_number (state->local, "x");
+                y_obj = script_obj_hash_peek_element (state->local, "y");
+                if (y_obj && script_obj_is_number (y_obj))
+                        scale_y = script_obj_as_number (y_obj);
+                else
+                        scale_y = scale_x;
+                script_obj_unref (y_obj);
+
+                if (scale_x != sprite->scale_x || scale_y != sprite->scale_y) {
+                        sprite->scale_x = scale_x;
+                        sprite->scale_y = scale_y;
+                        sprite->refresh_me = true;
+                        sprite_mark_dirty (data, sprite);
+                }
+        }
+        return script_return_obj_null ();
+}
+
+/* Applied after the scale and rotation */
+static script_return_t sprite_set_transform (script_state_t *state,
+                                             void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
+
+        if (sprite) {
+                sprite->transform[0] = script_obj_hash_get_number (state->local, "xx");
+                sprite->transform[1] = script_obj_hash_get_number (state->local, "xy");
+                sprite->transform[2] = script_obj_hash_get_number (state->local, "yx");
+                sprite->transform[3] = script_obj_hash_get_number (state->local, "yy");
+                sprite->refresh_me = true;
+                sprite_mark_dirty (data, sprite);
+        }
+        return script_return_obj_null ();
+}
+
+static sprite_batch_t *
+sprite_batch_get (script_lib_sprite_data_t *data,
+                  script_obj_t             *obj)
+{
+        sprite_t *sprite = script_obj_as_native_of_class (obj, data->class);
+
+        if (sprite == NULL)
+                return NULL;
+        return sprite->batch;
+}
+
+static void
+sprite_batch_changed (script_lib_sprite_data_t *data,
+                      script_obj_t             *obj)
+{
+        sprite_t *sprite = script_obj_as_native_of_class (obj, data->class);
+
+        sprite->refresh_me = true;
+        sprite_mark_dirty (data, sprite);
+}
+
+static script_return_t sprite_batch_new (script_state_t *state,
+                                         void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        script_return_t reply = sprite_new (state, user_data);
+        sprite_t *sprite = script_obj_as_native_of_class (reply.object, data->class);
+
+        sprite->batch = calloc (1, sizeof(sprite_batch_t));
+        return reply;
+}
+
+/* The opacity argument is optional and defaults to fully opaque */
+static double
+sprite_batch_get_opacity_argument (script_state_t *state)
+{
+        script_obj_t *opacity_obj = script_obj_hash_peek_element (state->local, "opacity");
+        double opacity = 1.0;
+
+        if (opacity_obj && script_obj_is_number (opacity_obj))
+                opacity = script_obj_as_number (opacity_obj);
+        script_obj_unref (opacity_obj);
+
+        return opacity;
+}
+
+static script_return_t sprite_batch_add (script_state_t *state,
+                                         void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_batch_t *batch = sprite_batch_get (data, state->this);
+        sprite_particle_t *particle;
+
+        if (!batch)
+                return script_return_obj_null ();
+
+        if (batch->count == batch->size) {
+                batch->size = batch->size ? batch->size * 2 : 16;
+                batch->particles = realloc (batch->particles, batch->size * sizeof(sprite_particle_t));
+        }
+        particle = &batch->particles[batch->count];
+        particle->x = script_obj_hash_get_number (state->local, "x");
+        particle->y = script_obj_hash_get_number (state->local, "y");
+        particle->velocity_x = script_obj_hash_get_number (state->local, "velocity_x");
+        particle->velocity_y = script_obj_hash_get_number (state->local, "velocity_y");
+        particle->opacity = sprite_batch_get_opacity_argument (state);
+
+        sprite_batch_changed (data, state->this);
+        return script_return_obj (script_obj_new_number (batch->count++));
+}
+
+static script_return_t sprite_batch_set_particle (script_state_t *state,
+                                                  void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_batch_t *batch = sprite_batch_get (data, state->this);
+        sprite_particle_t *particle;
+        int index;
+
+        if (!batch)
+                return script_return_obj_null ();
+
+        index = script_obj_hash_get_number (state->local, "index");
+        if (index < 0 || index >= batch->count)
+                return script_return_obj_null ();
+
+        particle = &batch->particles[index];
+        particle->x = script_obj_hash_get_number (state->local, "x");
+        particle->y = script_obj_hash_get_number (state->local, "y");
+        particle->opacity = sprite_batch_get_opacity_argument (state);
+        sprite_batch_changed (data, state->this);
+        return script_return_obj_null ();
+}
+
+/* Leaves the value alone if the array has no number at the index */
+static void
+sprite_batch_read_number (script_obj_t *array,
+                          int           index,
+                          double       *value)
+{
+        script_obj_t *element = script_obj_hash_peek_element_index (array, index);
+
+        if (element && script_obj_is_number (element))
+                *value = script_obj_as_number (element);
+        script_obj_unref (element);
+}
+
+static script_return_t sprite_batch_set_positions (script_state_t *state,
+                                                   void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_batch_t *batch = sprite_batch_get (data, state->this);
+        script_obj_t *x_obj, *y_obj;
+        int i;
+
+        if (!batch)
+                return script_return_obj_null ();
+
+        x_obj = script_obj_hash_get_element (state->local, "x");
+        y_obj = script_obj_hash_get_element (state->local, "y");
+        for (i = 0; i < batch->count; i++) {
+                sprite_batch_read_number (x_obj, i, &batch->particles[i].x);
+                sprite_batch_read_number (y_obj, i, &batch->particles[i].y);
+        }
+        script_obj_unref (x_obj);
+        script_obj_unref (y_obj);
+
+        sprite_batch_changed (data, state->this);
+        return script_return_obj_null ();
+}
+
+static script_return_t sprite_batch_set_opacities (script_state_t *state,
+                                                   void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_batch_t *batch = sprite_batch_get (data, state->this);
+        script_obj_t *values_obj;
+        int i;
+
+        if (!batch)
+                return script_return_obj_null ();
+
+        values_obj = script_obj_hash_get_element (state->local, "values");
+        for (i = 0; i < batch->count; i++) {
+                sprite_batch_read_number (values_obj, i, &batch->particles[i].opacity);
+        }
+        script_obj_unref (values_obj);
+
+        sprite_batch_changed (data, state->this);
+        return script_return_obj_null ();
+}
+
+static script_return_t sprite_batch_clear (script_state_t *state,
+                                           void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_batch_t *batch = sprite_batch_get (data, state->this);
+
+        if (batch && batch->count > 0) {
+                batch->count = 0;
+                sprite_batch_changed (data, state->this);
+        }
+        return script_return_obj_null ();
+}
+
+static script_return_t sprite_batch_get_count (script_state_t *state,
+                                               void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_batch_t *batch = sprite_batch_get (data, state->this);
+
+        if (batch)
+                return script_return_obj (script_obj_new_number (batch->count));
+        return script_return_obj_null ();
+}
+
+static script_return_t sprite_batch_set_gravity (script_state_t *state,
+                                                 void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_batch_t *batch = sprite_batch_get (data, state->this);
+
+        if (batch) {
+                batch->gravity_x = script_obj_hash_get_number (state->local, "x");
+                batch->gravity_y = script_obj_hash_get_number (state->local, "y");
+        }
+        return script_return_obj_null ();
+}
+
+/* Opacity each particle loses per unit of time */
+static script_return_t sprite_batch_set_fade (script_state_t *state,
+                                              void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_batch_t *batch = sprite_batch_get (data, state->this);
+
+        if (batch)
+                batch->fade = script_obj_hash_get_number (state->local, "value");
+        return script_return_obj_null ();
+}
+
+/* Moves every particle on by its velocity and the gravity, and drops the
+ * ones which have faded out, keeping the rest in order.
+ */
+static script_return_t sprite_batch_step (script_state_t *state,
+                                          void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_batch_t *batch = sprite_batch_get (data, state->this);
+        double time;
+        int i, kept;
+
+        if (!batch)
+                return script_return_obj_null ();
+
+        time = script_obj_hash_get_number (state->local, "time");
+        kept = 0;
+        for (i = 0; i < batch->count; i++) {
+                sprite_particle_t *particle = &batch->particles[i];
+
+                particle->velocity_x += batch->gravity_x * time;
+                particle->velocity_y += batch->gravity_y * time;
+                particle->x += particle->velocity_x * time;
+                particle->y += particle->velocity_y * time;
+                particle->opacity -= batch->fade * time;
+                if (particle->opacity <= 0)
+                        continue;
+                batch->particles[kept++] = *particle;
+        }
+        batch->count = kept;
+
+        sprite_batch_changed (data, state->this);
         return script_return_obj_null ();
 }
 
@@ -432,6 +1137,139 @@ static void script_lib_draw_brackground (ply_pixel_buffer_t *pixel_buffer,
         }
 }
 
+static int
+sprite_compare_index (const void *a,
+                      const void *b)
+{
+        const sprite_t *sprite_a = *(sprite_t *const *) a;
+        const sprite_t *sprite_b = *(sprite_t *const *) b;
+
+        return sprite_a->index - sprite_b->index;
+}
+
+/* Finds the part of the clip area the sprite would draw to, if any */
+static bool
+script_lib_sprite_get_drawn_area (script_lib_display_t *display,
+                                  ply_rectangle_t      *clip_area,
+                                  sprite_t             *sprite,
+                                  ply_rectangle_t      *drawn_area)
+{
+        ply_rectangle_t sprite_area;
+
+        if (!sprite->image) return false;
+        if (sprite->remove_me) return false;
+        if (sprite->opacity < 0.011) return false;
+
+        sprite_get_area (sprite, &sprite_area);
+        sprite_area.x -= display->x;
+        sprite_area.y -= display->y;
+
+        ply_rectangle_intersect (&sprite_area, clip_area, drawn_area);
+        return !ply_rectangle_is_empty (drawn_area);
+}
+
+static bool
+rectangle_contains (ply_rectangle_t *outer,
+                    ply_rectangle_t *inner)
+{
+        return inner->x >= outer->x &&
+               inner->y >= outer->y &&
+               inner->x + (long) inner->width <= outer->x + (long) outer->width &&
+               inner->y + (long) inner->height <= outer->y + (long) outer->height;
+}
+
+/* Gathers the sprites which may overlap the area, in drawing order.  Sprites
+ * are filed in the grid by where they were drawn at the last refresh, the
+ * ones changed since are checked separately.  Returns false if walking every
+ * sprite would be cheaper.
+ */
+static bool
+script_lib_sprite_find_candidates (script_lib_sprite_data_t *data,
+                                   long                      x,
+                                   long                      y,
+                                   long                      width,
+                                   long                      height)
+{
+        script_lib_sprite_array_t *candidates = &data->candidates;
+        int cells[4];
+        int cell_x, cell_y;
+        int i;
+
+        if (data->full_refresh || data->grid == NULL)
+                return false;
+
+        if (x < data->grid_x || y < data->grid_y ||
+            x + width > data->grid_x + (long) data->grid_width * SPRITE_GRID_CELL_SIZE ||
+            y + height > data->grid_y + (long) data->grid_height * SPRITE_GRID_CELL_SIZE)
+                return false;
+
+        sprite_grid_get_cells (data, x, y, width, height, cells);
+        if ((cells[2] - cells[0]) * (cells[3] - cells[1]) >= data->sprites.count)
+                return false;
+
+        data->query_stamp++;
+        candidates->count = 0;
+
+        for (cell_y = cells[1]; cell_y < cells[3]; cell_y++) {
+                for (cell_x = cells[0]; cell_x < cells[2]; cell_x++) {
+                        script_lib_sprite_array_t *cell = &data->grid[cell_y * data->grid_width + cell_x];
+
+                        for (i = 0; i < cell->count; i++) {
+                                sprite_t *sprite = cell->sprites[i];
+
+                                if (sprite->query_stamp == data->query_stamp)
+                                        continue;
+                                sprite->query_stamp = data->query_stamp;
+                                sprite_array_append (candidates, sprite);
+                        }
+                }
+        }
+
+        for (i = 0; i < data->dirty_sprites.count; i++) {
+                sprite_t *sprite = data->dirty_sprites.sprites[i];
+
+                if (sprite->query_stamp == data->query_stamp)
+                        continue;
+                sprite->query_stamp = data->query_stamp;
+                sprite_array_append (candidates, sprite);
+        }
+
+        qsort (candidates->sprites, candidates->count, sizeof(sprite_t *), sprite_compare_index);
+        return true;
+}
+
+static void
+script_lib_sprite_draw_batch (script_lib_display_t *display,
+                              ply_pixel_buffer_t   *pixel_buffer,
+                              ply_rectangle_t      *clip_area,
+                              sprite_t             *sprite)
+{
+        ply_rectangle_t particle_area;
+        ply_rectangle_t drawn_area;
+        int i;
+
+        for (i = 0; i < sprite->batch->count; i++) {
+                double opacity = sprite->opacity * sprite->batch->particles[i].opacity;
+
+                if (opacity < 0.011)
+                        continue;
+
+                sprite_batch_get_particle_area (sprite, i, &particle_area);
+                particle_area.x -= display->x;
+                particle_area.y -= display->y;
+                ply_rectangle_intersect (&particle_area, clip_area, &drawn_area);
+                if (ply_rectangle_is_empty (&drawn_area))
+                        continue;
+
+                ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (pixel_buffer,
+                                                                        sprite->image,
+                                                                        particle_area.x,
+                                                                        particle_area.y,
+                                                                        &drawn_area,
+                                                                        opacity);
+        }
+}
+
 static void script_lib_sprite_draw_area (script_lib_display_t *display,
                                          ply_pixel_buffer_t   *pixel_buffer,
                                          int                   x,
@@ -440,58 +1278,92 @@ static void script_lib_sprite_draw_area (script_lib_display_t *display,
                                          int                   height)
 {
         ply_rectangle_t clip_area;
-        ply_list_node_t *node;
-        sprite_t *sprite;
+        ply_rectangle_t drawn_area;
+        ply_rectangle_t occluders[SPRITE_MAX_OCCLUDERS];
+        int occluder_count;
+        sprite_t **sprites;
+        int sprite_count;
+        bool covered;
         script_lib_sprite_data_t *data = display->data;
+        script_lib_sprite_array_t *visible = &data->visible;
+        int i, j;
 
         clip_area.x = x;
         clip_area.y = y;
         clip_area.width = width;
         clip_area.height = height;
 
+        if (script_lib_sprite_find_candidates (data,
+                                               (long) x + display->x,
+                                               (long) y + display->y,
+                                               width,
+                                               height)) {
+                sprites = data->candidates.sprites;
+                sprite_count = data->candidates.count;
+        } else {
+                sprites = data->sprites.sprites;
+                sprite_count = data->sprites.count;
+        }
 
-        node = ply_list_get_first_node (data->sprite_list);
-        sprite = ply_list_node_get_data (node);
+        /* Walk from the top down, skipping sprites hidden behind an opaque
+         * one, and stop at the first opaque sprite covering the whole area,
+         * since neither what is below it nor the background will show.
+         */
+        visible->count = 0;
+        occluder_count = 0;
+        covered = false;
+        for (i = sprite_count - 1; i >= 0 && !covered; i--) {
+                sprite_t *sprite = sprites[i];
+
+                if (!script_lib_sprite_get_drawn_area (display, &clip_area, sprite, &drawn_area))
+                        continue;
+
+                for (j = 0; j < occluder_count; j++) {
+                        if (rectangle_contains (&occluders[j], &drawn_area))
+                                break;
+                }
+                if (j < occluder_count)
+                        continue;
 
-        /* Check If the first sprite should be rendered opaque */
-        if (sprite->image && !sprite->remove_me &&
-            ply_pixel_buffer_is_opaque (sprite->image) && sprite->opacity == 1.0)  {
-                int position_x = sprite->x - display->x;
-                int position_y = sprite->y - display->y;
+                sprite_array_append (visible, sprite);
 
-                /* In that case only draw the background if the sprite doesn't
-                 * cover the complete area */
-                if (position_x > x || position_y > y ||
-                    ((int)ply_pixel_buffer_get_width (sprite->image) + position_x) < (x + width) ||
-                    ((int)ply_pixel_buffer_get_height (sprite->image) + position_y) < (y + height))
-                        script_lib_draw_brackground (pixel_buffer, &clip_area, data);
-        } else {
-                script_lib_draw_brackground (pixel_buffer, &clip_area, data);
-        }
+                if (sprite->opacity != 1.0 || !ply_pixel_buffer_is_opaque (sprite->image) ||
+                    sprite_is_transformed (sprite) || sprite->batch != NULL)
+                        continue;
 
-        for (node = ply_list_get_first_node (data->sprite_list);
-             node;
-             node = ply_list_get_next_node (data->sprite_list, node)) {
-                int position_x, position_y;
+                if (rectangle_contains (&drawn_area, &clip_area))
+                        covered = true;
+                else if (occluder_count < SPRITE_MAX_OCCLUDERS)
+                        occluders[occluder_count++] = drawn_area;
+        }
 
-                sprite = ply_list_node_get_data (node);
+        if (!covered)
+                script_lib_draw_brackground (pixel_buffer, &clip_area, data);
 
-                if (!sprite->image) continue;
-                if (sprite->remove_me) continue;
-                if (sprite->opacity < 0.011) continue;
+        for (i = visible->count - 1; i >= 0; i--) {
+                sprite_t *sprite = visible->sprites[i];
+                double transform[6];
 
-                position_x = sprite->x - display->x;
-                position_y = sprite->y - display->y;
+                if (sprite->batch != NULL) {
+                        script_lib_sprite_draw_batch (display, pixel_buffer, &clip_area, sprite);
+                        continue;
+                }
 
-                if (position_x >= (x + width)) continue;
-                if (position_y >= (y + height)) continue;
+                if (sprite_get_transform (sprite, transform)) {
+                        transform[4] -= display->x;
+                        transform[5] -= display->y;
+                        ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip_and_transform (pixel_buffer,
+                                                                                              sprite->image,
+                                                                                              transform,
+                                                                                              &clip_area,
+                                                                                              sprite->opacity);
+                        continue;
+                }
 
-                if ((position_x + (int) ply_pixel_buffer_get_width (sprite->image)) <= x) continue;
-                if ((position_y + (int) ply_pixel_buffer_get_height (sprite->image)) <= y) continue;
                 ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (pixel_buffer,
                                                                         sprite->image,
-                                                                        position_x,
-                                                                        position_y,
+                                                                        sprite->x - display->x,
+                                                                        sprite->y - display->y,
                                                                         &clip_area,
                                                                         sprite->opacity);
         }
@@ -524,10 +1396,9 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
 {
         ply_list_node_t *node;
         unsigned int max_width, max_height;
-        script_lib_sprite_data_t *data = malloc (sizeof(script_lib_sprite_data_t));
+        script_lib_sprite_data_t *data = calloc (1, sizeof(script_lib_sprite_data_t));
 
         data->class = script_obj_native_class_new (sprite_free, "sprite", data);
-        data->sprite_list = ply_list_new ();
         data->displays = ply_list_new ();
 
         max_width = 0;
@@ -620,8 +1491,114 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
                                     data,
                                     "value",
                                     NULL);
+        script_add_native_function (sprite_hash,
+                                    "GetRotation",
+                                    sprite_get_rotation,
+                                    data,
+                                    NULL);
+        script_add_native_function (sprite_hash,
+                                    "SetRotation",
+                                    sprite_set_rotation,
+                                    data,
+                                    "value",
+                                    NULL);
+        script_add_native_function (sprite_hash,
+                                    "GetScaleX",
+                                    sprite_get_scale_x,
+                                    data,
+                                    NULL);
+        script_add_native_function (sprite_hash,
+                                    "GetScaleY",
+                                    sprite_get_scale_y,
+                                    data,
+                                    NULL);
+        script_add_native_function (sprite_hash,
+                                    "SetScale",
+                                    sprite_set_scale,
+                                    data,
+                                    "x",
+                                    "y",
+                                    NULL);
+        script_add_native_function (sprite_hash,
+                                    "SetTransform",
+                                    sprite_set_transform,
+                                    data,
+                                    "xx",
+                                    "xy",
+                                    "yx",
+                                    "yy",
+                                    NULL);
         script_obj_unref (sprite_hash);
 
+        script_obj_t *batch_hash = script_obj_hash_get_element (state->global, "SpriteBatch");
+        script_add_native_function (batch_hash,
+                                    "_New",
+                                    sprite_batch_new,
+                                    data,
+                                    NULL);
+        script_add_native_function (batch_hash,
+                                    "Add",
+                                    sprite_batch_add,
+                                    data,
+                                    "x",
+                                    "y",
+                                    "velocity_x",
+                                    "velocity_y",
+                                    "opacity",
+                                    NULL);
+        script_add_native_function (batch_hash,
+                                    "SetParticle",
+                                    sprite_batch_set_particle,
+                                    data,
+                                    "index",
+                                    "x",
+                                    "y",
+                                    "opacity",
+                                    NULL);
+        script_add_native_function (batch_hash,
+                                    "SetPositions",
+                                    sprite_batch_set_positions,
+                                    data,
+                                    "x",
+                                    "y",
+                                    NULL);
+        script_add_native_function (batch_hash,
+                                    "SetOpacities",
+                                    sprite_batch_set_opacities,
+                                    data,
+                                    "values",
+                                    NULL);
+        script_add_native_function (batch_hash,
+                                    "Clear",
+                                    sprite_batch_clear,
+                                    data,
+                                    NULL);
+        script_add_native_function (batch_hash,
+                                    "GetCount",
+                                    sprite_batch_get_count,
+                                    data,
+                                    NULL);
+        script_add_native_function (batch_hash,
+                                    "SetGravity",
+                                    sprite_batch_set_gravity,
+                                    data,
+                                    "x",
+                                    "y",
+                                    NULL);
+        script_add_native_function (batch_hash,
+                                    "SetFade",
+                                    sprite_batch_set_fade,
+                                    data,
+                                    "value",
+                                    NULL);
+        script_add_native_function (batch_hash,
+                                    "Step",
+                                    sprite_batch_step,
+                                    data,
+                                    "time",
+                                    NULL);
+        script_obj_unref (batch_hash);
+
 
         script_obj_t *window_hash = script_obj_hash_get_element (state->global, "Window");
         script_add_native_function (window_hash,
@@ -690,12 +1667,59 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
 }
 
 static int
-sprite_compare_z (void *data_a, void *data_b)
+sprite_compare_z (const void *a,
+                  const void *b)
 {
-        sprite_t *sprite_a = data_a;
-        sprite_t *sprite_b = data_b;
+        const sprite_t *sprite_a = *(sprite_t *const *) a;
+        const sprite_t *sprite_b = *(sprite_t *const *) b;
 
-        return sprite_a->z - sprite_b->z;
+        if (sprite_a->z != sprite_b->z)
+                return sprite_a->z < sprite_b->z ? -1 : 1;
+        return sprite_a->index - sprite_b->index;
+}
+
+/* Drops removed sprites and moves the ones whose z changed into place.  The
+ * rest are still in order, so only the moved ones need sorting before they
+ * are merged back in.  Ties keep the previous order, as a stable sort would.
+ */
+static void
+sprite_resort (script_lib_sprite_data_t *data)
+{
+        script_lib_sprite_array_t moved = { NULL, 0, 0 };
+        sprite_t **sprites = data->sprites.sprites;
+        int kept, i, j, k;
+
+        kept = 0;
+        for (i = 0; i < data->sprites.count; i++) {
+                sprite_t *sprite = sprites[i];
+
+                if (sprite->remove_me) {
+                        sprite_destroy (sprite);
+                } else if (sprite->resort_me) {
+                        sprite_array_append (&moved, sprite);
+                } else {
+                        sprites[kept++] = sprite;
+                }
+        }
+
+        qsort (moved.sprites, moved.count, sizeof(sprite_t *), sprite_compare_z);
+
+        i = kept - 1;
+        j = moved.count - 1;
+        for (k = kept + moved.count - 1; j >= 0; k--) {
+                if (i >= 0 && sprite_compare_z (&sprites[i], &moved.sprites[j]) > 0)
+                        sprites[k] = sprites[i--];
+                else
+                        sprites[k] = moved.sprites[j--];
+        }
+        data->sprites.count = kept + moved.count;
+
+        for (i = 0; i < data->sprites.count; i++) {
+                sprites[i]->index = i;
+                sprites[i]->resort_me = false;
+        }
+
+        free (moved.sprites);
 }
 
 static void
@@ -737,23 +1761,22 @@ void script_lib_sprite_pixel_display_removed (script_lib_sprite_data_t *data, pl
     }
 }
 
-void
+/* Returns whether anything on screen changed */
+bool
 script_lib_sprite_refresh (script_lib_sprite_data_t *data)
 {
         ply_list_node_t *node;
         ply_region_t *region;
         ply_list_t *rectable_list;
+        bool needs_resort;
+        bool damaged;
+        int i;
 
         if (!data)
-            return;
+            return false;
 
         region = ply_region_new ();
 
-        ply_list_sort_stable (data->sprite_list, &sprite_compare_z);
-
-        node = ply_list_get_first_node (data->sprite_list);
-
-
         if (data->full_refresh) {
                 for (node = ply_list_get_first_node (data->displays);
                      node;
@@ -766,62 +1789,57 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
                                          ply_pixel_display_get_height (display->pixel_display));
                 }
 
+                sprite_grid_rebuild (data);
                 data->full_refresh = false;
         }
 
-        while (node) {
-                sprite_t *sprite = ply_list_node_get_data (node);
-                ply_list_node_t *next_node = ply_list_get_next_node (data->sprite_list,
-                                                                     node);
+        needs_resort = false;
+        for (i = 0; i < data->dirty_sprites.count; i++) {
+                sprite_t *sprite = data->dirty_sprites.sprites[i];
+
+                sprite->is_dirty = false;
+
                 if (sprite->remove_me) {
-                        if (sprite->image) {
-                                region_add_area (region,
-                                                 sprite->old_x,
-                                                 sprite->old_y,
-                                                 sprite->old_width,
-                                                 sprite->old_height);
-                        }
-                        ply_list_remove_node (data->sprite_list, node);
-                        script_obj_unref (sprite->image_obj);
-                        free (sprite);
+                        if (sprite->image)
+                                ply_region_add_rectangle (region, &sprite->old_area);
+                        sprite_grid_remove (data, sprite);
+                        needs_resort = true;
+                        continue;
                 }
-                node = next_node;
-        }
+                if (sprite->resort_me)
+                        needs_resort = true;
 
-        for (node = ply_list_get_first_node (data->sprite_list);
-             node;
-             node = ply_list_get_next_node (data->sprite_list, node)) {
-                sprite_t *sprite = ply_list_node_get_data (node);
                 if (!sprite->image) continue;
                 if ((sprite->x != sprite->old_x)
                     || (sprite->y != sprite->old_y)
                     || (sprite->z != sprite->old_z)
                     || (fabs (sprite->old_opacity - sprite->opacity) > 0.01) /* People can't see the difference between */
                     || sprite->refresh_me) {
-                        ply_rectangle_t size;
-                        ply_pixel_buffer_get_size (sprite->image, &size);
-                        region_add_area (region,
-                                         sprite->x,
-                                         sprite->y,
-                                         size.width,
-                                         size.height);
-                        region_add_area (region,
-                                         sprite->old_x,
-                                         sprite->old_y,
-                                         sprite->old_width,
-                                         sprite->old_height);
+                        ply_rectangle_t area;
+                        sprite_get_area (sprite, &area);
+                        if (sprite->batch != NULL) {
+                                sprite_batch_add_damage (sprite, region, &area);
+                        } else {
+                                ply_region_add_rectangle (region, &area);
+                                ply_region_add_rectangle (region, &sprite->old_area);
+                        }
 
                         sprite->old_x = sprite->x;
                         sprite->old_y = sprite->y;
                         sprite->old_z = sprite->z;
-                        sprite->old_width = size.width;
-                        sprite->old_height = size.height;
+                        sprite->old_area = area;
                         sprite->old_opacity = sprite->opacity;
                         sprite->refresh_me = false;
+                        sprite_grid_update (data, sprite);
                 }
         }
+        data->dirty_sprites.count = 0;
+
+        if (needs_resort)
+                sprite_resort (data);
 
         rectable_list = ply_region_get_rectangle_list (region);
+        damaged = ply_list_get_length (rectable_list) > 0;
 
         for (node = ply_list_get_first_node (rectable_list);
              node;
@@ -835,11 +1853,13 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
         }
 
         ply_region_free (region);
+        return damaged;
 }
 
 void script_lib_sprite_destroy (script_lib_sprite_data_t *data)
 {
         ply_list_node_t *node;
+        int i;
 
         for (node = ply_list_get_first_node (data->displays);
              node;
@@ -848,19 +1868,15 @@ void script_lib_sprite_destroy (script_lib_sprite_data_t *data)
                 ply_pixel_display_set_draw_handler (display->pixel_display, NULL, NULL);
         }
 
-        node = ply_list_get_first_node (data->sprite_list);
-
-        while (node) {
-                sprite_t *sprite = ply_list_node_get_data (node);
-                ply_list_node_t *next_node = ply_list_get_next_node (data->sprite_list,
-                                                                     node);
-                ply_list_remove_node (data->sprite_list, node);
-                script_obj_unref (sprite->image_obj);
-                free (sprite);
-                node = next_node;
+        for (i = 0; i < data->sprites.count; i++) {
+                sprite_destroy (data->sprites.sprites[i]);
         }
 
-        ply_list_free (data->sprite_list);
+        free (data->sprites.sprites);
+        free (data->dirty_sprites.sprites);
+        free (data->candidates.sprites);
+        free (data->visible.sprites);
+        sprite_grid_free (data);
         script_parse_op_free (data->script_main_op);
         script_obj_native_class_destroy (data->class);
         free (data);
@@ -26,10 +26,50 @@
 #include "ply-pixel-buffer.h"
 #include "ply-pixel-display.h"
 
+typedef struct sprite_t sprite_t;
+
+typedef struct
+{
+        double x;
+        double y;
+        double velocity_x;
+        double velocity_y;
+        double opacity;
+} sprite_particle_t;
+
+/* Many copies of one image, drawn as a single sprite */
+typedef struct
+{
+        sprite_particle_t *particles;
+        int                count;
+        int                size;
+        double             gravity_x;
+        double             gravity_y;
+        double             fade;
+        ply_rectangle_t   *old_areas;    /* where each particle was last drawn */
+        int                old_count;
+} sprite_batch_t;
+
+typedef struct
+{
+        sprite_t **sprites;
+        int        count;
+        int        size;
+} script_lib_sprite_array_t;
+
 typedef struct
 {
         ply_list_t                *displays;
-        ply_list_t                *sprite_list;
+        script_lib_sprite_array_t  sprites;        /* sorted by z at the last refresh */
+        script_lib_sprite_array_t  dirty_sprites;  /* changed since the last refresh */
+        script_lib_sprite_array_t  candidates;
+        script_lib_sprite_array_t  visible;
+        script_lib_sprite_array_t *grid;           /* sprites overlapping each cell */
+        int                        grid_x;
+        int                        grid_y;
+        int                        grid_width;
+        int                        grid_height;
+        unsigned int               query_stamp;
         script_obj_native_class_t *class;
         script_op_t               *script_main_op;
         uint32_t                   background_color_start;
@@ -45,7 +85,7 @@ typedef struct
         int                       y;
 } script_lib_display_t;
 
-typedef struct
+struct sprite_t
 {
         int                 x;
         int                 y;
@@ -54,19 +94,31 @@ typedef struct
         int                 old_x;
         int                 old_y;
         int                 old_z;
-        int                 old_width;
-        int                 old_height;
+        ply_rectangle_t     old_area;
         double              old_opacity;
+        double              rotation;
+        double              scale_x;
+        double              scale_y;
+        double              transform[4];  /* applied after scale and rotation */
         bool                refresh_me;
         bool                remove_me;
+        bool                resort_me;
+        bool                is_dirty;
+        int                 index;
+        int                 cell_x1;       /* grid cells covered by the old area */
+        int                 cell_y1;
+        int                 cell_x2;
+        int                 cell_y2;
+        unsigned int        query_stamp;
         ply_pixel_buffer_t *image;
         script_obj_t       *image_obj;
-} sprite_t;
+        sprite_batch_t     *batch;
+};
 
 script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
                                                    ply_list_t     *displays);
 void script_lib_sprite_pixel_display_removed (script_lib_sprite_data_t *data, ply_pixel_display_t *pixel_display);
-void script_lib_sprite_refresh (script_lib_sprite_data_t *data);
+bool script_lib_sprite_refresh (script_lib_sprite_data_t *data);
 void script_lib_sprite_destroy (script_lib_sprite_data_t *data);
 
 #endif /* SCRIPT_LIB_SPRITE_H */
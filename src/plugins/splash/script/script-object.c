@@ -38,15 +38,86 @@
 #include <values.h>
 
 #include "script.h"
+#include "script-atom.h"
 #include "script-object.h"
 
-void script_obj_reset (script_obj_t *obj);
+#define SCRIPT_POOL_SLAB_ITEMS 256
+
+/* Objects and hash variables are small, all the same size and churned
+ * through at a high rate, so they are carved out of slabs and recycled
+ * through a free list instead of going back to malloc each time.  Slabs
+ * are kept for the life of the process.
+ */
+typedef struct script_pool_item_t
+{
+        struct script_pool_item_t *next;
+} script_pool_item_t;
+
+typedef struct
+{
+        script_pool_item_t *free_list;
+        size_t              item_size;
+        unsigned long       allocations;
+} script_pool_t;
+
+static script_pool_t script_obj_pool = { NULL, sizeof(script_obj_t), 0 };
+static script_pool_t script_variable_pool = { NULL, sizeof(script_variable_t), 0 };
+static script_pool_t script_hash_pool = { NULL, sizeof(script_hash_t), 0 };
+
+/* Hash versions are never reused, and the shape changes whenever an object
+ * that could be part of an extended object is destroyed or overwritten.
+ * Together they tell a script_obj_hash_cache_t whether it is still valid.
+ * Hashes come from a pool so a stale cache can still read their version.
+ */
+static uint64_t script_hash_version;
+static uint64_t script_obj_shape;
+
+static void *script_pool_alloc (script_pool_t *pool)
+{
+        script_pool_item_t *item;
+
+        if (!pool->free_list) {
+                char *slab = malloc (pool->item_size * SCRIPT_POOL_SLAB_ITEMS);
+                int index;
+
+                for (index = SCRIPT_POOL_SLAB_ITEMS - 1; index >= 0; index--) {
+                        item = (script_pool_item_t *) (slab + index * pool->item_size);
+                        item->next = pool->free_list;
+                        pool->free_list = item;
+                }
+        }
+        item = pool->free_list;
+        pool->free_list = item->next;
+        pool->allocations++;
+        return item;
+}
+
+static void script_pool_free (script_pool_t *pool,
+                              void          *data)
+{
+        script_pool_item_t *item = data;
+
+        item->next = pool->free_list;
+        pool->free_list = item;
+}
+
+static script_obj_t *script_obj_alloc (void)
+{
+        return script_pool_alloc (&script_obj_pool);
+}
+
+unsigned long script_obj_get_allocation_count (void)
+{
+        return script_obj_pool.allocations + script_variable_pool.allocations;
+}
+
+static void script_obj_clear (script_obj_t *obj);
 
 void script_obj_free (script_obj_t *obj)
 {
         assert (!obj->refcount);
-        script_obj_reset (obj);
-        free (obj);
+        script_obj_clear (obj);
+        script_pool_free (&script_obj_pool, obj);
 }
 
 void script_obj_ref (script_obj_t *obj)
@@ -70,11 +141,11 @@ static void foreach_free_variable (void *key,
         script_variable_t *variable = data;
 
         script_obj_unref (variable->object);
-        free (variable->name);
-        free (variable);
+        script_atom_unref (variable->name);
+        script_pool_free (&script_variable_pool, variable);
 }
 
-void script_obj_reset (script_obj_t *obj)
+static void script_obj_clear (script_obj_t *obj)
 {
         switch (obj->type) {
         case SCRIPT_OBJ_TYPE_REF:
@@ -82,6 +153,7 @@ void script_obj_reset (script_obj_t *obj)
                 break;
 
         case SCRIPT_OBJ_TYPE_EXTEND:
+                script_obj_shape++;
                 script_obj_unref (obj->data.dual_obj.obj_a);
                 script_obj_unref (obj->data.dual_obj.obj_b);
                 break;
@@ -94,9 +166,20 @@ void script_obj_reset (script_obj_t *obj)
                 break;
 
         case SCRIPT_OBJ_TYPE_HASH:              /* FIXME nightmare */
-                ply_hashtable_foreach (obj->data.hash, foreach_free_variable, NULL);
-                ply_hashtable_free (obj->data.hash);
+        {
+                script_hash_t *hash = obj->data.hash;
+                int index;
+
+                ply_hashtable_foreach (hash->table, foreach_free_variable, NULL);
+                ply_hashtable_free (hash->table);
+                for (index = 0; index < hash->vector_size; index++) {
+                        script_obj_unref (hash->vector[index]);
+                }
+                free (hash->vector);
+                hash->version = ++script_hash_version;
+                script_pool_free (&script_hash_pool, hash);
                 break;
+        }
 
         case SCRIPT_OBJ_TYPE_FUNCTION:
         {
@@ -128,6 +211,14 @@ void script_obj_reset (script_obj_t *obj)
         obj->type = SCRIPT_OBJ_TYPE_NULL;
 }
 
+void script_obj_reset (script_obj_t *obj)
+{
+        /* The value may be part of an extended object someone has cached */
+        if (obj->type != SCRIPT_OBJ_TYPE_REF && obj->type != SCRIPT_OBJ_TYPE_NULL)
+                script_obj_shape++;
+        script_obj_clear (obj);
+}
+
 script_obj_t *script_obj_deref_direct (script_obj_t *obj)
 {
         while (obj->type == SCRIPT_OBJ_TYPE_REF) {
@@ -148,7 +239,7 @@ void script_obj_deref (script_obj_t **obj_ptr)
 
 script_obj_t *script_obj_new_null (void)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_NULL;
         obj->refcount = 1;
@@ -157,7 +248,7 @@ script_obj_t *script_obj_new_null (void)
 
 script_obj_t *script_obj_new_number (script_number_t number)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_NUMBER;
         obj->refcount = 1;
@@ -168,7 +259,7 @@ script_obj_t *script_obj_new_number (script_number_t number)
 script_obj_t *script_obj_new_string (const char *string)
 {
         if (!string) return script_obj_new_null ();
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
         obj->type = SCRIPT_OBJ_TYPE_STRING;
         obj->refcount = 1;
         obj->data.string = strdup (string);
@@ -177,18 +268,20 @@ script_obj_t *script_obj_new_string (const char *string)
 
 script_obj_t *script_obj_new_hash (void)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_HASH;
-        obj->data.hash = ply_hashtable_new (ply_hashtable_string_hash,
-                                            ply_hashtable_string_compare);
+        obj->data.hash = script_pool_alloc (&script_hash_pool);
+        memset (obj->data.hash, 0, sizeof(script_hash_t));
+        obj->data.hash->table = ply_hashtable_new (script_atom_hash, NULL);
+        obj->data.hash->version = ++script_hash_version;
         obj->refcount = 1;
         return obj;
 }
 
 script_obj_t *script_obj_new_function (script_function_t *function)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_FUNCTION;
         obj->data.function = function;
@@ -198,7 +291,7 @@ script_obj_t *script_obj_new_function (script_function_t *function)
 
 script_obj_t *script_obj_new_ref (script_obj_t *sub_obj)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         sub_obj = script_obj_deref_direct (sub_obj);
         script_obj_ref (sub_obj);
@@ -210,7 +303,7 @@ script_obj_t *script_obj_new_ref (script_obj_t *sub_obj)
 
 script_obj_t *script_obj_new_extend (script_obj_t *obj_a, script_obj_t *obj_b)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj_a = script_obj_deref_direct (obj_a);
         obj_b = script_obj_deref_direct (obj_b);
@@ -227,7 +320,7 @@ script_obj_t *script_obj_new_native (void                      *object_data,
                                      script_obj_native_class_t *class)
 {
         if (!object_data) return script_obj_new_null ();
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
         obj->type = SCRIPT_OBJ_TYPE_NATIVE;
         obj->data.native.class = class;
         obj->data.native.object_data = object_data;
@@ -330,6 +423,43 @@ static void *script_obj_direct_as_native_of_class (script_obj_t *obj,
         return NULL;
 }
 
+/* Numbers that are small non-negative integers are keyed by their value */
+bool script_obj_key_as_index (script_obj_t *obj,
+                              int          *index)
+{
+        script_obj_t *number_obj;
+        script_number_t number;
+
+        if (script_obj_as_obj_type (obj, SCRIPT_OBJ_TYPE_STRING))
+                return false;
+        number_obj = script_obj_as_obj_type (obj, SCRIPT_OBJ_TYPE_NUMBER);
+        if (!number_obj)
+                return false;
+        number = number_obj->data.number;
+        if (!(number >= 0 && number < SCRIPT_ATOM_INDEX_LIMIT) || signbit (number))
+                return false;
+        *index = (int) number;
+        return *index == number;
+}
+
+/* Same conversion as script_obj_as_string, for use as a hash key */
+script_atom_t *script_obj_as_atom (script_obj_t *obj)
+{
+        char buffer[64];
+        script_obj_t *string_obj = script_obj_as_obj_type (obj, SCRIPT_OBJ_TYPE_STRING);
+
+        if (string_obj) return script_atom_get (string_obj->data.string);
+        string_obj = script_obj_as_obj_type (obj, SCRIPT_OBJ_TYPE_NUMBER);
+        if (string_obj) {
+                snprintf (buffer, sizeof(buffer), "%g", string_obj->data.number);
+                return script_atom_get (buffer);
+        }
+        if (script_obj_is_null (obj))
+                return script_atom_get ("#NULL");
+        snprintf (buffer, sizeof(buffer), "#(0x%p)", obj);
+        return script_atom_get (buffer);
+}
+
 void *script_obj_as_native_of_class (script_obj_t              *obj,
                                      script_obj_native_class_t *class)
 {
@@ -409,48 +539,223 @@ void script_obj_assign (script_obj_t *obj_a,
 static void *script_obj_direct_as_hash_element (script_obj_t *obj,
                                                 void         *user_data)
 {
-        const char *name = user_data;
+        script_atom_t *name = user_data;
 
         if (obj->type == SCRIPT_OBJ_TYPE_HASH) {
-                script_variable_t *variable = ply_hashtable_lookup (obj->data.hash, (void *) name);
+                script_variable_t *variable = ply_hashtable_lookup (obj->data.hash->table, name);
                 if (variable)
                         return variable->object;
         }
         return NULL;
 }
 
-script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
-                                            const char   *name)
+static void *script_obj_direct_as_hash_index (script_obj_t *obj,
+                                              void         *user_data)
+{
+        int index = *(int *) user_data;
+
+        if (obj->type == SCRIPT_OBJ_TYPE_HASH) {
+                script_hash_t *hash = obj->data.hash;
+                if (index < hash->vector_size && hash->vector[index])
+                        return hash->vector[index];
+                if (hash->table_index_count) {
+                        char name[16];
+                        script_atom_t *atom;
+                        snprintf (name, sizeof(name), "%d", index);
+                        atom = script_atom_lookup (name);
+                        if (atom)
+                                return script_obj_direct_as_hash_element (obj, atom);
+                }
+        }
+        return NULL;
+}
+
+/* Integer keys must be given in the canonical form, see script_obj_key_as_index */
+script_obj_t *script_obj_hash_peek_element_index (script_obj_t *hash,
+                                                  int           index)
 {
         script_obj_t *object;
 
-        if (!name) return script_obj_new_null ();
+        object = script_obj_as_custom (hash,
+                                       script_obj_direct_as_hash_index,
+                                       &index);
+        if (object) script_obj_ref (object);
+        return object;
+}
+
+script_obj_t *script_obj_hash_peek_element_atom (script_obj_t  *hash,
+                                                 script_atom_t *name)
+{
+        script_obj_t *object;
+
+        if (name->index >= 0)
+                return script_obj_hash_peek_element_index (hash, name->index);
         object = script_obj_as_custom (hash,
                                        script_obj_direct_as_hash_element,
-                                       (void *) name);
+                                       name);
         if (object) script_obj_ref (object);
         return object;
 }
 
-script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
-                                           const char   *name)
+/* Mirrors script_obj_as_custom, noting every hash searched on the way */
+static script_obj_t *script_obj_hash_cache_search (script_obj_hash_cache_t *cache,
+                                                   script_obj_t            *obj,
+                                                   script_atom_t           *name)
 {
-        script_obj_t *obj = script_obj_hash_peek_element (hash, name);
+        script_obj_t *element;
 
-        if (obj) return obj;
+        obj = script_obj_deref_direct (obj);
+        if (obj->type == SCRIPT_OBJ_TYPE_HASH) {
+                int index = name->index;
+
+                if (cache->hash_count < SCRIPT_OBJ_HASH_CACHE_DEPTH) {
+                        cache->hashes[cache->hash_count] = obj->data.hash;
+                        cache->versions[cache->hash_count] = obj->data.hash->version;
+                }
+                cache->hash_count++;
+                if (index >= 0)
+                        return script_obj_direct_as_hash_index (obj, &index);
+                return script_obj_direct_as_hash_element (obj, name);
+        }
+        if (obj->type == SCRIPT_OBJ_TYPE_EXTEND) {
+                element = script_obj_hash_cache_search (cache, obj->data.dual_obj.obj_a, name);
+                if (element) return element;
+                return script_obj_hash_cache_search (cache, obj->data.dual_obj.obj_b, name);
+        }
+        return NULL;
+}
+
+/* Same as script_obj_hash_peek_element_atom, with the caller keeping one
+ * cache per place the same name is looked up.
+ */
+script_obj_t *script_obj_hash_peek_element_cached (script_obj_t            *hash,
+                                                   script_atom_t           *name,
+                                                   script_obj_hash_cache_t *cache)
+{
+        script_obj_t *root = script_obj_deref_direct (hash);
+        int index;
+
+        if (cache->root == root &&
+            cache->root_type == root->type &&
+            cache->shape == script_obj_shape) {
+                for (index = 0; index < cache->hash_count; index++) {
+                        if (cache->hashes[index]->version != cache->versions[index])
+                                break;
+                }
+                if (index == cache->hash_count) {
+                        if (cache->element) script_obj_ref (cache->element);
+                        return cache->element;
+                }
+        }
+
+        cache->hash_count = 0;
+        cache->element = script_obj_hash_cache_search (cache, root, name);
+        if (cache->hash_count <= SCRIPT_OBJ_HASH_CACHE_DEPTH) {
+                cache->root = root;
+                cache->root_type = root->type;
+                cache->shape = script_obj_shape;
+        } else {
+                cache->root = NULL;
+        }
+        if (cache->element) script_obj_ref (cache->element);
+        return cache->element;
+}
+
+script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
+                                            const char   *name)
+{
+        script_atom_t *atom;
+
+        if (!name) return script_obj_new_null ();
+        atom = script_atom_lookup (name);
+        if (!atom) return NULL;         /* no hash can hold a name that was never interned */
+        return script_obj_hash_peek_element_atom (hash, atom);
+}
+
+static script_obj_t *script_obj_hash_get_real_hash (script_obj_t *hash)
+{
         script_obj_t *realhash = script_obj_as_obj_type (hash, SCRIPT_OBJ_TYPE_HASH);
+
         if (!realhash) {
                 realhash = script_obj_new_hash (); /* If it wasn't a hash then make it into one */
                 script_obj_assign (hash, realhash);
         }
-        script_variable_t *variable = malloc (sizeof(script_variable_t));
-        variable->name = strdup (name);
+        return realhash;
+}
+
+static script_obj_t *script_obj_hash_insert_atom (script_obj_t  *realhash,
+                                                  script_atom_t *name)
+{
+        script_variable_t *variable = script_pool_alloc (&script_variable_pool);
+
+        variable->name = script_atom_ref (name);
         variable->object = script_obj_new_null ();
-        ply_hashtable_insert (realhash->data.hash, variable->name, variable);
+        ply_hashtable_insert (realhash->data.hash->table, variable->name, variable);
+        realhash->data.hash->version = ++script_hash_version;
         script_obj_ref (variable->object);
         return variable->object;
 }
 
+script_obj_t *script_obj_hash_get_element_index (script_obj_t *hash,
+                                                 int           index)
+{
+        script_obj_t *obj = script_obj_hash_peek_element_index (hash, index);
+        script_hash_t *realhash;
+
+        if (obj) return obj;
+        obj = script_obj_hash_get_real_hash (hash);
+        realhash = obj->data.hash;
+
+        if (index >= realhash->vector_size * 2 + 16) {
+                char name[16];
+                script_atom_t *atom;
+                snprintf (name, sizeof(name), "%d", index);
+                atom = script_atom_get (name);
+                obj = script_obj_hash_insert_atom (obj, atom);
+                script_atom_unref (atom);
+                realhash->table_index_count++;
+                return obj;
+        }
+
+        if (index >= realhash->vector_size) {
+                int new_size = realhash->vector_size * 2;
+                if (new_size <= index)
+                        new_size = index + 1;
+                realhash->vector = realloc (realhash->vector, new_size * sizeof(script_obj_t *));
+                memset (realhash->vector + realhash->vector_size, 0,
+                        (new_size - realhash->vector_size) * sizeof(script_obj_t *));
+                realhash->vector_size = new_size;
+        }
+        obj = script_obj_new_null ();
+        realhash->vector[index] = obj;
+        realhash->version = ++script_hash_version;
+        script_obj_ref (obj);
+        return obj;
+}
+
+script_obj_t *script_obj_hash_get_element_atom (script_obj_t  *hash,
+                                                script_atom_t *name)
+{
+        script_obj_t *obj;
+
+        if (name->index >= 0)
+                return script_obj_hash_get_element_index (hash, name->index);
+
+        obj = script_obj_hash_peek_element_atom (hash, name);
+        if (obj) return obj;
+        return script_obj_hash_insert_atom (script_obj_hash_get_real_hash (hash), name);
+}
+
+script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
+                                           const char   *name)
+{
+        script_atom_t *atom = script_atom_get (name);
+        script_obj_t *obj = script_obj_hash_get_element_atom (hash, atom);
+
+        script_atom_unref (atom);
+        return obj;
+}
+
 script_number_t script_obj_hash_get_number (script_obj_t *hash,
                                             const char   *name)
 {
@@ -513,6 +818,26 @@ void script_obj_hash_add_element (script_obj_t *hash,
         script_obj_unref (obj);
 }
 
+void script_obj_hash_add_element_index (script_obj_t *hash,
+                                        script_obj_t *element,
+                                        int           index)
+{
+        script_obj_t *obj = script_obj_hash_get_element_index (hash, index);
+
+        script_obj_assign (obj, element);
+        script_obj_unref (obj);
+}
+
+void script_obj_hash_add_element_atom (script_obj_t  *hash,
+                                       script_obj_t  *element,
+                                       script_atom_t *name)
+{
+        script_obj_t *obj = script_obj_hash_get_element_atom (hash, name);
+
+        script_obj_assign (obj, element);
+        script_obj_unref (obj);
+}
+
 script_obj_t *script_obj_plus (script_obj_t *script_obj_a,
                                script_obj_t *script_obj_b)
 {
@@ -23,6 +23,7 @@
 #define SCRIPT_OBJECT_H
 
 #include "script.h"
+#include "script-atom.h"
 #include <stdbool.h>
 
 
@@ -38,7 +39,25 @@ typedef enum
 typedef void *(*script_obj_direct_func_t)(script_obj_t *,
                                           void         *);
 
+#define SCRIPT_OBJ_HASH_CACHE_DEPTH 4
 
+/* Remembers the result of looking a name up in an object, along with the
+ * hashes searched to find it, so the lookup can be repeated without a search
+ * while none of them gained elements.
+ */
+typedef struct
+{
+        script_obj_t      *root;
+        script_obj_type_t  root_type;
+        uint64_t           shape;
+        int                hash_count;
+        script_hash_t     *hashes[SCRIPT_OBJ_HASH_CACHE_DEPTH];
+        uint64_t           versions[SCRIPT_OBJ_HASH_CACHE_DEPTH];
+        script_obj_t      *element;
+} script_obj_hash_cache_t;
+
+
+unsigned long script_obj_get_allocation_count (void);
 void script_obj_free (script_obj_t *obj);
 void script_obj_ref (script_obj_t *obj);
 void script_obj_unref (script_obj_t *obj);
@@ -64,6 +83,9 @@ script_obj_t *script_obj_as_obj_type (script_obj_t     *obj,
 script_number_t script_obj_as_number (script_obj_t *obj);
 bool script_obj_as_bool (script_obj_t *obj);
 char *script_obj_as_string (script_obj_t *obj);
+script_atom_t *script_obj_as_atom (script_obj_t *obj);
+bool script_obj_key_as_index (script_obj_t *obj,
+                              int          *index);
 void *script_obj_as_native_of_class (script_obj_t              *obj,
                                      script_obj_native_class_t *class);
 void *script_obj_as_native_of_class_name (script_obj_t *obj,
@@ -84,6 +106,17 @@ script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
                                             const char   *name);
 script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
                                            const char   *name);
+script_obj_t *script_obj_hash_peek_element_cached (script_obj_t            *hash,
+                                                   script_atom_t           *name,
+                                                   script_obj_hash_cache_t *cache);
+script_obj_t *script_obj_hash_peek_element_atom (script_obj_t  *hash,
+                                                 script_atom_t *name);
+script_obj_t *script_obj_hash_get_element_atom (script_obj_t  *hash,
+                                                script_atom_t *name);
+script_obj_t *script_obj_hash_peek_element_index (script_obj_t *hash,
+                                                  int           index);
+script_obj_t *script_obj_hash_get_element_index (script_obj_t *hash,
+                                                 int           index);
 script_number_t script_obj_hash_get_number (script_obj_t *hash,
                                             const char   *name);
 bool script_obj_hash_get_bool (script_obj_t *hash,
@@ -99,6 +132,12 @@ void *script_obj_hash_get_native_of_class_name (script_obj_t *hash,
 void script_obj_hash_add_element (script_obj_t *hash,
                                   script_obj_t *element,
                                   const char   *name);
+void script_obj_hash_add_element_atom (script_obj_t  *hash,
+                                       script_obj_t  *element,
+                                       script_atom_t *name);
+void script_obj_hash_add_element_index (script_obj_t *hash,
+                                        script_obj_t *element,
+                                        int           index);
 script_obj_t *script_obj_plus (script_obj_t *script_obj_a_in,
                                script_obj_t *script_obj_b_in);
 script_obj_t *script_obj_minus (script_obj_t *script_obj_a_in,
@@ -0,0 +1,911 @@
+/* script-optimize.c - simplification of parsed scripts
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script.h"
+#include "script-debug.h"
+#include "script-object.h"
+#include "script-optimize.h"
+#include "script-parse.h"
+
+/* Loops are only given hoisted expressions when nothing in them can change
+ * what the expression reads: no calls, no access to the scope hashes, no
+ * hash elements with computed keys, and no writes to the names involved.
+ * The names must also be read whenever the condition is, or by the first
+ * pass through the body, so reading them once before the loop cannot create
+ * a variable that would not have been.  The latter needs the hoisted code
+ * guarded by a copy of the condition.
+ */
+typedef struct
+{
+        ply_hashtable_t *written;       /* names which may change, owned */
+        ply_hashtable_t *read;          /* names the condition always reads */
+        ply_hashtable_t *body_read;     /* names the body always reads first */
+        ply_list_t      *hoisted;       /* assignments to put before the loop */
+        bool             blocked;
+        bool             guard;
+} script_optimize_loop_t;
+
+static int script_optimize_hoisted_count;
+
+static script_op_t *script_optimize_op (script_op_t *op);
+
+static script_exp_t *script_optimize_new_exp (script_exp_type_t type,
+                                              void             *like)
+{
+        script_exp_t *exp = malloc (sizeof(script_exp_t));
+        script_debug_location_t *location = script_debug_lookup_element (like);
+
+        exp->type = type;
+        if (location)
+                script_debug_add_element (exp, location);
+        return exp;
+}
+
+static script_op_t *script_optimize_new_op (script_op_type_t type,
+                                            void            *like)
+{
+        script_op_t *op = malloc (sizeof(script_op_t));
+        script_debug_location_t *location = script_debug_lookup_element (like);
+
+        op->type = type;
+        if (location)
+                script_debug_add_element (op, location);
+        return op;
+}
+
+static void script_optimize_free_shell (script_exp_t *exp)
+{
+        script_debug_remove_element (exp);
+        free (exp);
+}
+
+static script_obj_t *script_optimize_exp_as_obj (script_exp_t *exp)
+{
+        if (exp->type == SCRIPT_EXP_TYPE_TERM_NUMBER)
+                return script_obj_new_number (exp->data.number);
+        if (exp->type == SCRIPT_EXP_TYPE_TERM_STRING)
+                return script_obj_new_string (exp->data.string);
+        if (exp->type == SCRIPT_EXP_TYPE_TERM_NULL)
+                return script_obj_new_null ();
+        return NULL;
+}
+
+static script_exp_t *script_optimize_obj_as_exp (script_obj_t *obj,
+                                                 script_exp_t *like)
+{
+        script_exp_t *exp;
+
+        obj = script_obj_deref_direct (obj);
+        if (obj->type == SCRIPT_OBJ_TYPE_NUMBER) {
+                exp = script_optimize_new_exp (SCRIPT_EXP_TYPE_TERM_NUMBER, like);
+                exp->data.number = obj->data.number;
+                return exp;
+        }
+        if (obj->type == SCRIPT_OBJ_TYPE_STRING) {
+                exp = script_optimize_new_exp (SCRIPT_EXP_TYPE_TERM_STRING, like);
+                exp->data.string = strdup (obj->data.string);
+                return exp;
+        }
+        if (obj->type == SCRIPT_OBJ_TYPE_NULL)
+                return script_optimize_new_exp (SCRIPT_EXP_TYPE_TERM_NULL, like);
+        return NULL;
+}
+
+static int script_optimize_cmp_mask (script_exp_type_t type)
+{
+        if (type == SCRIPT_EXP_TYPE_EQ)
+                return SCRIPT_OBJ_CMP_RESULT_EQ;
+        if (type == SCRIPT_EXP_TYPE_NE)
+                return SCRIPT_OBJ_CMP_RESULT_NE | SCRIPT_OBJ_CMP_RESULT_LT | SCRIPT_OBJ_CMP_RESULT_GT;
+        if (type == SCRIPT_EXP_TYPE_GT)
+                return SCRIPT_OBJ_CMP_RESULT_GT;
+        if (type == SCRIPT_EXP_TYPE_GE)
+                return SCRIPT_OBJ_CMP_RESULT_GT | SCRIPT_OBJ_CMP_RESULT_EQ;
+        if (type == SCRIPT_EXP_TYPE_LT)
+                return SCRIPT_OBJ_CMP_RESULT_LT;
+        if (type == SCRIPT_EXP_TYPE_LE)
+                return SCRIPT_OBJ_CMP_RESULT_LT | SCRIPT_OBJ_CMP_RESULT_EQ;
+        return 0;
+}
+
+/* Constants are combined with the same functions the interpreter uses, so
+ * folding cannot change a result, including number to string conversion.
+ */
+static script_exp_t *script_optimize_fold_dual (script_exp_t *exp)
+{
+        script_obj_t *obj_a = script_optimize_exp_as_obj (exp->data.dual.sub_a);
+        script_obj_t *obj_b = script_optimize_exp_as_obj (exp->data.dual.sub_b);
+        script_obj_t *result = NULL;
+        script_exp_t *folded = NULL;
+        int mask;
+
+        if (obj_a && obj_b) {
+                mask = script_optimize_cmp_mask (exp->type);
+                if (mask)
+                        result = script_obj_new_number ((script_obj_cmp (obj_a, obj_b) & mask) ? 1 : 0);
+                else if (exp->type == SCRIPT_EXP_TYPE_PLUS)
+                        result = script_obj_plus (obj_a, obj_b);
+                else if (exp->type == SCRIPT_EXP_TYPE_MINUS)
+                        result = script_obj_minus (obj_a, obj_b);
+                else if (exp->type == SCRIPT_EXP_TYPE_MUL)
+                        result = script_obj_mul (obj_a, obj_b);
+                else if (exp->type == SCRIPT_EXP_TYPE_DIV)
+                        result = script_obj_div (obj_a, obj_b);
+                else if (exp->type == SCRIPT_EXP_TYPE_MOD)
+                        result = script_obj_mod (obj_a, obj_b);
+        }
+        script_obj_unref (obj_a);
+        script_obj_unref (obj_b);
+
+        if (result) {
+                folded = script_optimize_obj_as_exp (result, exp);
+                script_obj_unref (result);
+        }
+        if (!folded)
+                return exp;
+        script_parse_exp_free (exp);
+        return folded;
+}
+
+/* "a && b" is a if a is false and b otherwise, "a || b" the reverse */
+static script_exp_t *script_optimize_fold_logic (script_exp_t *exp)
+{
+        script_obj_t *obj_a = script_optimize_exp_as_obj (exp->data.dual.sub_a);
+        script_exp_t *result;
+        bool keep_a;
+
+        if (!obj_a)
+                return exp;
+        keep_a = script_obj_as_bool (obj_a) == (exp->type == SCRIPT_EXP_TYPE_OR);
+        script_obj_unref (obj_a);
+
+        if (keep_a) {
+                result = exp->data.dual.sub_a;
+                exp->data.dual.sub_a = NULL;
+        } else {
+                result = exp->data.dual.sub_b;
+                exp->data.dual.sub_b = NULL;
+        }
+        script_parse_exp_free (exp);
+        return result;
+}
+
+static script_exp_t *script_optimize_fold_single (script_exp_t *exp)
+{
+        script_exp_t *sub = exp->data.sub;
+        script_obj_t *obj;
+        script_exp_t *folded;
+
+        if (exp->type == SCRIPT_EXP_TYPE_POS) {
+                /* the compiler never emits anything for it */
+                script_optimize_free_shell (exp);
+                return sub;
+        }
+        if (exp->type == SCRIPT_EXP_TYPE_NEG && sub->type == SCRIPT_EXP_TYPE_TERM_NUMBER) {
+                sub->data.number = -sub->data.number;
+                script_optimize_free_shell (exp);
+                return sub;
+        }
+        if (exp->type == SCRIPT_EXP_TYPE_NOT) {
+                obj = script_optimize_exp_as_obj (sub);
+                if (!obj)
+                        return exp;
+                folded = script_optimize_new_exp (SCRIPT_EXP_TYPE_TERM_NUMBER, exp);
+                folded->data.number = !script_obj_as_bool (obj);
+                script_obj_unref (obj);
+                script_parse_exp_free (exp);
+                return folded;
+        }
+        return exp;
+}
+
+static ply_list_t *script_optimize_exp_list (ply_list_t *list);
+
+static script_exp_t *script_optimize_exp (script_exp_t *exp)
+{
+        if (!exp) return NULL;
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+                exp->data.dual.sub_a = script_optimize_exp (exp->data.dual.sub_a);
+                exp->data.dual.sub_b = script_optimize_exp (exp->data.dual.sub_b);
+                return script_optimize_fold_dual (exp);
+
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+                exp->data.dual.sub_a = script_optimize_exp (exp->data.dual.sub_a);
+                exp->data.dual.sub_b = script_optimize_exp (exp->data.dual.sub_b);
+                return script_optimize_fold_logic (exp);
+
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                exp->data.dual.sub_a = script_optimize_exp (exp->data.dual.sub_a);
+                exp->data.dual.sub_b = script_optimize_exp (exp->data.dual.sub_b);
+                return exp;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+                exp->data.sub = script_optimize_exp (exp->data.sub);
+                return script_optimize_fold_single (exp);
+
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                exp->data.sub = script_optimize_exp (exp->data.sub);
+                return exp;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                exp->data.parameters = script_optimize_exp_list (exp->data.parameters);
+                return exp;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                exp->data.function_exe.name = script_optimize_exp (exp->data.function_exe.name);
+                exp->data.function_exe.parameters = script_optimize_exp_list (exp->data.function_exe.parameters);
+                return exp;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                if (exp->data.function_def->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
+                        exp->data.function_def->data.script = script_optimize_op (exp->data.function_def->data.script);
+                return exp;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                return exp;
+        }
+        return exp;
+}
+
+static ply_list_t *script_optimize_exp_list (ply_list_t *list)
+{
+        ply_list_t *optimized = ply_list_new ();
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (list);
+             node;
+             node = ply_list_get_next_node (list, node)) {
+                script_exp_t *exp = ply_list_node_get_data (node);
+                ply_list_append_data (optimized, script_optimize_exp (exp));
+        }
+        ply_list_free (list);
+        return optimized;
+}
+
+static void script_optimize_loop_write (script_optimize_loop_t *loop,
+                                        const char             *name)
+{
+        if (!ply_hashtable_lookup (loop->written, (void *) name)) {
+                char *copy = strdup (name);
+                ply_hashtable_insert (loop->written, copy, copy);
+        }
+}
+
+static void script_optimize_scan_exp (script_optimize_loop_t *loop,
+                                      script_exp_t           *exp);
+
+static void script_optimize_scan_exp_list (script_optimize_loop_t *loop,
+                                           ply_list_t             *list)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (list);
+             node;
+             node = ply_list_get_next_node (list, node)) {
+                script_optimize_scan_exp (loop, ply_list_node_get_data (node));
+        }
+}
+
+/* Notes every name the loop may write and whether anything rules it out */
+static void script_optimize_scan_exp (script_optimize_loop_t *loop,
+                                      script_exp_t           *exp)
+{
+        char buffer[64];
+
+        if (!exp) return;
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_HASH:
+                /* Reading an element creates it, the hash may be a scope and
+                 * a variable used as one is turned into a hash.
+                 */
+                if (exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING) {
+                        script_optimize_loop_write (loop, exp->data.dual.sub_b->data.string);
+                } else if (exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_NUMBER) {
+                        snprintf (buffer, sizeof(buffer), "%g", exp->data.dual.sub_b->data.number);
+                        script_optimize_loop_write (loop, buffer);
+                } else {
+                        loop->blocked = true;
+                }
+        /* fall through */
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                if (exp->data.dual.sub_a->type == SCRIPT_EXP_TYPE_TERM_VAR)
+                        script_optimize_loop_write (loop, exp->data.dual.sub_a->data.string);
+        /* fall through */
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+                script_optimize_scan_exp (loop, exp->data.dual.sub_a);
+                script_optimize_scan_exp (loop, exp->data.dual.sub_b);
+                break;
+
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                if (exp->data.sub->type == SCRIPT_EXP_TYPE_TERM_VAR)
+                        script_optimize_loop_write (loop, exp->data.sub->data.string);
+        /* fall through */
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+                script_optimize_scan_exp (loop, exp->data.sub);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                script_optimize_scan_exp_list (loop, exp->data.parameters);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                loop->blocked = true;
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                break;
+        }
+}
+
+static void script_optimize_scan_op (script_optimize_loop_t *loop,
+                                     script_op_t            *op)
+{
+        ply_list_node_t *node;
+
+        if (!op) return;
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                script_optimize_scan_exp (loop, op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        script_optimize_scan_op (loop, ply_list_node_get_data (node));
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                script_optimize_scan_exp (loop, op->data.cond_op.cond);
+                script_optimize_scan_op (loop, op->data.cond_op.op1);
+                script_optimize_scan_op (loop, op->data.cond_op.op2);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+}
+
+/* Collects the names read every time the expression is evaluated */
+static void script_optimize_scan_reads (ply_hashtable_t *read,
+                                        script_exp_t    *exp)
+{
+        if (!exp) return;
+
+        if (exp->type == SCRIPT_EXP_TYPE_TERM_VAR) {
+                ply_hashtable_insert (read, exp->data.string, exp->data.string);
+                return;
+        }
+        if (exp->type == SCRIPT_EXP_TYPE_AND || exp->type == SCRIPT_EXP_TYPE_OR) {
+                script_optimize_scan_reads (read, exp->data.dual.sub_a);
+                return;
+        }
+        if ((exp->type >= SCRIPT_EXP_TYPE_PLUS && exp->type <= SCRIPT_EXP_TYPE_NE) ||
+            exp->type == SCRIPT_EXP_TYPE_HASH) {
+                script_optimize_scan_reads (read, exp->data.dual.sub_a);
+                script_optimize_scan_reads (read, exp->data.dual.sub_b);
+                return;
+        }
+        if (exp->type >= SCRIPT_EXP_TYPE_ASSIGN && exp->type <= SCRIPT_EXP_TYPE_ASSIGN_MOD) {
+                script_optimize_scan_reads (read, exp->data.dual.sub_b);
+                return;
+        }
+        if (exp->type == SCRIPT_EXP_TYPE_NOT || exp->type == SCRIPT_EXP_TYPE_NEG)
+                script_optimize_scan_reads (read, exp->data.sub);
+}
+
+/* Only the statements before anything which could leave the body count */
+static void script_optimize_scan_body_reads (script_optimize_loop_t *loop,
+                                             script_op_t            *op)
+{
+        ply_list_node_t *node;
+
+        if (!op) return;
+
+        if (op->type == SCRIPT_OP_TYPE_EXPRESSION) {
+                script_optimize_scan_reads (loop->body_read, op->data.exp);
+                return;
+        }
+        if (op->type != SCRIPT_OP_TYPE_OP_BLOCK)
+                return;
+
+        for (node = ply_list_get_first_node (op->data.list);
+             node;
+             node = ply_list_get_next_node (op->data.list, node)) {
+                script_op_t *sub_op = ply_list_node_get_data (node);
+                if (sub_op->type != SCRIPT_OP_TYPE_EXPRESSION)
+                        break;
+                script_optimize_scan_reads (loop->body_read, sub_op->data.exp);
+        }
+}
+
+/* Copies a condition which can be evaluated twice without anything to show
+ * for it, or returns NULL.
+ */
+static script_exp_t *script_optimize_copy_cond (script_exp_t *exp)
+{
+        script_exp_t *copy;
+
+        if (exp->type == SCRIPT_EXP_TYPE_TERM_NULL ||
+            exp->type == SCRIPT_EXP_TYPE_TERM_NUMBER) {
+                copy = script_optimize_new_exp (exp->type, exp);
+                copy->data.number = exp->data.number;
+                return copy;
+        }
+        if (exp->type == SCRIPT_EXP_TYPE_TERM_STRING ||
+            exp->type == SCRIPT_EXP_TYPE_TERM_VAR) {
+                copy = script_optimize_new_exp (exp->type, exp);
+                copy->data.string = strdup (exp->data.string);
+                return copy;
+        }
+        if ((exp->type >= SCRIPT_EXP_TYPE_PLUS && exp->type <= SCRIPT_EXP_TYPE_OR) ||
+            exp->type == SCRIPT_EXP_TYPE_HASH) {
+                copy = script_optimize_new_exp (exp->type, exp);
+                copy->data.dual.sub_a = script_optimize_copy_cond (exp->data.dual.sub_a);
+                copy->data.dual.sub_b = script_optimize_copy_cond (exp->data.dual.sub_b);
+                if (copy->data.dual.sub_a && copy->data.dual.sub_b)
+                        return copy;
+                script_parse_exp_free (copy);
+                return NULL;
+        }
+        if (exp->type == SCRIPT_EXP_TYPE_NOT) {
+                copy = script_optimize_new_exp (exp->type, exp);
+                copy->data.sub = script_optimize_copy_cond (exp->data.sub);
+                if (copy->data.sub)
+                        return copy;
+                script_optimize_free_shell (copy);
+                return NULL;
+        }
+        return NULL;
+}
+
+static bool script_optimize_is_invariant (script_optimize_loop_t *loop,
+                                          script_exp_t           *exp,
+                                          bool                   *reads_variable,
+                                          bool                   *needs_guard)
+{
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+                return true;
+
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                *reads_variable = true;
+                if (ply_hashtable_lookup (loop->written, exp->data.string))
+                        return false;
+                if (ply_hashtable_lookup (loop->read, exp->data.string))
+                        return true;
+                *needs_guard = true;
+                return ply_hashtable_lookup (loop->body_read, exp->data.string) != NULL;
+
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+                return script_optimize_is_invariant (loop, exp->data.dual.sub_a, reads_variable, needs_guard) &&
+                       script_optimize_is_invariant (loop, exp->data.dual.sub_b, reads_variable, needs_guard);
+
+        case SCRIPT_EXP_TYPE_NOT:
+                return script_optimize_is_invariant (loop, exp->data.sub, reads_variable, needs_guard);
+
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+        case SCRIPT_EXP_TYPE_TERM_SET:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+        case SCRIPT_EXP_TYPE_HASH:
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                break;
+        }
+        return false;
+}
+
+/* Replaces invariant expressions with a variable set before the loop.  Only
+ * places which just read the value qualify, anywhere else the variable
+ * itself could end up being modified.
+ */
+static script_exp_t *script_optimize_hoist_exp (script_optimize_loop_t *loop,
+                                                script_exp_t           *exp,
+                                                bool                    read_only)
+{
+        bool reads_variable = false;
+        bool needs_guard = false;
+        bool operands_read_only;
+        script_exp_t *var, *assign;
+        char name[32];
+
+        if (!exp) return NULL;
+
+        if (read_only &&
+            exp->type != SCRIPT_EXP_TYPE_TERM_VAR &&
+            script_optimize_is_invariant (loop, exp, &reads_variable, &needs_guard) &&
+            reads_variable) {
+                loop->guard |= needs_guard;
+                /* Starts with a digit so it cannot clash with a script name */
+                snprintf (name, sizeof(name), "0hoisted%d", script_optimize_hoisted_count++);
+
+                var = script_optimize_new_exp (SCRIPT_EXP_TYPE_TERM_VAR, exp);
+                var->data.string = strdup (name);
+                assign = script_optimize_new_exp (SCRIPT_EXP_TYPE_ASSIGN, exp);
+                assign->data.dual.sub_a = script_optimize_new_exp (SCRIPT_EXP_TYPE_TERM_VAR, exp);
+                assign->data.dual.sub_a->data.string = strdup (name);
+                assign->data.dual.sub_b = exp;
+                ply_list_append_data (loop->hoisted, assign);
+                return var;
+        }
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+                exp->data.dual.sub_a = script_optimize_hoist_exp (loop, exp->data.dual.sub_a, true);
+                exp->data.dual.sub_b = script_optimize_hoist_exp (loop, exp->data.dual.sub_b, true);
+                break;
+
+        case SCRIPT_EXP_TYPE_HASH:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+                exp->data.dual.sub_a = script_optimize_hoist_exp (loop, exp->data.dual.sub_a, false);
+                exp->data.dual.sub_b = script_optimize_hoist_exp (loop, exp->data.dual.sub_b, true);
+                break;
+
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                exp->data.dual.sub_a = script_optimize_hoist_exp (loop, exp->data.dual.sub_a, false);
+                exp->data.dual.sub_b = script_optimize_hoist_exp (loop, exp->data.dual.sub_b, false);
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                operands_read_only = exp->type == SCRIPT_EXP_TYPE_NOT ||
+                                     exp->type == SCRIPT_EXP_TYPE_NEG;
+                exp->data.sub = script_optimize_hoist_exp (loop, exp->data.sub, operands_read_only);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+        case SCRIPT_EXP_TYPE_TERM_SET:
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                break;
+        }
+        return exp;
+}
+
+static void script_optimize_hoist_op (script_optimize_loop_t *loop,
+                                      script_op_t            *op)
+{
+        ply_list_node_t *node;
+
+        if (!op) return;
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                op->data.exp = script_optimize_hoist_exp (loop, op->data.exp, false);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        script_optimize_hoist_op (loop, ply_list_node_get_data (node));
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                op->data.cond_op.cond = script_optimize_hoist_exp (loop, op->data.cond_op.cond, true);
+                script_optimize_hoist_op (loop, op->data.cond_op.op1);
+                script_optimize_hoist_op (loop, op->data.cond_op.op2);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+}
+
+static void script_optimize_free_name (void *key,
+                                       void *data,
+                                       void *user_data)
+{
+        free (key);
+}
+
+static script_op_t *script_optimize_loop (script_op_t *op)
+{
+        script_optimize_loop_t loop;
+        ply_list_t *list;
+        ply_list_node_t *node;
+        script_op_t *block, *guard_op;
+        script_exp_t *guard_cond = NULL;
+
+        loop.written = ply_hashtable_new (ply_hashtable_string_hash, ply_hashtable_string_compare);
+        loop.read = ply_hashtable_new (ply_hashtable_string_hash, ply_hashtable_string_compare);
+        loop.body_read = ply_hashtable_new (ply_hashtable_string_hash, ply_hashtable_string_compare);
+        loop.hoisted = ply_list_new ();
+        loop.blocked = false;
+        loop.guard = false;
+
+        script_optimize_scan_op (&loop, op);
+        if (!loop.blocked && op->data.cond_op.cond) {
+                script_optimize_scan_reads (loop.read, op->data.cond_op.cond);
+                guard_cond = script_optimize_copy_cond (op->data.cond_op.cond);
+                if (guard_cond)
+                        script_optimize_scan_body_reads (&loop, op->data.cond_op.op1);
+                script_optimize_hoist_op (&loop, op);
+        }
+
+        ply_hashtable_foreach (loop.written, script_optimize_free_name, NULL);
+        ply_hashtable_free (loop.written);
+        ply_hashtable_free (loop.read);
+        ply_hashtable_free (loop.body_read);
+
+        if (ply_list_get_length (loop.hoisted) == 0 || !loop.guard) {
+                script_parse_exp_free (guard_cond);
+                guard_cond = NULL;
+        }
+        if (ply_list_get_length (loop.hoisted) == 0) {
+                ply_list_free (loop.hoisted);
+                return op;
+        }
+
+        list = ply_list_new ();
+        for (node = ply_list_get_first_node (loop.hoisted);
+             node;
+             node = ply_list_get_next_node (loop.hoisted, node)) {
+                script_exp_t *assign = ply_list_node_get_data (node);
+                script_op_t *assign_op = script_optimize_new_op (SCRIPT_OP_TYPE_EXPRESSION, assign);
+                assign_op->data.exp = assign;
+                ply_list_append_data (list, assign_op);
+        }
+        ply_list_append_data (list, op);
+        ply_list_free (loop.hoisted);
+
+        block = script_optimize_new_op (SCRIPT_OP_TYPE_OP_BLOCK, op);
+        block->data.list = list;
+        if (!guard_cond)
+                return block;
+
+        guard_op = script_optimize_new_op (SCRIPT_OP_TYPE_IF, op);
+        guard_op->data.cond_op.cond = guard_cond;
+        guard_op->data.cond_op.op1 = block;
+        guard_op->data.cond_op.op2 = NULL;
+        return guard_op;
+}
+
+static script_op_t *script_optimize_empty_op (script_op_t *like)
+{
+        script_op_t *op = script_optimize_new_op (SCRIPT_OP_TYPE_OP_BLOCK, like);
+
+        op->data.list = ply_list_new ();
+        return op;
+}
+
+static script_op_t *script_optimize_op (script_op_t *op)
+{
+        ply_list_t *list;
+        ply_list_node_t *node;
+        script_obj_t *cond;
+        script_op_t *taken;
+
+        if (!op) return NULL;
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                op->data.exp = script_optimize_exp (op->data.exp);
+                return op;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                list = ply_list_new ();
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        ply_list_append_data (list, script_optimize_op (ply_list_node_get_data (node)));
+                }
+                ply_list_free (op->data.list);
+                op->data.list = list;
+                return op;
+
+        case SCRIPT_OP_TYPE_IF:
+                op->data.cond_op.cond = script_optimize_exp (op->data.cond_op.cond);
+                op->data.cond_op.op1 = script_optimize_op (op->data.cond_op.op1);
+                op->data.cond_op.op2 = script_optimize_op (op->data.cond_op.op2);
+
+                cond = script_optimize_exp_as_obj (op->data.cond_op.cond);
+                if (!cond)
+                        return op;
+                if (script_obj_as_bool (cond)) {
+                        taken = op->data.cond_op.op1;
+                        op->data.cond_op.op1 = NULL;
+                } else {
+                        taken = op->data.cond_op.op2;
+                        op->data.cond_op.op2 = NULL;
+                }
+                script_obj_unref (cond);
+                if (!taken)
+                        taken = script_optimize_empty_op (op);
+                script_parse_op_free (op);
+                return taken;
+
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                op->data.cond_op.cond = script_optimize_exp (op->data.cond_op.cond);
+                op->data.cond_op.op1 = script_optimize_op (op->data.cond_op.op1);
+                op->data.cond_op.op2 = script_optimize_op (op->data.cond_op.op2);
+                return script_optimize_loop (op);
+
+        case SCRIPT_OP_TYPE_DO_WHILE:
+                op->data.cond_op.cond = script_optimize_exp (op->data.cond_op.cond);
+                op->data.cond_op.op1 = script_optimize_op (op->data.cond_op.op1);
+                return op;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                return op;
+        }
+        return op;
+}
+
+/* Folds constant expressions, drops the branches of if statements with a
+ * constant condition and moves loop invariant arithmetic out of loops.
+ * The result behaves exactly as the original.
+ */
+script_op_t *script_optimize (script_op_t *op)
+{
+        return script_optimize_op (op);
+}
@@ -28,16 +28,22 @@
 #include "ply-list.h"
 #include "ply-bitarray.h"
 #include "ply-logger.h"
+#include "ply-utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <assert.h>
 #include <math.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdbool.h>
 
+#include "script-cache.h"
+#include "script-compile.h"
 #include "script-debug.h"
+#include "script-optimize.h"
 #include "script-scan.h"
 #include "script-parse.h"
 
@@ -54,7 +60,6 @@ static script_op_t *script_parse_op (script_scan_t *scan);
 static script_exp_t *script_parse_exp (script_scan_t *scan);
 static ply_list_t *script_parse_op_list (script_scan_t *scan);
 static void script_parse_op_list_free (ply_list_t *op_list);
-static void script_parse_exp_free (script_exp_t *exp);
 
 static script_exp_t *script_parse_new_exp (script_exp_type_t        type,
                                            script_debug_location_t *location)
@@ -186,9 +191,12 @@ static script_op_t *script_parse_new_op_cond (script_op_type_t         type,
         return op;
 }
 
+static int script_parse_error_count;
+
 static void script_parse_error (script_debug_location_t *location,
                                 const char              *message)
 {
+        script_parse_error_count++;
         ply_error ("Parser error \"%s\" L:%d C:%d : %s\n",
                    location->name,
                    location->line_index,
@@ -880,7 +888,7 @@ static ply_list_t *script_parse_op_list (script_scan_t *scan)
         return op_list;
 }
 
-static void script_parse_exp_free (script_exp_t *exp)
+void script_parse_exp_free (script_exp_t *exp)
 {
         if (!exp) return;
         switch (exp->type) {
@@ -955,6 +963,7 @@ static void script_parse_exp_free (script_exp_t *exp)
         {
                 if (exp->data.function_def->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
                         script_parse_op_free (exp->data.function_def->data.script);
+                script_code_free (exp->data.function_def->code);
                 ply_list_node_t *node;
                 for (node = ply_list_get_first_node (exp->data.function_def->parameters);
                      node;
@@ -1024,12 +1033,22 @@ static void script_parse_op_list_free (ply_list_t *op_list)
         return;
 }
 
-script_op_t *script_parse_file (const char *filename)
+/* Scans and parses a whole script, unless an earlier run left the result in
+ * the cache.
+ */
+static script_op_t *script_parse_source (const char *source,
+                                         const char *name)
 {
-        script_scan_t *scan = script_scan_file (filename);
+        script_op_t *op = script_cache_load (source, name);
+        int error_count = script_parse_error_count;
+
+        if (op)
+                return op;
+
+        script_scan_t *scan = script_scan_string (source, name);
 
         if (!scan) {
-                ply_error ("Parser error : Error opening file %s\n", filename);
+                ply_error ("Parser error : Error creating a parser with a string");
                 return NULL;
         }
         script_scan_token_t *curtoken = script_scan_get_current_token (scan);
@@ -1042,31 +1061,48 @@ script_op_t *script_parse_file (const char *filename)
                 script_parse_op_list_free (list);
                 return NULL;
         }
-        script_op_t *op = script_parse_new_op_block (list, &location);
+        op = script_parse_new_op_block (list, &location);
         script_scan_free (scan);
+        op = script_optimize (op);
+
+        /* A cached tree would hide the errors from later runs */
+        if (error_count == script_parse_error_count)
+                script_cache_save (source, name, op);
         return op;
 }
 
-script_op_t *script_parse_string (const char *string,
-                                  const char *name)
+script_op_t *script_parse_file (const char *filename)
 {
-        script_scan_t *scan = script_scan_string (string, name);
-
-        if (!scan) {
-                ply_error ("Parser error : Error creating a parser with a string");
+        struct stat file_info;
+        script_op_t *op;
+        char *source;
+        int fd;
+
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || fstat (fd, &file_info) < 0) {
+                if (fd >= 0)
+                        close (fd);
+                ply_error ("Parser error : Error opening file %s\n", filename);
                 return NULL;
         }
-        script_scan_token_t *curtoken = script_scan_get_current_token (scan);
-        script_debug_location_t location = curtoken->location;
-        ply_list_t *list = script_parse_op_list (scan);
 
-        curtoken = script_scan_get_current_token (scan);
-        if (curtoken->type != SCRIPT_SCAN_TOKEN_TYPE_EOF) {
-                script_parse_error (&curtoken->location, "Unparsed characters at end of file");
-                script_parse_op_list_free (list);
+        source = malloc (file_info.st_size + 1);
+        if (!ply_read (fd, source, file_info.st_size)) {
+                ply_error ("Parser error : Error reading file %s\n", filename);
+                close (fd);
+                free (source);
                 return NULL;
         }
-        script_op_t *op = script_parse_new_op_block (list, &location);
-        script_scan_free (scan);
+        source[file_info.st_size] = '\0';
+        close (fd);
+
+        op = script_parse_source (source, filename);
+        free (source);
         return op;
 }
+
+script_op_t *script_parse_string (const char *string,
+                                  const char *name)
+{
+        return script_parse_source (string, name);
+}
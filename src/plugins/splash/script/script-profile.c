@@ -0,0 +1,225 @@
+/* script-profile.c - time and allocation profiling of scripts
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ply-hashtable.h"
+#include "ply-logger.h"
+#include "ply-utils.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script-debug.h"
+#include "script-object.h"
+#include "script-profile.h"
+
+#define SCRIPT_PROFILE_LOG_ENTRIES 20
+
+/* Time and allocations are charged to the line which was last entered, so
+ * lines get their own cost plus that of any native functions they call,
+ * while functions get everything that happens until they return.  Entries
+ * are referenced by compiled code and so are never freed.
+ */
+static bool script_profile_enabled;
+static char *script_profile_filename;
+static ply_hashtable_t *script_profile_lines;
+static ply_hashtable_t *script_profile_functions;
+static script_profile_entry_t *script_profile_current;
+static double script_profile_time;
+static unsigned long script_profile_allocations;
+
+void script_profile_start (const char *filename)
+{
+        if (script_profile_enabled)
+                return;
+
+        script_profile_enabled = true;
+        script_profile_filename = filename ? strdup (filename) : NULL;
+        if (!script_profile_lines) {
+                script_profile_lines = ply_hashtable_new (ply_hashtable_string_hash,
+                                                          ply_hashtable_string_compare);
+                script_profile_functions = ply_hashtable_new (ply_hashtable_string_hash,
+                                                              ply_hashtable_string_compare);
+        }
+        script_profile_current = NULL;
+        script_profile_time = ply_get_timestamp ();
+        script_profile_allocations = script_obj_get_allocation_count ();
+}
+
+bool script_profile_is_enabled (void)
+{
+        return script_profile_enabled;
+}
+
+static script_profile_entry_t *script_profile_get_entry (ply_hashtable_t *entries,
+                                                         void            *element)
+{
+        script_debug_location_t *location = script_debug_lookup_element (element);
+        script_profile_entry_t *entry;
+        char *label;
+
+        if (!location)
+                return NULL;
+
+        asprintf (&label, "%s:%d", location->name, location->line_index);
+        entry = ply_hashtable_lookup (entries, label);
+        if (entry) {
+                free (label);
+                return entry;
+        }
+        entry = calloc (1, sizeof(script_profile_entry_t));
+        entry->label = label;
+        ply_hashtable_insert (entries, label, entry);
+        return entry;
+}
+
+script_profile_entry_t *script_profile_get_line (void *element)
+{
+        return script_profile_get_entry (script_profile_lines, element);
+}
+
+script_profile_entry_t *script_profile_get_function (void *element)
+{
+        return script_profile_get_entry (script_profile_functions, element);
+}
+
+static void script_profile_charge (void)
+{
+        double now = ply_get_timestamp ();
+        unsigned long allocations = script_obj_get_allocation_count ();
+
+        if (script_profile_current) {
+                script_profile_current->time += now - script_profile_time;
+                script_profile_current->allocations += allocations - script_profile_allocations;
+        }
+        script_profile_time = now;
+        script_profile_allocations = allocations;
+}
+
+void script_profile_line (script_profile_entry_t *line)
+{
+        script_profile_charge ();
+        script_profile_current = line;
+        line->count++;
+}
+
+void script_profile_enter (script_profile_frame_t *frame,
+                           script_profile_entry_t *function)
+{
+        script_profile_charge ();
+        frame->function = function;
+        frame->caller_line = script_profile_current;
+        frame->start_time = script_profile_time;
+        frame->start_allocations = script_profile_allocations;
+        script_profile_current = NULL;
+}
+
+void script_profile_leave (script_profile_frame_t *frame)
+{
+        script_profile_charge ();
+        frame->function->time += script_profile_time - frame->start_time;
+        frame->function->allocations += script_profile_allocations - frame->start_allocations;
+        frame->function->count++;
+        script_profile_current = frame->caller_line;
+}
+
+static void script_profile_collect (void *key,
+                                    void *data,
+                                    void *user_data)
+{
+        script_profile_entry_t ***next = user_data;
+
+        **next = data;
+        (*next)++;
+}
+
+static int script_profile_compare (const void *a,
+                                   const void *b)
+{
+        const script_profile_entry_t *entry_a = *(script_profile_entry_t * const *) a;
+        const script_profile_entry_t *entry_b = *(script_profile_entry_t * const *) b;
+
+        if (entry_a->time > entry_b->time) return -1;
+        if (entry_a->time < entry_b->time) return 1;
+        return strcmp (entry_a->label, entry_b->label);
+}
+
+/* Writes the entries, most expensive first, and clears them */
+static void script_profile_report (FILE            *file,
+                                   const char      *title,
+                                   ply_hashtable_t *entries)
+{
+        int count = ply_hashtable_get_size (entries);
+        script_profile_entry_t *sorted[count + 1];
+        script_profile_entry_t **next = sorted;
+        int i;
+
+        ply_hashtable_foreach (entries, script_profile_collect, &next);
+        qsort (sorted, count, sizeof(script_profile_entry_t *), script_profile_compare);
+
+        if (file)
+                fprintf (file, "%s\n%12s %10s %12s  %s\n", title, "ms", "count", "allocations", "location");
+        else
+                ply_trace ("%s", title);
+
+        for (i = 0; i < count; i++) {
+                script_profile_entry_t *entry = sorted[i];
+
+                if (file)
+                        fprintf (file, "%12.3f %10lu %12lu  %s\n",
+                                 entry->time * 1000, entry->count, entry->allocations, entry->label);
+                else if (i < SCRIPT_PROFILE_LOG_ENTRIES)
+                        ply_trace ("%10.3fms %8lu calls %10lu allocations  %s",
+                                   entry->time * 1000, entry->count, entry->allocations, entry->label);
+                entry->time = 0;
+                entry->allocations = 0;
+                entry->count = 0;
+        }
+}
+
+/* Reports to the file given to script_profile_start, or the debug log */
+void script_profile_stop (void)
+{
+        FILE *file = NULL;
+
+        if (!script_profile_enabled)
+                return;
+
+        if (script_profile_filename) {
+                file = fopen (script_profile_filename, "w");
+                if (!file)
+                        ply_trace ("could not write script profile to %s: %m", script_profile_filename);
+        }
+
+        script_profile_report (file, "script functions, including callees:", script_profile_functions);
+        if (file)
+                fprintf (file, "\n");
+        script_profile_report (file, "script lines, including native calls:", script_profile_lines);
+
+        if (file)
+                fclose (file);
+        free (script_profile_filename);
+        script_profile_filename = NULL;
+        script_profile_enabled = false;
+}
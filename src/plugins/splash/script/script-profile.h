@@ -0,0 +1,51 @@
+/* script-profile.h - time and allocation profiling of scripts
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_PROFILE_H
+#define SCRIPT_PROFILE_H
+
+#include <stdbool.h>
+
+typedef struct
+{
+        char         *label;
+        double        time;
+        unsigned long allocations;
+        unsigned long count;
+} script_profile_entry_t;
+
+typedef struct
+{
+        script_profile_entry_t *function;
+        script_profile_entry_t *caller_line;
+        double                  start_time;
+        unsigned long           start_allocations;
+} script_profile_frame_t;
+
+void script_profile_start (const char *filename);
+void script_profile_stop (void);
+bool script_profile_is_enabled (void);
+script_profile_entry_t *script_profile_get_line (void *element);
+script_profile_entry_t *script_profile_get_function (void *element);
+void script_profile_line (script_profile_entry_t *line);
+void script_profile_enter (script_profile_frame_t *frame,
+                           script_profile_entry_t *function);
+void script_profile_leave (script_profile_frame_t *frame);
+
+#endif /* SCRIPT_PROFILE_H */
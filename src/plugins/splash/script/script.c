@@ -49,6 +49,7 @@ script_function_t *script_function_script_new (script_op_t *script,
         function->type = SCRIPT_FUNCTION_TYPE_SCRIPT;
         function->parameters = parameter_list;
         function->data.script = script;
+        function->code = NULL;
         function->freeable = false;
         function->user_data = user_data;
         return function;
@@ -63,6 +64,7 @@ script_function_t *script_function_native_new (script_native_function_t native_f
         function->type = SCRIPT_FUNCTION_TYPE_NATIVE;
         function->parameters = parameter_list;
         function->data.native = native_function;
+        function->code = NULL;
         function->freeable = true;
         function->user_data = user_data;
         return function;
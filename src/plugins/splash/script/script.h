@@ -25,6 +25,7 @@
 #include "ply-hashtable.h"
 #include "ply-list.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef enum                        /* FIXME add _t to all types */
 {
@@ -70,6 +71,7 @@ typedef struct script_function_t
                 script_native_function_t native;
                 struct script_op_t      *script;
         } data;
+        struct script_code_t  *code;       /* compiled on first call */
         bool                   freeable;
 } script_function_t;
 
@@ -117,7 +119,7 @@ typedef struct script_obj_t
                         struct script_obj_t *obj_b;
                 } dual_obj;
                 script_function_t   *function;
-                ply_hashtable_t     *hash;
+                struct script_hash_t *hash;
                 script_obj_native_t  native;
         } data;
 } script_obj_t;
@@ -220,10 +222,25 @@ typedef struct script_op_t
 
 typedef struct
 {
-        char         *name;
-        script_obj_t *object;
+        struct script_atom_t *name;
+        script_obj_t         *object;
 } script_variable_t;
 
+/* Small integer keys live in a vector, everything else in a table keyed by
+ * atom.  An integer key only goes to the table when it is far beyond the end
+ * of the vector, and table_index_count says whether any did.  The version is
+ * unique across all hashes and changes whenever an element is added or the
+ * hash is destroyed.
+ */
+typedef struct script_hash_t
+{
+        ply_hashtable_t *table;
+        script_obj_t   **vector;
+        int              vector_size;
+        int              table_index_count;
+        uint64_t         version;
+} script_hash_t;
+
 
 #define script_return_obj(_return_object) ((script_return_t) { SCRIPT_RETURN_TYPE_RETURN, _return_object })
 #define script_return_obj_null() ((script_return_t) { SCRIPT_RETURN_TYPE_RETURN, script_obj_new_null () })
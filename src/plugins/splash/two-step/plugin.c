@@ -81,6 +81,46 @@
 #define BGRT_STATUS_ORIENTATION_OFFSET_270  (3 << 1)
 #define BGRT_STATUS_ORIENTATION_OFFSET_MASK (3 << 1)
 
+#define BGRT_IMAGE_FILE "/sys/firmware/acpi/bgrt/image"
+
+#define BGRT_CACHE_MAGIC   0x54524742 /* "BGRT" */
+#define BGRT_CACHE_VERSION 2
+
+/* Everything the placement of the firmware logo depends on */
+typedef struct
+{
+        uint64_t image_checksum;
+        int32_t  screen_width;
+        int32_t  screen_height;
+        int32_t  screen_scale;
+        int32_t  have_panel_props;
+        int32_t  panel_width;
+        int32_t  panel_height;
+        int32_t  panel_rotation;
+        int32_t  panel_scale;
+        int32_t  sysfs_x_offset;
+        int32_t  sysfs_y_offset;
+        int32_t  bgrt_rotation;
+        int32_t  reserved;
+        char     package_version[32];   /* placement rules change between builds */
+} bgrt_cache_key_t;
+
+/* The cache files hold the logo already rotated upright and scaled, and
+ * where it goes on the otherwise black background, followed by its pixels
+ */
+typedef struct
+{
+        uint32_t         magic;
+        uint32_t         version;
+        bgrt_cache_key_t key;
+        int32_t          x_offset;
+        int32_t          y_offset;
+        uint32_t         logo_width;
+        uint32_t         logo_height;
+        int32_t          logo_scale;
+        uint32_t         logo_is_opaque;
+} bgrt_cache_header_t;
+
 typedef enum
 {
         PLY_BOOT_SPLASH_DISPLAY_NORMAL,
@@ -113,6 +153,7 @@ typedef struct
         ply_trigger_t            *end_trigger;
         ply_pixel_buffer_t       *background_buffer;
         int                       animation_bottom;
+        bool                      background_is_tiled;
 } view_t;
 
 typedef struct
@@ -166,6 +207,7 @@ struct _ply_boot_splash_plugin
         uint32_t                            background_end_color;
         int                                 background_bgrt_raw_width;
         int                                 background_bgrt_raw_height;
+        uint64_t                            background_bgrt_checksum;
 
         double                              progress_bar_horizontal_alignment;
         double                              progress_bar_vertical_alignment;
@@ -397,6 +439,183 @@ out:
         return ret;
 }
 
+/* FNV-1a over the firmware logo, so a firmware update that changes the
+ * logo doesn't pick up stale cache files
+ */
+static bool
+get_bgrt_image_checksum (uint64_t *checksum)
+{
+        uint8_t buf[64 * 1024];
+        ssize_t bytes_read;
+        uint64_t hash;
+        int fd;
+
+        fd = open (BGRT_IMAGE_FILE, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return false;
+
+        hash = 0xcbf29ce484222325ULL;
+        do {
+                ssize_t i;
+
+                bytes_read = read (fd, buf, sizeof(buf));
+
+                for (i = 0; i < bytes_read; i++) {
+                        hash ^= buf[i];
+                        hash *= 0x100000001b3ULL;
+                }
+        } while (bytes_read > 0 || (bytes_read < 0 && errno == EINTR));
+
+        close (fd);
+
+        if (bytes_read < 0)
+                return false;
+
+        *checksum = hash;
+        return true;
+}
+
+static char *
+get_bgrt_cache_filename (bgrt_cache_key_t *key)
+{
+        char *filename = NULL;
+
+        asprintf (&filename, PLYMOUTH_STATE_DIRECTORY "bgrt-%dx%d@%d.cache",
+                  key->screen_width, key->screen_height, key->screen_scale);
+
+        return filename;
+}
+
+static ply_pixel_buffer_t *
+load_bgrt_cache (bgrt_cache_key_t *key,
+                 int              *x_offset,
+                 int              *y_offset)
+{
+        bgrt_cache_header_t header;
+        ply_pixel_buffer_t *logo_buffer = NULL;
+        char *filename;
+        int fd;
+
+        filename = get_bgrt_cache_filename (key);
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
+        free (filename);
+
+        if (fd < 0)
+                return NULL;
+
+        if (!ply_read (fd, &header, sizeof(header)))
+                goto out;
+
+        if (header.magic != BGRT_CACHE_MAGIC ||
+            header.version != BGRT_CACHE_VERSION ||
+            memcmp (&header.key, key, sizeof(bgrt_cache_key_t)) != 0) {
+                ply_trace ("bgrt cache is stale");
+                goto out;
+        }
+
+        if (header.logo_width == 0 || header.logo_width > 16384 ||
+            header.logo_height == 0 || header.logo_height > 16384 ||
+            header.logo_scale < 1)
+                goto out;
+
+        logo_buffer = ply_pixel_buffer_new (header.logo_width, header.logo_height);
+
+        if (!ply_read (fd, ply_pixel_buffer_get_argb32_data (logo_buffer),
+                       header.logo_width * header.logo_height * sizeof(uint32_t))) {
+                ply_pixel_buffer_free (logo_buffer);
+                logo_buffer = NULL;
+                goto out;
+        }
+
+        ply_pixel_buffer_set_device_scale (logo_buffer, header.logo_scale);
+        ply_pixel_buffer_set_opaque (logo_buffer, header.logo_is_opaque);
+        *x_offset = header.x_offset;
+        *y_offset = header.y_offset;
+out:
+        close (fd);
+        return logo_buffer;
+}
+
+/* Only writes the cache if the state directory is already there, so
+ * nothing gets left behind in an initramfs that doesn't ship one
+ */
+static void
+save_bgrt_cache (bgrt_cache_key_t   *key,
+                 ply_pixel_buffer_t *logo_buffer,
+                 int                 x_offset,
+                 int                 y_offset)
+{
+        bgrt_cache_header_t header;
+        unsigned long logo_width, logo_height;
+        int logo_scale;
+        char *filename, *temporary_filename;
+        bool saved;
+        int fd;
+
+        if (!ply_directory_exists (PLYMOUTH_STATE_DIRECTORY))
+                return;
+
+        logo_scale = ply_pixel_buffer_get_device_scale (logo_buffer);
+        logo_width = ply_pixel_buffer_get_width (logo_buffer) * logo_scale;
+        logo_height = ply_pixel_buffer_get_height (logo_buffer) * logo_scale;
+
+        memset (&header, 0, sizeof(header));
+        header.magic = BGRT_CACHE_MAGIC;
+        header.version = BGRT_CACHE_VERSION;
+        header.key = *key;
+        header.x_offset = x_offset;
+        header.y_offset = y_offset;
+        header.logo_width = logo_width;
+        header.logo_height = logo_height;
+        header.logo_scale = logo_scale;
+        header.logo_is_opaque = ply_pixel_buffer_is_opaque (logo_buffer);
+
+        filename = get_bgrt_cache_filename (key);
+        asprintf (&temporary_filename, "%s.XXXXXX", filename);
+
+        fd = mkostemp (temporary_filename, O_CLOEXEC);
+        if (fd < 0) {
+                ply_trace ("could not create bgrt cache %s: %m", temporary_filename);
+                free (temporary_filename);
+                free (filename);
+                return;
+        }
+
+        saved = ply_write (fd, &header, sizeof(header)) &&
+                ply_write (fd, ply_pixel_buffer_get_argb32_data (logo_buffer),
+                           logo_width * logo_height * sizeof(uint32_t));
+        saved = close (fd) == 0 && saved;
+
+        if (saved && rename (temporary_filename, filename) == 0) {
+                ply_trace ("saved bgrt cache %s", filename);
+        } else {
+                ply_trace ("could not save bgrt cache %s: %m", filename);
+                unlink (temporary_filename);
+        }
+
+        free (temporary_filename);
+        free (filename);
+}
+
+static bool
+load_bgrt_image (ply_boot_splash_plugin_t *plugin)
+{
+        if (plugin->background_bgrt_raw_width > 0)
+                return true;
+
+        ply_trace ("loading background bgrt image");
+        if (!ply_image_load (plugin->background_bgrt_image)) {
+                ply_image_free (plugin->background_bgrt_image);
+                plugin->background_bgrt_image = NULL;
+                return false;
+        }
+
+        plugin->background_bgrt_raw_width = ply_image_get_width (plugin->background_bgrt_image);
+        plugin->background_bgrt_raw_height = ply_image_get_height (plugin->background_bgrt_image);
+
+        return true;
+}
+
 /* The Microsoft boot logo spec says that the logo must use a black background
  * and have its center at 38.2% from the screen's top (golden ratio).
  * We reproduce this exactly here so that we get a background which is an exact
@@ -416,7 +635,8 @@ view_set_bgrt_background (view_t *view)
         int x_offset, y_offset, sysfs_x_offset, sysfs_y_offset, width, height;
         int panel_width = 0, panel_height = 0, panel_scale = 1;
         int screen_width, screen_height, screen_scale;
-        ply_pixel_buffer_t *bgrt_buffer;
+        ply_pixel_buffer_t *bgrt_buffer, *upright_buffer;
+        bgrt_cache_key_t cache_key;
         bool have_panel_props;
 
         if (!view->plugin->background_bgrt_image)
@@ -432,12 +652,43 @@ view_set_bgrt_background (view_t *view)
         screen_height = ply_pixel_display_get_height (view->display);
         screen_scale = ply_pixel_display_get_device_scale (view->display);
 
-        bgrt_buffer = ply_image_get_buffer (view->plugin->background_bgrt_image);
-
         have_panel_props = ply_renderer_get_panel_properties (ply_pixel_display_get_renderer (view->display),
                                                               &panel_width, &panel_height,
                                                               &panel_rotation, &panel_scale);
 
+        memset (&cache_key, 0, sizeof(cache_key));
+        cache_key.image_checksum = view->plugin->background_bgrt_checksum;
+        cache_key.screen_width = screen_width;
+        cache_key.screen_height = screen_height;
+        cache_key.screen_scale = screen_scale;
+        cache_key.have_panel_props = have_panel_props;
+        cache_key.panel_width = panel_width;
+        cache_key.panel_height = panel_height;
+        cache_key.panel_rotation = panel_rotation;
+        cache_key.panel_scale = panel_scale;
+        cache_key.sysfs_x_offset = sysfs_x_offset;
+        cache_key.sysfs_y_offset = sysfs_y_offset;
+        cache_key.bgrt_rotation = bgrt_rotation;
+        strncpy (cache_key.package_version, PACKAGE_VERSION,
+                 sizeof(cache_key.package_version) - 1);
+
+        upright_buffer = load_bgrt_cache (&cache_key, &x_offset, &y_offset);
+        if (upright_buffer != NULL) {
+                ply_trace ("using cached bgrt image at %dx%d for %dx%d screen",
+                           x_offset, y_offset, screen_width, screen_height);
+
+                view->background_buffer = ply_pixel_buffer_new (screen_width * screen_scale, screen_height * screen_scale);
+                ply_pixel_buffer_set_device_scale (view->background_buffer, screen_scale);
+                ply_pixel_buffer_fill_with_hex_color (view->background_buffer, NULL, 0x000000);
+                ply_pixel_buffer_fill_with_buffer (view->background_buffer, upright_buffer, x_offset, y_offset);
+                ply_pixel_buffer_free (upright_buffer);
+                return;
+        }
+
+        /* Only decode the firmware logo when there's no cache to use */
+        if (!load_bgrt_image (view->plugin))
+                return;
+
         /*
          * Some buggy Lenovo 2-in-1s with a 90 degree rotated panel, behave as
          * if the panel is mounted up-right / not rotated at all. These devices
@@ -483,6 +734,11 @@ view_set_bgrt_background (view_t *view)
                 panel_rotation = PLY_PIXEL_BUFFER_ROTATE_UPRIGHT;
         }
 
+        /* The image's buffer may be shared, so don't change its device
+         * properties in place
+         */
+        bgrt_buffer = ply_pixel_buffer_copy (ply_image_get_buffer (view->plugin->background_bgrt_image));
+
         if (have_panel_props) {
                 ply_pixel_buffer_set_device_rotation (bgrt_buffer, panel_rotation);
                 ply_pixel_buffer_set_device_scale (bgrt_buffer, panel_scale);
@@ -567,10 +823,13 @@ view_set_bgrt_background (view_t *view)
         ply_pixel_buffer_set_device_scale (view->background_buffer, screen_scale);
         ply_pixel_buffer_fill_with_hex_color (view->background_buffer, NULL, 0x000000);
         if (x_offset >= 0 && y_offset >= 0) {
-                bgrt_buffer = ply_pixel_buffer_rotate_upright (bgrt_buffer);
-                ply_pixel_buffer_fill_with_buffer (view->background_buffer, bgrt_buffer, x_offset, y_offset);
-                ply_pixel_buffer_free (bgrt_buffer);
+                upright_buffer = ply_pixel_buffer_rotate_upright (bgrt_buffer);
+                ply_pixel_buffer_fill_with_buffer (view->background_buffer, upright_buffer, x_offset, y_offset);
+                save_bgrt_cache (&cache_key, upright_buffer, x_offset, y_offset);
+                ply_pixel_buffer_free (upright_buffer);
         }
+
+        ply_pixel_buffer_free (bgrt_buffer);
 }
 
 static void
@@ -597,6 +856,79 @@ view_set_bgrt_fallback_background (view_t *view)
         ply_pixel_buffer_fill_with_buffer (view->background_buffer, image_buffer, x_offset, y_offset);
 }
 
+static void
+view_fill_background_with_colors (view_t          *view,
+                                  ply_rectangle_t *area)
+{
+        ply_boot_splash_plugin_t *plugin = view->plugin;
+
+        if (plugin->background_start_color != plugin->background_end_color)
+                ply_pixel_buffer_fill_with_gradient (view->background_buffer, area,
+                                                     plugin->background_start_color,
+                                                     plugin->background_end_color);
+        else
+                ply_pixel_buffer_fill_with_hex_color (view->background_buffer, area,
+                                                      plugin->background_start_color);
+}
+
+static void
+view_add_background_tile_band (view_t          *view,
+                               ply_rectangle_t *band)
+{
+        ply_pixel_buffer_t *tile_buffer;
+        unsigned long screen_width, screen_height, tile_width, tile_height;
+        ply_rectangle_t band_area;
+        unsigned long x, y;
+
+        if (!view->background_is_tiled)
+                return;
+
+        screen_width = ply_pixel_display_get_width (view->display);
+        screen_height = ply_pixel_display_get_height (view->display);
+
+        tile_buffer = ply_image_get_buffer (view->plugin->background_tile_image);
+        tile_width = ply_pixel_buffer_get_width (tile_buffer);
+        tile_height = ply_pixel_buffer_get_height (tile_buffer);
+
+        for (y = 0; y < screen_height; y += tile_height) {
+                band_area.x = 0;
+                band_area.y = y + band->y;
+                band_area.width = screen_width;
+                band_area.height = band->height;
+
+                /* Interlaced images decode the same rows more than once,
+                 * so start the band over from the plain background
+                 */
+                view_fill_background_with_colors (view, &band_area);
+
+                for (x = 0; x < screen_width; x += tile_width) {
+                        ply_pixel_buffer_fill_with_buffer_with_clip (view->background_buffer,
+                                                                     tile_buffer, x, y,
+                                                                     &band_area);
+                }
+
+                ply_pixel_display_draw_area (view->display,
+                                             band_area.x, band_area.y,
+                                             band_area.width, band_area.height);
+        }
+}
+
+static void
+on_background_tile_image_decoded (ply_boot_splash_plugin_t *plugin,
+                                  ply_image_t              *image,
+                                  ply_rectangle_t          *band)
+{
+        ply_list_node_t *node;
+        view_t *view;
+
+        node = ply_list_get_first_node (plugin->views);
+        while (node != NULL) {
+                view = ply_list_node_get_data (node);
+                view_add_background_tile_band (view, band);
+                node = ply_list_get_next_node (plugin->views, node);
+        }
+}
+
 static bool
 view_load (view_t *view)
 {
@@ -626,15 +958,14 @@ view_load (view_t *view)
                 /* Create a buffer at screen scale so that we only do the slow interpolating scale once */
                 view->background_buffer = ply_pixel_buffer_new (screen_width * screen_scale, screen_height * screen_scale);
                 ply_pixel_buffer_set_device_scale (view->background_buffer, screen_scale);
+                view->background_is_tiled = true;
 
-                if (plugin->background_start_color != plugin->background_end_color)
-                        ply_pixel_buffer_fill_with_gradient (view->background_buffer, NULL,
-                                                             plugin->background_start_color,
-                                                             plugin->background_end_color);
-                else
-                        ply_pixel_buffer_fill_with_hex_color (view->background_buffer, NULL,
-                                                              plugin->background_start_color);
+                view_fill_background_with_colors (view, NULL);
 
+                /* If the tile image is still being decoded, the parts that
+                 * are missing are transparent, and get filled in band by
+                 * band from on_background_tile_image_decoded
+                 */
                 buffer = ply_pixel_buffer_tile (ply_image_get_buffer (plugin->background_tile_image), screen_width, screen_height);
                 ply_pixel_buffer_fill_with_buffer (view->background_buffer, buffer, 0, 0);
                 ply_pixel_buffer_free (buffer);
@@ -1204,7 +1535,7 @@ create_plugin (ply_key_file_t *key_file)
         load_mode_settings (plugin, key_file, "firmware-upgrade", PLY_BOOT_SPLASH_MODE_FIRMWARE_UPGRADE);
 
         if (plugin->use_firmware_background) {
-                plugin->background_bgrt_image = ply_image_new ("/sys/firmware/acpi/bgrt/image");
+                plugin->background_bgrt_image = ply_image_new (BGRT_IMAGE_FILE);
 
                 asprintf (&image_path, "%s/bgrt-fallback.png", image_dir);
                 plugin->background_bgrt_fallback_image = ply_image_new (image_path);
@@ -1505,10 +1836,10 @@ draw_background (view_t             *view,
                                                       plugin->background_start_color);
 
         if (plugin->watermark_image != NULL) {
-                uint32_t *data;
-
-                data = ply_image_get_data (plugin->watermark_image);
-                ply_pixel_buffer_fill_with_argb32_data (pixel_buffer, &view->watermark_area, data);
+                ply_pixel_buffer_fill_with_buffer (pixel_buffer,
+                                                   ply_image_get_buffer (plugin->watermark_image),
+                                                   view->watermark_area.x,
+                                                   view->watermark_area.y);
         }
 }
 
@@ -1532,13 +1863,11 @@ on_draw (view_t             *view,
 
         if (plugin->state == PLY_BOOT_SPLASH_DISPLAY_QUESTION_ENTRY ||
             plugin->state == PLY_BOOT_SPLASH_DISPLAY_PASSWORD_ENTRY) {
-                uint32_t *box_data, *lock_data;
-
                 if (plugin->box_image) {
-                        box_data = ply_image_get_data (plugin->box_image);
-                        ply_pixel_buffer_fill_with_argb32_data (pixel_buffer,
-                                                                &view->box_area,
-                                                                box_data);
+                        ply_pixel_buffer_fill_with_buffer (pixel_buffer,
+                                                           ply_image_get_buffer (plugin->box_image),
+                                                           view->box_area.x,
+                                                           view->box_area.y);
                 }
 
                 ply_entry_draw_area (view->entry,
@@ -1554,10 +1883,10 @@ on_draw (view_t             *view,
                                      pixel_buffer,
                                      x, y, width, height);
 
-                lock_data = ply_image_get_data (plugin->lock_image);
-                ply_pixel_buffer_fill_with_argb32_data (pixel_buffer,
-                                                        &view->lock_area,
-                                                        lock_data);
+                ply_pixel_buffer_fill_with_buffer (pixel_buffer,
+                                                   ply_image_get_buffer (plugin->lock_image),
+                                                   view->lock_area.x,
+                                                   view->lock_area.y);
         } else {
                 if (use_progress_bar (plugin))
                         ply_progress_bar_draw_area (view->progress_bar, pixel_buffer,
@@ -1583,7 +1912,7 @@ on_draw (view_t             *view,
                         image_area.x = screen_area.width - image_area.width - 20;
                         image_area.y = screen_area.height - image_area.height - 20;
 
-                        ply_pixel_buffer_fill_with_argb32_data (pixel_buffer, &image_area, ply_image_get_data (plugin->corner_image));
+                        ply_pixel_buffer_fill_with_buffer (pixel_buffer, ply_image_get_buffer (plugin->corner_image), image_area.x, image_area.y);
                 }
 
                 if (plugin->header_image != NULL) {
@@ -1604,7 +1933,7 @@ on_draw (view_t             *view,
                         image_area.x = screen_area.width / 2.0 - image_area.width / 2.0;
                         image_area.y = plugin->animation_vertical_alignment * screen_area.height - sprite_height / 2.0 - image_area.height;
 
-                        ply_pixel_buffer_fill_with_argb32_data (pixel_buffer, &image_area, ply_image_get_data (plugin->header_image));
+                        ply_pixel_buffer_fill_with_buffer (pixel_buffer, ply_image_get_buffer (plugin->header_image), image_area.x, image_area.y);
                 }
                 ply_label_draw_area (view->title_label,
                                      pixel_buffer,
@@ -1713,21 +2042,23 @@ show_splash_screen (ply_boot_splash_plugin_t *plugin,
 
         if (plugin->background_tile_image != NULL) {
                 ply_trace ("loading background tile image");
-                if (!ply_image_load (plugin->background_tile_image)) {
+                if (!ply_image_load_progressively (plugin->background_tile_image, loop,
+                                                   (ply_image_load_handler_t)
+                                                   on_background_tile_image_decoded,
+                                                   plugin)) {
                         ply_image_free (plugin->background_tile_image);
                         plugin->background_tile_image = NULL;
                 }
         }
 
-        if (plugin->background_bgrt_image != NULL) {
-                ply_trace ("loading background bgrt image");
-                if (ply_image_load (plugin->background_bgrt_image)) {
-                        plugin->background_bgrt_raw_width = ply_image_get_width (plugin->background_bgrt_image);
-                        plugin->background_bgrt_raw_height = ply_image_get_height (plugin->background_bgrt_image);
-                } else {
-                        ply_image_free (plugin->background_bgrt_image);
-                        plugin->background_bgrt_image = NULL;
-                }
+        /* The bgrt image itself only gets decoded if a view can't use the
+         * cached background, see view_set_bgrt_background
+         */
+        if (plugin->background_bgrt_image != NULL &&
+            !get_bgrt_image_checksum (&plugin->background_bgrt_checksum)) {
+                ply_trace ("could not read background bgrt image");
+                ply_image_free (plugin->background_bgrt_image);
+                plugin->background_bgrt_image = NULL;
         }
 
         if (plugin->background_bgrt_fallback_image != NULL) {